@@ -19,6 +19,91 @@
 
 #include "Sim900.h"
 
+//Every string constant below lives in flash (PROGMEM) and is read with the
+//pgm_read_* functions, on AVR they would otherwise all be copied to SRAM.
+static const char SIM900_MESSAGE_NO_ERROR[] PROGMEM = "No Error";
+static const char SIM900_MESSAGE_COULD_NOT_AQUIRE_LOCK[] PROGMEM = "Only one connection at a time can use the modem.";
+static const char SIM900_MESSAGE_BUSY[] PROGMEM = "The modem is busy processing another command.";
+static const char SIM900_MESSAGE_MODEM_ERROR[] PROGMEM = "Modem Error";
+static const char SIM900_MESSAGE_CME_ERROR[] PROGMEM = "The modem reported an equipment error (+CME ERROR).";
+static const char SIM900_MESSAGE_CMS_ERROR[] PROGMEM = "The modem reported a message service error (+CMS ERROR).";
+static const char SIM900_MESSAGE_TIMEOUT[] PROGMEM = "Timed out waiting for modem response.";
+static const char SIM900_MESSAGE_DATA_NOT_READY[] PROGMEM = "init_retrieve needs to be called before data can be read.";
+static const char SIM900_MESSAGE_MAX_POST_DATA_SIZE_EXCEEDED[] PROGMEM = "The maximum post data size was exceeded.";
+static const char SIM900_MESSAGE_READ_LIMIT_EXCEEDED[] PROGMEM = "The read limit was exceeded.";
+static const char SIM900_MESSAGE_INVALID_CID_VALUE[] PROGMEM = "Invalid Bearer profile Identifier";
+static const char SIM900_MESSAGE_CHARACTER_LIMIT_EXCEEDED[] PROGMEM = "The Maximum character limit was exceeded";
+static const char SIM900_MESSAGE_INVALID_CONNECTION_TYPE[] PROGMEM = "The specified connection type is not valid.";
+static const char SIM900_MESSAGE_INVALID_CONNECTION_RATE[] PROGMEM = "The specified connection rate is not valid.";
+static const char SIM900_MESSAGE_INVALID_HTTP_TIMEOUT[] PROGMEM = "The HTTP Timeout value must be between 30 and 1000 seconds.";
+static const char SIM900_MESSAGE_BAUD_RATE_NOT_FOUND[] PROGMEM = "The modem did not answer at any supported baud rate.";
+static const char SIM900_MESSAGE_BAUD_RATE_FIXED[] PROGMEM = "The baud rate of a Stream passed to Sim900 cannot be changed.";
+static const char SIM900_MESSAGE_NO_DTR_PIN[] PROGMEM = "Sleep mode 1 needs the DTR pin, see setDTRPin().";
+static const char SIM900_MESSAGE_NO_FREE_SOCKET[] PROGMEM = "All of the sockets are in use.";
+static const char SIM900_MESSAGE_CONNECT_FAILED[] PROGMEM = "The socket could not connect.";
+static const char SIM900_MESSAGE_SEND_FAILED[] PROGMEM = "The modem could not send the data.";
+static const char SIM900_MESSAGE_SOCKET_CLOSED[] PROGMEM = "The socket is closed.";
+static const char SIM900_MESSAGE_NO_FREE_CONNECTION[] PROGMEM = "All of the HTTP connections are in use.";
+static const char SIM900_MESSAGE_QUEUE_FULL[] PROGMEM = "There is no room left in the queue for the record.";
+static const char SIM900_MESSAGE_QUEUE_EMPTY[] PROGMEM = "The queue is empty.";
+static const char SIM900_MESSAGE_HTTP_STATUS[] PROGMEM = "The server did not answer with a 2xx status.";
+static const char SIM900_MESSAGE_WEAK_SIGNAL[] PROGMEM = "The signal is too weak for a transmission that can wait.";
+static const char SIM900_MESSAGE_UNKNOWN[] PROGMEM = "Could not find error message.";
+
+static const error_message messages[] PROGMEM =
+{
+	{SIM900_ERROR_NO_ERROR, SIM900_MESSAGE_NO_ERROR},
+	{SIM900_ERROR_COULD_NOT_AQUIRE_LOCK, SIM900_MESSAGE_COULD_NOT_AQUIRE_LOCK},
+	{SIM900_ERROR_BUSY, SIM900_MESSAGE_BUSY},
+	{SIM900_ERROR_MODEM_ERROR, SIM900_MESSAGE_MODEM_ERROR},
+	{SIM900_ERROR_CME_ERROR, SIM900_MESSAGE_CME_ERROR},
+	{SIM900_ERROR_CMS_ERROR, SIM900_MESSAGE_CMS_ERROR},
+	{SIM900_ERROR_TIMEOUT, SIM900_MESSAGE_TIMEOUT},
+	{SIM900_ERROR_DATA_NOT_READY, SIM900_MESSAGE_DATA_NOT_READY},
+	{SIM900_ERROR_MAX_POST_DATA_SIZE_EXCEEDED, SIM900_MESSAGE_MAX_POST_DATA_SIZE_EXCEEDED},
+	{SIM900_ERROR_READ_LIMIT_EXCEEDED, SIM900_MESSAGE_READ_LIMIT_EXCEEDED},
+	{SIM900_ERROR_INVALID_CID_VALUE, SIM900_MESSAGE_INVALID_CID_VALUE},
+	{SIM900_ERROR_CHARACTER_LIMIT_EXCEEDED, SIM900_MESSAGE_CHARACTER_LIMIT_EXCEEDED},
+	{SIM900_ERROR_INVALID_CONNECTION_TYPE, SIM900_MESSAGE_INVALID_CONNECTION_TYPE},
+	{SIM900_ERROR_INVALID_CONNECTION_RATE, SIM900_MESSAGE_INVALID_CONNECTION_RATE},
+	{SIM900_ERROR_INVALID_HTTP_TIMEOUT, SIM900_MESSAGE_INVALID_HTTP_TIMEOUT},
+	{SIM900_ERROR_BAUD_RATE_NOT_FOUND, SIM900_MESSAGE_BAUD_RATE_NOT_FOUND},
+	{SIM900_ERROR_BAUD_RATE_FIXED, SIM900_MESSAGE_BAUD_RATE_FIXED},
+	{SIM900_ERROR_NO_DTR_PIN, SIM900_MESSAGE_NO_DTR_PIN},
+	{SIM900_ERROR_NO_FREE_SOCKET, SIM900_MESSAGE_NO_FREE_SOCKET},
+	{SIM900_ERROR_CONNECT_FAILED, SIM900_MESSAGE_CONNECT_FAILED},
+	{SIM900_ERROR_SEND_FAILED, SIM900_MESSAGE_SEND_FAILED},
+	{SIM900_ERROR_SOCKET_CLOSED, SIM900_MESSAGE_SOCKET_CLOSED},
+	{SIM900_ERROR_NO_FREE_CONNECTION, SIM900_MESSAGE_NO_FREE_CONNECTION},
+	{SIM900_ERROR_QUEUE_FULL, SIM900_MESSAGE_QUEUE_FULL},
+	{SIM900_ERROR_QUEUE_EMPTY, SIM900_MESSAGE_QUEUE_EMPTY},
+	{SIM900_ERROR_HTTP_STATUS, SIM900_MESSAGE_HTTP_STATUS},
+	{SIM900_ERROR_WEAK_SIGNAL, SIM900_MESSAGE_WEAK_SIGNAL},
+
+
+	//This needs to be the last element or things will go badly wrong.
+	{SIM900_ERROR_LIST_TERMINATOR, NULL}
+};
+
+static const char SIM900_CONNECTION_TYPE_GPRS[] PROGMEM = "GPRS";
+static const char SIM900_CONNECTION_TYPE_CSD[] PROGMEM = "CSD";
+
+static const char* const VALID_CONNECTION_TYPES[] PROGMEM =
+{
+	SIM900_CONNECTION_TYPE_GPRS,
+	SIM900_CONNECTION_TYPE_CSD,
+	NULL
+};
+
+static const uint16_t VALID_CONNECTION_SPEEDS[] PROGMEM =
+{
+	2400,
+	4800,
+	9600,
+	14400,
+	0
+};
+
 void set_sim900_debug_mode(bool mode)
 {
 	SIM900_DEBUG_OUTPUT = mode;
@@ -43,9 +128,10 @@ bool is_valid_connection_type(char* to_check)
 	{
 		return false;
 	}
-	for(uint32_t i = 0; VALID_CONNECTION_TYPES[i] != NULL; i++)
+	const char* type;
+	for(uint32_t i = 0; (type = (const char*)pgm_read_ptr(&VALID_CONNECTION_TYPES[i])) != NULL; i++)
 	{
-		if(strcmp(VALID_CONNECTION_TYPES[i], to_check) == 0)	
+		if(strcmp_P(to_check, type) == 0)
 		{
 			return true;
 		}
@@ -55,10 +141,11 @@ bool is_valid_connection_type(char* to_check)
 
 bool is_valid_connection_rate(char* to_check)
 {
-	uint32_t speed = String(to_check).toInt();
-	for(uint32_t i = 0; VALID_CONNECTION_SPEEDS[i] != NULL; i++)
+	uint32_t speed = atol(to_check);
+	uint16_t valid;
+	for(uint32_t i = 0; (valid = pgm_read_word(&VALID_CONNECTION_SPEEDS[i])) != 0; i++)
 	{
-		if(speed == VALID_CONNECTION_SPEEDS[i])
+		if(speed == valid)
 		{
 			return true;
 		}
@@ -66,115 +153,314 @@ bool is_valid_connection_rate(char* to_check)
 	return false;
 }
 
-char* get_error_message(int error_code)
+const __FlashStringHelper* get_error_message(int error_code)
 {
-	for(uint32_t i = 0; messages[i].code != SIM900_ERROR_LIST_TERMINATOR; i++)
+	int16_t code;
+	for(uint32_t i = 0; (code = (int16_t)pgm_read_word(&messages[i].code)) != SIM900_ERROR_LIST_TERMINATOR; i++)
 	{
-		if(messages[i].code == error_code)
+		if(code == error_code)
 		{
-			return messages[i].message;
+			return (const __FlashStringHelper*)pgm_read_ptr(&messages[i].message);
 		}
 	}
-	return "Could not find error message.\0";//SIM900_UNKNOWN_ERROR_MESSAGE;
+	return (const __FlashStringHelper*)SIM900_MESSAGE_UNKNOWN;
 }
 
-Sim900::Sim900(SoftwareSerial* serial, int baud_rate, int powerPin, int statusPin,  enum MODEM_VARIANT varient)
+//Failure responses watched for alongside every command target, in the order
+//they are added to the matcher, and the error condition each one sets.
+#define SIM900_ERROR_TOKEN_COUNT 3
+static const char SIM900_TOKEN_CME_ERROR[] PROGMEM = "+CME ERROR:";
+static const char SIM900_TOKEN_CMS_ERROR[] PROGMEM = "+CMS ERROR:";
+static const char SIM900_TOKEN_ERROR[] PROGMEM = "ERROR";
+static const char* const SIM900_ERROR_TOKENS[SIM900_ERROR_TOKEN_COUNT] PROGMEM =
 {
-	_serial = serial;	
-	_powerPin = powerPin;
-	_statusPin = statusPin;
-	_lock = 0;
-	_error_condition = SIM900_ERROR_NO_ERROR;	
-	_ser = serial;
-	handle_varient(varient);
-	serial->begin(baud_rate);
-}
+	SIM900_TOKEN_CME_ERROR,
+	SIM900_TOKEN_CMS_ERROR,
+	SIM900_TOKEN_ERROR
+};
+static const int16_t SIM900_ERROR_TOKEN_CODES[SIM900_ERROR_TOKEN_COUNT] PROGMEM =
+{
+	SIM900_ERROR_CME_ERROR,
+	SIM900_ERROR_CMS_ERROR,
+	SIM900_ERROR_MODEM_ERROR
+};
 
-Sim900::Sim900(HardwareSerial* serial, int baud_rate, int powerPin, int statusPin,  enum MODEM_VARIANT varient)
+//Lines starting with one of these are unsolicited result codes, unless
+//they answer the command in progress.
+static const char SIM900_URC_RING[] PROGMEM = "RING";
+static const char SIM900_URC_CMTI[] PROGMEM = "+CMTI:";
+static const char SIM900_URC_CREG[] PROGMEM = "+CREG:";
+static const char SIM900_URC_CGREG[] PROGMEM = "+CGREG:";
+static const char SIM900_URC_CPIN[] PROGMEM = "+CPIN:";
+static const char SIM900_URC_CFUN[] PROGMEM = "+CFUN:";
+static const char SIM900_URC_SAPBR[] PROGMEM = "+SAPBR ";
+static const char SIM900_URC_PDP_DEACT[] PROGMEM = "+PDP: DEACT";
+static const char SIM900_URC_HTTPACTION[] PROGMEM = "+HTTPACTION:";
+static const char SIM900_URC_UNDER_VOLTAGE[] PROGMEM = "UNDER-VOLTAGE";
+static const char SIM900_URC_OVER_VOLTAGE[] PROGMEM = "OVER-VOLTAGE";
+static const char SIM900_URC_POWER_DOWN[] PROGMEM = "NORMAL POWER DOWN";
+static const char SIM900_URC_CALL_READY[] PROGMEM = "Call Ready";
+static const char SIM900_URC_RDY[] PROGMEM = "RDY";
+static const char* const SIM900_URC_PREFIXES[] PROGMEM =
 {
-	_serial = serial;	
-	_powerPin = powerPin;
-	_statusPin = statusPin;
-	_lock = 0;
-	_error_condition = SIM900_ERROR_NO_ERROR;	
-	_ser = NULL;
-	handle_varient(varient);
-	serial->begin(baud_rate);
-}
+	SIM900_URC_RING,
+	SIM900_URC_CMTI,
+	SIM900_URC_CREG,
+	SIM900_URC_CGREG,
+	SIM900_URC_CPIN,
+	SIM900_URC_CFUN,
+	SIM900_URC_SAPBR,
+	SIM900_URC_PDP_DEACT,
+	SIM900_URC_HTTPACTION,
+	SIM900_URC_UNDER_VOLTAGE,
+	SIM900_URC_OVER_VOLTAGE,
+	SIM900_URC_POWER_DOWN,
+	SIM900_URC_CALL_READY,
+	SIM900_URC_RDY,
+	NULL
+};
 
-void Sim900::handle_varient(MODEM_VARIANT varient)
+//The bearer profile parameters in the order they are set by AT+SAPBR=3.
+static const char SIM900_FIELD_CONTYPE[] PROGMEM = "CONTYPE";
+static const char SIM900_FIELD_APN[] PROGMEM = "APN";
+static const char SIM900_FIELD_USER[] PROGMEM = "USER";
+static const char SIM900_FIELD_PWD[] PROGMEM = "PWD";
+static const char SIM900_FIELD_PHONENUM[] PROGMEM = "PHONENUM";
+static const char SIM900_FIELD_RATE[] PROGMEM = "RATE";
+static const char* const SIM900_BEARER_FIELD_NAMES[SIM900_BEARER_FIELDS] PROGMEM =
 {
-	this->varient = varient;
-	switch(varient)
+	SIM900_FIELD_CONTYPE,
+	SIM900_FIELD_APN,
+	SIM900_FIELD_USER,
+	SIM900_FIELD_PWD,
+	SIM900_FIELD_PHONENUM,
+	SIM900_FIELD_RATE
+};
+
+//Targets used where a command can end in more than one way.
+static const char SIM900_TARGET_OK[] PROGMEM = "OK";
+static const char SIM900_TARGET_CONNECT[] PROGMEM = "CONNECT";
+static const char SIM900_TARGET_CONNECT_OK[] PROGMEM = "CONNECT OK";
+static const char SIM900_TARGET_CONNECT_FAIL[] PROGMEM = "CONNECT FAIL";
+static const char SIM900_TARGET_ALREADY_CONNECT[] PROGMEM = "ALREADY CONNECT";
+static const char SIM900_TARGET_NO_CARRIER[] PROGMEM = "NO CARRIER";
+static const char SIM900_TARGET_HTTPREAD[] PROGMEM = "+HTTPREAD:";
+static const char SIM900_TARGET_CIPRXGET[] PROGMEM = "+CIPRXGET: 2,";
+static const char SIM900_TARGET_CLOSE_OK[] PROGMEM = "CLOSE OK";
+static const char SIM900_TARGET_SEND_OK[] PROGMEM = "SEND OK";
+static const char SIM900_TARGET_SEND_FAIL[] PROGMEM = "SEND FAIL";
+static const char SIM900_TARGET_CMGL[] PROGMEM = "+CMGL: ";
+
+static const char SIM900_PARAM_USERDATA[] PROGMEM = "USERDATA";
+
+//
+//16 bit FNV-1a hash, used to remember bearer profile values without
+//keeping copies of them.
+//
+static uint16_t hash_setting(const char* value, int length)
+{
+	uint32_t hash = 2166136261ul;
+	for(int i = 0; i < length; i++)
 	{
-	case VARIANT_1:
-		max_http_post_size = SIM900_MAX_POST_DATA_V1;
-		break;
-	case VARIANT_2:
-		max_http_post_size = SIM900_MAX_POST_DATA_V2;
-		break;
+		hash = (hash ^ (uint8_t)value[i]) * 16777619ul;
 	}
+	return (hash >> 16) ^ (hash & 0xFFFF);
 }
 
-MODEM_VARIANT Sim900::get_varient()
+//
+//Reads the number in the given comma separated field of a response such as
+//"0,200,8", in place. Returns 0 when there are not that many fields.
+//
+static long number_field(const char* text, uint8_t field)
 {
-	return varient;
+	for(; field > 0 && text != NULL; field--)
+	{
+		text = strchr(text, ',');
+		if(text != NULL)
+		{
+			text++;
+		}
+	}
+	return text != NULL ? atol(text) : 0;
 }
-uint32_t Sim900::get_max_http_post_size()
+
+//The rates AT+IPR accepts, fastest first.
+static const unsigned long SIM900_BAUD_RATES[] =
 {
-	return max_http_post_size;
+	115200,
+	57600,
+	38400,
+	19200,
+	9600,
+	4800,
+	2400,
+	1200,
+	0
+};
+
+//Upper limits in milliseconds of all but the last latency bucket, the last
+//one counts every command slower than that.
+static const uint16_t SIM900_LATENCY_BOUNDS[SIM900_LATENCY_BUCKETS - 1] =
+{
+	50,
+	200,
+	1000,
+	5000,
+	20000
+};
+
+static void increment_metric(uint16_t &counter)
+{
+	if(counter < 0xFFFF)
+	{
+		counter++;
+	}
 }
 
-void Sim900::set_error_condition(int error_value)
+void MeteredStream::attach(Stream* stream, SIM900_METRICS* metrics, SoftwareSerial* soft)
 {
-	_error_condition = error_value;
+	_stream = stream;
+	_soft = soft;
+	_metrics = metrics;
+#if SIM900_RX_BUFFER > 0
+	_rx_head = 0;
+	_rx_count = 0;
+#endif
+	_rts_pin = -1;
+	_cts_pin = -1;
+	_paused = false;
+	_sleep_mode = SIM900_SLEEP_OFF;
+	_dtr_pin = -1;
+	_asleep = false;
+	_command_start = true;
+	_last_write = 0;
+#if SIM900_TRACE_LENGTH > 0
+	memset(_command, 0, sizeof(_command));
+	_name_state = 0;
+	_name_length = 0;
+#endif
 }
 
-int Sim900::get_error_condition()
+void MeteredStream::setFlowControl(int rts_pin, int cts_pin)
 {
-	return _error_condition;
+	_rts_pin = rts_pin;
+	_cts_pin = cts_pin;
+	_paused = false;
+	if(_rts_pin >= 0)
+	{
+		pinMode(_rts_pin, OUTPUT);
+		digitalWrite(_rts_pin, LOW);
+	}
+	if(_cts_pin >= 0)
+	{
+		pinMode(_cts_pin, INPUT);
+	}
 }
 
-bool Sim900::isPoweredUp()
+//
+//Moves what the port has received into the ring buffer, so that its own
+//small buffer does not overflow between reads, and pauses or resumes the
+//modem with RTS. Runs whenever the link is used.
+//
+void MeteredStream::pump()
 {
-	pinMode(_statusPin, INPUT);
-	return analogRead(_statusPin) > SIM900_POWERUP_THRESHOLD;
+	if(_soft != NULL && _soft->overflow())
+	{
+		increment_metric(_metrics->rx_overruns);
+	}
+#if SIM900_RX_BUFFER > 0
+	while(_rx_count < SIM900_RX_BUFFER && _stream->available() > 0)
+	{
+		_rx[(_rx_head + _rx_count) % SIM900_RX_BUFFER] = _stream->read();
+		_rx_count++;
+	}
+	if(_rx_count > _metrics->rx_peak)
+	{
+		_metrics->rx_peak = _rx_count;
+	}
+#endif
+	if(_rts_pin < 0)
+	{
+		return;
+	}
+	uint16_t waiting = _stream->available();
+#if SIM900_RX_BUFFER > 0
+	waiting += _rx_count;
+#endif
+	if(!_paused && waiting >= SIM900_FLOW_STOP)
+	{
+		digitalWrite(_rts_pin, HIGH);
+		_paused = true;
+	}else if(_paused && waiting <= SIM900_FLOW_RESUME)
+	{
+		digitalWrite(_rts_pin, LOW);
+		_paused = false;
+	}
+}
 
+//
+//Records the AT+CSCLK mode the modem is now in. SIM900_SLEEP_DTR raises DTR
+//so it sleeps straight away, any other mode holds DTR low. The port counts
+//as idle from here.
+//
+void MeteredStream::setSleep(enum SIM900_SLEEP_MODE mode, int dtr_pin)
+{
+	_sleep_mode = mode;
+	_dtr_pin = dtr_pin;
+	_asleep = mode == SIM900_SLEEP_DTR;
+	_last_write = millis();
+	if(_dtr_pin >= 0)
+	{
+		pinMode(_dtr_pin, OUTPUT);
+		digitalWrite(_dtr_pin, _asleep ? HIGH : LOW);
+	}
 }
 
-bool Sim900::lock()
+bool MeteredStream::isAsleep()
 {
-	if(_lock == 0)
+	switch(_sleep_mode)
 	{
-		if(SIM900_DEBUG_OUTPUT){
-			SIM900_DEBUG_OUTPUT_STREAM->println("Locked....");
-		}
-		_lock = 1;
-		return true;
+	case SIM900_SLEEP_DTR:
+		return _asleep;
+	case SIM900_SLEEP_AUTO:
+		return (millis() - _last_write) > SIM900_SLEEP_IDLE_TIME;
+	default:
+		return false;
 	}
-	set_error_condition(SIM900_ERROR_COULD_NOT_AQUIRE_LOCK);
-	return false;
 }
 
-bool Sim900::unlock()
+//
+//Called before each write. DTR wakes the modem straight away, otherwise
+//the first character only wakes it and is lost, so a carriage return
+//(an empty command line once it is awake) is sent ahead of the command.
+//
+void MeteredStream::wake()
 {
-	if(_lock == 1)
+	if(_sleep_mode == SIM900_SLEEP_DTR && _asleep)
 	{
-		if(SIM900_DEBUG_OUTPUT){
-			SIM900_DEBUG_OUTPUT_STREAM->println("Unlocked....");
-		}
-		_lock = 0;
+		digitalWrite(_dtr_pin, LOW);
+		delay(SIM900_WAKE_TIME);
+		_asleep = false;
+	}else if(_sleep_mode == SIM900_SLEEP_AUTO && _command_start && isAsleep())
+	{
+		_metrics->bytes_sent += _stream->write('\r');
+		delay(SIM900_WAKE_TIME);
 	}
-	return true;
+	_command_start = false;
+	_last_write = millis();
 }
 
-bool Sim900::compare(char to_test[], char target[], int pos, int length, int test_len)
+//
+//Waits for the modem to raise CTS, false if it does not within
+//SIM900_CTS_TIMEOUT.
+//
+bool MeteredStream::clearToSend()
 {
-	int s = pos - length;
-	if(s < 0){s = 0;}
-	for(int i = 0; i < length; i++)
+	unsigned long start = millis();
+	while(_cts_pin >= 0 && digitalRead(_cts_pin) == HIGH)
 	{
-		if(to_test[(i+s) % test_len] != target[i])
+		pump();
+		if((millis() - start) > SIM900_CTS_TIMEOUT)
 		{
 			return false;
 		}
@@ -182,712 +468,5481 @@ bool Sim900::compare(char to_test[], char target[], int pos, int length, int tes
 	return true;
 }
 
-int Sim900::waitFor(char target[], bool dropLastEOL, String* data)
+int MeteredStream::available()
 {
-	return waitFor(target, dropLastEOL, data, SIM900_INPUT_TIMEOUT);
+	pump();
+#if SIM900_RX_BUFFER > 0
+	return _rx_count + _stream->available();
+#else
+	return _stream->available();
+#endif
 }
 
-int Sim900::waitFor(char target[], bool dropLastEOL, String* data, unsigned long timeout)
+int MeteredStream::read()
 {
-	set_error_condition(SIM900_ERROR_NO_ERROR);	
-	if(SIM900_DEBUG_OUTPUT){
-		SIM900_DEBUG_OUTPUT_STREAM->print("Waiting for: ");
-		SIM900_DEBUG_OUTPUT_STREAM->println(target);
-	}
-	unsigned long time = millis();
-	int len = strlen(target);
-	int test_len = len;
-	if(test_len < 5)
+	int c;
+	pump();
+#if SIM900_RX_BUFFER > 0
+	if(_rx_count > 0)
 	{
-		test_len = 5;
-	}
-	int pos = 0;
-	char tmp[test_len + 1];
-	tmp[test_len] = NULL;
-	char _tmp;
-	bool concat = data != NULL;
-	while(!compare(tmp, target, pos, len, test_len))
+		c = _rx[_rx_head];
+		_rx_head = (_rx_head + 1) % SIM900_RX_BUFFER;
+		_rx_count--;
+	}else
 	{
-		if(compare(tmp, "ERROR", pos, 5, test_len))
-		{
-			if(SIM900_DEBUG_OUTPUT){SIM900_DEBUG_OUTPUT_STREAM->println("");SIM900_DEBUG_OUTPUT_STREAM->println("ERROR");}
-			set_error_condition(SIM900_ERROR_MODEM_ERROR);
-			return false;
-		}
-		if(_serial->available())
-		{
-			_tmp = _serial->read();
-			if(SIM900_DEBUG_OUTPUT){
-				SIM900_DEBUG_OUTPUT_STREAM->write(_tmp);
-			}
-			if(concat){
-				data->concat(_tmp);
-			}
-			tmp[pos++ % test_len] = _tmp;
-			time = millis();
-		}else if((millis() - time) > timeout)
-		{
-			set_error_condition(SIM900_ERROR_TIMEOUT);
-			if(SIM900_DEBUG_OUTPUT){
-				SIM900_DEBUG_OUTPUT_STREAM->println("");
-				SIM900_DEBUG_OUTPUT_STREAM->print("Timed out waiting for: ");
-				SIM900_DEBUG_OUTPUT_STREAM->println(target);
-			}
-			return false;
-		}
+		c = _stream->read();
 	}
-	if(dropLastEOL)
+#else
+	c = _stream->read();
+#endif
+	if(c >= 0)
 	{
-		dropEOL();
+		_metrics->bytes_received++;
 	}
-	if(SIM900_DEBUG_OUTPUT){SIM900_DEBUG_OUTPUT_STREAM->println("");SIM900_DEBUG_OUTPUT_STREAM->println("Found it!");}
-	return true;
+	return c;
+}
 
+int MeteredStream::peek()
+{
+#if SIM900_RX_BUFFER > 0
+	pump();
+	if(_rx_count > 0)
+	{
+		return _rx[_rx_head];
+	}
+#endif
+	return _stream->peek();
 }
 
-bool Sim900::dropEOL()
+size_t MeteredStream::write(uint8_t byte)
 {
-	while(_serial->available() && (_serial->peek() == 10 || _serial->peek() == 13))
+	pump();
+	wake();
+	if(!clearToSend())
 	{
-		_serial->read();
+		return 0;
 	}
+#if SIM900_TRACE_LENGTH > 0
+	noteByte(byte);
+#endif
+	size_t written = _stream->write(byte);
+	_metrics->bytes_sent += written;
+	return written;
 }
 
-void Sim900::powerToggle()
+size_t MeteredStream::write(const uint8_t* buffer, size_t size)
 {
-  pinMode(_powerPin, OUTPUT); 
-  digitalWrite(_powerPin, LOW);
-  delay(1000);
-  digitalWrite(_powerPin, HIGH);
-  delay(2000);
-  digitalWrite(_powerPin, LOW);
-  delay(3000);
+	pump();
+	wake();
+	if(!clearToSend())
+	{
+		return 0;
+	}
+#if SIM900_TRACE_LENGTH > 0
+	for(size_t i = 0; i < size; i++)
+	{
+		noteByte(buffer[i]);
+	}
+#endif
+	size_t written = _stream->write(buffer, size);
+	_metrics->bytes_sent += written;
+	return written;
 }
 
-bool Sim900::powerUp()
+#if SIM900_TRACE_LENGTH > 0
+//
+//Picks the command name out of lines starting with "AT", skipping the "+"
+//and stopping at "=", "?" or the end of the line. Sim900 also marks the
+//start of a line when a command completes, as data written after a prompt
+//is not followed by a line break.
+//
+//_name_state: 0 at the start of a line, 1 after the "A", 2 while the name
+//is being copied, 3 for the rest of the line.
+//
+void MeteredStream::noteByte(uint8_t byte)
 {
-	if(SIM900_DEBUG_OUTPUT){
-		SIM900_DEBUG_OUTPUT_STREAM->println("Powering up Modem!");
+	if(byte == '\r' || byte == '\n')
+	{
+		_name_state = 0;
+		return;
 	}
-	if(!isPoweredUp())
+	switch(_name_state)
 	{
-		//if(_ser != NULL)
-		//{
-		//	_ser->listen();
-		//}
-		powerToggle();
-		if(waitFor("Call Ready", true, NULL))
+	case 0:
+		_name_state = byte == 'A' ? 1 : 3;
+		return;
+	case 1:
+		if(byte != 'T')
 		{
-			return true;
-		}else
+			_name_state = 3;
+			return;
+		}
+		_name_state = 2;
+		_name_length = 0;
+		memset(_command, 0, sizeof(_command));
+		return;
+	case 2:
+		if(byte == '=' || byte == '?' || _name_length == SIM900_TRACE_NAME_LENGTH)
 		{
-			if(isPoweredUp())
-			{
-				powerToggle();
-			}
+			_name_state = 3;
+		}else if(byte != '+' || _name_length > 0)
+		{
+			_command[_name_length++] = byte;
 		}
-
+		return;
 	}
-	return false;
 }
-bool Sim900::powerDown()
+#endif
+
+void MeteredStream::flush()
 {
-	if(isPoweredUp())
-	{
-		powerToggle();
-		return waitFor("NORMAL POWER DOWN", true, NULL);
-	}
-	return false;
+	_stream->flush();
 }
 
-bool Sim900::getSignalQuality(int &strength, int &error_rate)
+ResponseMatcher::ResponseMatcher()
 {
-	if(lock())
-	{
-		_serial->write("AT+CSQ\r\n");
-		_serial->flush();
-		delay(100);
-		String d;
-		if(waitFor("OK", true, &d))
-		{
-			int _start = d.lastIndexOf("+CSQ");
-			_start = d.indexOf(" ", _start) + 1;
-			int split = d.indexOf(",", _start);
-			int _end = d.indexOf("\r", _start);
-			strength = d.substring(_start, split).toInt();
-			error_rate = d.substring(split+1, _end).toInt();
-			unlock();
-			return true;
-		}else
-		{
-			unlock();
-		}
-	}
-	return false;
+	clear();
 }
 
-bool Sim900::waitForSignal(int iterations, int wait_time)
+void ResponseMatcher::clear()
 {
-  int strength = -1, error_rate = -1, strength_count = 0;
-  while(strength <= 0)
-  {
-    if(getSignalQuality(strength, error_rate))
-    {
-    	if(SIM900_DEBUG_OUTPUT){
-    		SIM900_DEBUG_OUTPUT_STREAM->print("Strength: ");
-    		SIM900_DEBUG_OUTPUT_STREAM->print(strength);
-    		SIM900_DEBUG_OUTPUT_STREAM->print(" Error Rate: ");
-    		SIM900_DEBUG_OUTPUT_STREAM->println(error_rate);
-    	}
-    }
-    if(strength <= 0){
-    	if(SIM900_DEBUG_OUTPUT){
-    		SIM900_DEBUG_OUTPUT_STREAM->println("Waiting for modem to establish connection...");
-    	}
-
-    	delay(wait_time);
-    	strength_count++;
-    }
-    if(strength_count > iterations)
-    {
-    	if(SIM900_DEBUG_OUTPUT){
-    		SIM900_DEBUG_OUTPUT_STREAM->println("Could not establish connection. Not uploading data.");
-    	}
-    	return false;
-    }
-  }
-  return true;
+	_count = 0;
+	_coded = 0;
+	_flash = 0;
+	reset();
 }
 
-bool Sim900::issueCommand(char command[], char ok[], bool dropLastEOL)
+void ResponseMatcher::reset()
 {
-	_serial->write(command);
-	waitFor(ok, dropLastEOL, NULL);
+	restart();
+	_code = -1;
+}
 
+void ResponseMatcher::restart()
+{
+	memset(_state, 0, sizeof(_state));
+	_in_code = SIM900_TOKEN_NONE;
 }
 
+int ResponseMatcher::add(const char* token, bool coded)
+{
+	return insert(token, coded, false);
+}
 
-void Sim900::dumpStream()
+int ResponseMatcher::add(const __FlashStringHelper* token, bool coded)
 {
-	while(_serial->available())
-	{
-		Serial.write(_serial->read());
-	}
+	return insert((const char*)token, coded, true);
 }
 
-bool Sim900::is_valid_connection_settings(CONN settings)
+int ResponseMatcher::insert(const char* token, bool coded, bool flash)
 {
-	if(!(settings.cid >= 0 && settings.cid <= 5))
+	size_t length = flash ? strlen_P(token) : strlen(token);
+	if(_count >= SIM900_MAX_MATCH_TOKENS || length == 0 || length > SIM900_MAX_TARGET_LENGTH)
 	{
-		set_error_condition(SIM900_ERROR_INVALID_CID_VALUE);
-		return false;
+		return SIM900_TOKEN_NONE;
 	}
-	if(!is_valid_connection_type(settings.contype))
+	_tokens[_count] = token;
+	_lengths[_count] = length;
+	_state[_count] = 0;
+	if(flash)
 	{
-		set_error_condition(SIM900_ERROR_INVALID_CONNECTION_TYPE);
-		return false;
+		_flash |= 1 << _count;
 	}
-	if(settings.apn != NULL && !(strlen(settings.apn) <= SIM900_MAX_CONNECTION_SETTING_CHARACTERS))
+	uint8_t* fail = _fail[_count];
+	uint8_t k = 0;
+	fail[0] = 0;
+	for(uint8_t i = 1; i < length; i++)
 	{
-		set_error_condition(SIM900_ERROR_CHARACTER_LIMIT_EXCEEDED);
-		return false;
+		while(k > 0 && tokenChar(_count, i) != tokenChar(_count, k))
+		{
+			k = fail[k - 1];
+		}
+		if(tokenChar(_count, i) == tokenChar(_count, k))
+		{
+			k++;
+		}
+		fail[i] = k;
 	}
-	if(settings.user!= NULL && !(strlen(settings.user) <= SIM900_MAX_CONNECTION_SETTING_CHARACTERS))
+	if(coded)
 	{
-		set_error_condition(SIM900_ERROR_CHARACTER_LIMIT_EXCEEDED);
-		return false;
+		_coded |= 1 << _count;
 	}
-	if(settings.pwd != NULL && !(strlen(settings.pwd) <= SIM900_MAX_CONNECTION_SETTING_CHARACTERS))
+	return _count++;
+}
+
+char ResponseMatcher::tokenChar(uint8_t token, uint8_t index)
+{
+	if(_flash & (1 << token))
 	{
-		set_error_condition(SIM900_ERROR_CHARACTER_LIMIT_EXCEEDED);
-		return false;
+		return pgm_read_byte(_tokens[token] + index);
 	}
-	if(settings.rate != NULL && !is_valid_connection_rate(settings.rate))
+	return _tokens[token][index];
+}
+
+//
+//Returns the new matched length of a token after a mismatch on c, falling
+//back through the failure table. Each fall back undoes a character matched
+//earlier, so this costs O(1) per byte on average.
+//
+uint8_t ResponseMatcher::advance(uint8_t token, char c)
+{
+	uint8_t matched = _state[token];
+	if(matched == _lengths[token])
 	{
-		set_error_condition(SIM900_ERROR_INVALID_CONNECTION_RATE);
-		return false;
+		matched = _fail[token][matched - 1];
 	}
-	return true;
+	while(matched > 0 && tokenChar(token, matched) != c)
+	{
+		matched = _fail[token][matched - 1];
+	}
+	return tokenChar(token, matched) == c ? matched + 1 : 0;
 }
 
-GPRSHTTP* Sim900::createHTTPConnection(CONN settings, char URL[])
+int ResponseMatcher::feed(char c)
 {
-	set_error_condition(SIM900_ERROR_NO_ERROR);
-	if(is_valid_connection_settings(settings) && lock()){
-		if(settings.contype != NULL)	
-		{
-			_serial->write("AT+SAPBR=3,");
-			_serial->print(settings.cid, DEC);
-			_serial->write(",\"CONTYPE\",\"");
-			_serial->write(settings.contype);
-			_serial->println("\"");
-			waitFor("OK", true, NULL);
-		}
-		if(settings.apn != NULL)	
+	if(_in_code != SIM900_TOKEN_NONE)
+	{
+		return feedCode(c);
+	}
+	int found = SIM900_TOKEN_NONE;
+	uint8_t matched;
+	for(uint8_t i = 0; i < _count; i++)
+	{
+		matched = _state[i];
+		if(matched < _lengths[i] && tokenChar(i, matched) == c)
 		{
-			_serial->write("AT+SAPBR=3,");
-			_serial->print(settings.cid, DEC);
-			_serial->write(",\"APN\",\"");
-			_serial->write(settings.apn);
-			_serial->println("\"");
-			waitFor("OK", true, NULL);
-		}
-		if(settings.user != NULL)	
+			matched++;
+		}else if(matched == 0)
 		{
-			_serial->write("AT+SAPBR=3,");
-			_serial->print(settings.cid, DEC);
-			_serial->write(",\"USER\",\"");
-			_serial->write(settings.user);
-			_serial->println("\"");
-			waitFor("OK", true, NULL);
-		}
-		if(settings.pwd != NULL)	
+			//Tokens that have not matched anything only cost one comparison.
+			continue;
+		}else
 		{
-			_serial->write("AT+SAPBR=3,");
-			_serial->print(settings.cid, DEC);
-			_serial->write(",\"PWD\",\"");
-			_serial->write(settings.pwd);
-			_serial->println("\"");
-			waitFor("OK", true, NULL);
+			matched = advance(i, c);
 		}
-		if(settings.phone != NULL)	
+		_state[i] = matched;
+		if(matched == _lengths[i] && (found == SIM900_TOKEN_NONE || matched > _lengths[found]))
 		{
-			_serial->write("AT+SAPBR=3,");
-			_serial->print(settings.cid, DEC);
-			_serial->write(",\"PHONENUM\",\"");
-			_serial->write(settings.phone);
-			_serial->println("\"");
-			waitFor("OK", true, NULL);
+			found = i;
 		}
-		if(settings.rate != NULL)	
+	}
+	if(found == SIM900_TOKEN_NONE)
+	{
+		return SIM900_TOKEN_NONE;
+	}
+	//A longer token that ends with this one is still being matched
+	//(e.g. "ERROR" inside "+CME ERROR:"), let that one decide.
+	for(uint8_t i = 0; i < _count; i++)
+	{
+		if(_state[i] > _lengths[found] && _state[i] < _lengths[i])
 		{
-			_serial->write("AT+SAPBR=3,");
-			_serial->print(settings.cid, DEC);
-			_serial->write(",\"RATE\",\"");
-			_serial->write(settings.rate);
-			_serial->println("\"");
-			waitFor("OK", true, NULL);
+			return SIM900_TOKEN_NONE;
 		}
-
-		return new GPRSHTTP(this, settings.cid, URL);
 	}
-	return NULL;
+	if(_coded & (1 << found))
+	{
+		_in_code = found;
+		_code = -1;
+		return SIM900_TOKEN_NONE;
+	}
+	restart();
+	return found;
 }
 
-GPRSHTTP::GPRSHTTP(Sim900* sim, int cid, char URL[])
+int ResponseMatcher::feedCode(char c)
 {
-	_sim = sim;
-	_cid = cid;
+	if(c >= '0' && c <= '9')
+	{
+		_code = (_code < 0 ? 0 : _code * 10) + (c - '0');
+		return SIM900_TOKEN_NONE;
+	}
+	if(c == ' ' && _code < 0)
+	{
+		return SIM900_TOKEN_NONE;
+	}
+	//Anything else ends the code, a verbose error (AT+CMEE=2) leaves it at -1.
+	int found = _in_code;
+	restart();
+	return found;
+}
+
+long ResponseMatcher::code()
+{
+	return _code;
+}
+
+Sim900::Sim900(SoftwareSerial* serial, long baud_rate, int powerPin, int statusPin,  enum MODEM_VARIANT varient)
+{
+	_serial = serial;	
+	_ser = serial;
+	_hw = NULL;
+	init(powerPin, statusPin, varient);
+	setPortBaudRate(baud_rate);
+}
+
+Sim900::Sim900(HardwareSerial* serial, long baud_rate, int powerPin, int statusPin,  enum MODEM_VARIANT varient)
+{
+	_serial = serial;	
+	_ser = NULL;
+	_hw = serial;
+	init(powerPin, statusPin, varient);
+	setPortBaudRate(baud_rate);
+}
+
+Sim900::Sim900(Stream* serial, int powerPin, int statusPin,  enum MODEM_VARIANT varient)
+{
+	_serial = serial;	
+	_ser = NULL;
+	_hw = NULL;
+	_baud_rate = 0;
+	init(powerPin, statusPin, varient);
+}
+
+void Sim900::init(int powerPin, int statusPin, enum MODEM_VARIANT varient)
+{
+	//All modem traffic goes through _link so that it can be counted.
+	_link.attach(_serial, &_metrics, _ser);
+	_serial = &_link;
+	resetMetrics();
+	_powerPin = powerPin;
+	_statusPin = statusPin;
+	_dtrPin = -1;
+	_lock = 0;
+	_error_condition = SIM900_ERROR_NO_ERROR;	
+	_engine_state = SIM900_ENGINE_IDLE;
+	_engine_result = SIM900_ERROR_NO_ERROR;
+	_target = NULL;
+	_flash_targets = false;
+	_targets = 0;
+	_matched = SIM900_TOKEN_NONE;
+	_modem_error_code = -1;
+	_capture = NULL;
+	_capture_size = 0;
+	_capture_length = 0;
+	_response[0] = '\0';
+	_active = NULL;
+	_data_mode = false;
+	_line_len = 0;
+	_line_matched = false;
+	_line_start = 0;
+	_command_name[0] = '\0';
+	memset(_urc_handlers, 0, sizeof(_urc_handlers));
+	_urc_head = 0;
+	_urc_count = 0;
+	_session_mode = false;
+	_session_state = SIM900_SESSION_CLOSED;
+	_session_timeout = SIM900_SESSION_IDLE_TIMEOUT;
+	_session_time = 0;
+	_session_cid = -1;
+	_session_http_timeout = 0;
+	_session_userdata = false;
+	memset(_profile_fields, 0, sizeof(_profile_fields));
+	_ip_up = false;
+	memset(_sockets, 0, sizeof(_sockets));
+	_transparent = SIM900_TRANSPARENT_OFF;
+	_escape_step = SIM900_ESCAPE_IDLE;
+	_transparent_link.attach(this);
+	_validators = NULL;
+	_monitor_state = SIM900_MONITOR_IDLE;
+	_monitor_interval = 0;
+	_monitor_time = 0;
+	_monitor_error = SIM900_ERROR_NO_ERROR;
+	_rssi_average = -1;
+	_ber_average = -1;
+	_signal_good = SIM900_SIGNAL_GOOD;
+	_signal_bad = SIM900_SIGNAL_BAD;
+	_signal_max_ber = SIM900_SIGNAL_MAX_BER;
+	_network_registered = false;
+	_gprs_registered = false;
+	_good_window = false;
+	_signal_handler = NULL;
+	_sms_setup = false;
+	_sms_reference = 0;
+	_sms_waiting = 0;
+	_report_handler = NULL;
+	_report_line = false;
+	clearTrace();
+	handle_varient(varient);
+}
+
+void Sim900::handle_varient(MODEM_VARIANT varient)
+{
+	this->varient = varient;
+	switch(varient)
+	{
+	case VARIANT_1:
+		max_http_post_size = SIM900_MAX_POST_DATA_V1;
+		break;
+	case VARIANT_2:
+		max_http_post_size = SIM900_MAX_POST_DATA_V2;
+		break;
+	}
+}
+
+MODEM_VARIANT Sim900::get_varient()
+{
+	return varient;
+}
+uint32_t Sim900::get_max_http_post_size()
+{
+	return max_http_post_size;
+}
+
+void Sim900::set_error_condition(int error_value)
+{
+	_error_condition = error_value;
+}
+
+int Sim900::get_error_condition()
+{
+	return _error_condition;
+}
+
+bool Sim900::isPoweredUp()
+{
+	pinMode(_statusPin, INPUT);
+	return analogRead(_statusPin) > SIM900_POWERUP_THRESHOLD;
+
+}
+
+bool Sim900::lock()
+{
+	if(_lock == 0)
+	{
+		if(!suspendTransparent())
+		{
+			return false;
+		}
+		if(SIM900_LOG_ENABLED(SIM900_LOG_DEBUG)){
+			SIM900_DEBUG_OUTPUT_STREAM->println(F("Locked...."));
+		}
+		_lock = 1;
+		return true;
+	}
+	set_error_condition(SIM900_ERROR_COULD_NOT_AQUIRE_LOCK);
+	return false;
+}
+
+bool Sim900::unlock()
+{
+	if(_lock == 1)
+	{
+		if(SIM900_LOG_ENABLED(SIM900_LOG_DEBUG)){
+			SIM900_DEBUG_OUTPUT_STREAM->println(F("Unlocked...."));
+		}
+		_lock = 0;
+	}
+	return true;
+}
+
+bool Sim900::beginCommand(const char command[], const char target[], char* data, uint16_t size)
+{
+	return startCommand(command, false, &target, 1, data, size);
+}
+
+bool Sim900::beginCommand(const char command[], const char* const targets[], uint8_t count, char* data, uint16_t size)
+{
+	return startCommand(command, false, targets, count, data, size);
+}
+
+bool Sim900::beginCommand(const __FlashStringHelper* command, const __FlashStringHelper* target, char* data, uint16_t size)
+{
+	const char* targets[] = {(const char*)target};
+	return startCommand((const char*)command, true, targets, 1, data, size);
+}
+
+static const char SIM900_COMMAND_PREFIX[] PROGMEM = "AT+";
+static const char SIM900_COMMAND_NAME_END[] PROGMEM = "=?\r\n";
+
+static char text_char(const char* text, uint8_t index, bool flash)
+{
+	return flash ? pgm_read_byte(text + index) : text[index];
+}
+
+//Compares text, in RAM or in flash, with other, in flash.
+static bool text_equals_P(const char* text, bool flash, const char* other)
+{
+	char c;
+	uint8_t i = 0;
+	do
+	{
+		c = pgm_read_byte(other + i);
+		if(text_char(text, i, flash) != c)
+		{
+			return false;
+		}
+		i++;
+	}while(c != '\0');
+	return true;
+}
+
+//
+//Sends a command and waits for its targets. When flash is set both the
+//command and the targets are in flash.
+//
+bool Sim900::startCommand(const char* command, bool flash, const char* const targets[], uint8_t count, char* data, uint16_t size)
+{
+	if(!releaseMonitor() || !isDone())
+	{
+		set_error_condition(SIM900_ERROR_BUSY);
+		return false;
+	}
+	if(_transparent == SIM900_TRANSPARENT_DATA)
+	{
+		//poll() runs the escape, the command can go once it is done.
+		beginEscape();
+		set_error_condition(SIM900_ERROR_BUSY);
+		return false;
+	}
+	if(flash)
+	{
+		_serial->print((const __FlashStringHelper*)command);
+	}else
+	{
+		_serial->write(command);
+	}
+	if(!beginWait(targets, count, true, data, size, SIM900_INPUT_TIMEOUT, flash))
+	{
+		return false;
+	}
+	//Remember the command name so that its response (e.g. "+CREG: 0,1")
+	//is not mistaken for the unsolicited result code with the same prefix.
+	uint8_t i = 0;
+	while(i < 3 && text_char(command, i, flash) == pgm_read_byte(SIM900_COMMAND_PREFIX + i))
+	{
+		i++;
+	}
+	if(i == 3)
+	{
+		char c;
+		for(i = 0; i < SIM900_MAX_COMMAND_NAME; i++)
+		{
+			c = text_char(command, i + 2, flash);
+			if(c == '\0' || strchr_P(SIM900_COMMAND_NAME_END, c) != NULL)
+			{
+				break;
+			}
+			_command_name[i] = c;
+		}
+		_command_name[i] = '\0';
+	}
+	return true;
+}
+
+bool Sim900::beginWait(const __FlashStringHelper* target, bool dropLastEOL, char* data, uint16_t size, unsigned long timeout)
+{
+	const char* targets[] = {(const char*)target};
+	return beginWait(targets, 1, dropLastEOL, data, size, timeout, true);
+}
+
+bool Sim900::beginWait(const char* const targets[], uint8_t count, bool dropLastEOL, char* data, uint16_t size, unsigned long timeout, bool flash)
+{
+	if(!isDone())
+	{
+		set_error_condition(SIM900_ERROR_BUSY);
+		return false;
+	}
+	set_error_condition(SIM900_ERROR_NO_ERROR);	
+	_matcher.clear();
+	for(uint8_t i = 0; i < count; i++)
+	{
+		int token = flash ? _matcher.add((const __FlashStringHelper*)targets[i]) : _matcher.add(targets[i]);
+		if(token == SIM900_TOKEN_NONE)
+		{
+			set_error_condition(SIM900_ERROR_CHARACTER_LIMIT_EXCEEDED);
+			return false;
+		}
+	}
+	//The error tokens follow the targets, "ERROR" goes last so that the
+	//longer +CME/+CMS matches take precedence over it.
+	for(uint8_t i = 0; i < SIM900_ERROR_TOKEN_COUNT; i++)
+	{
+		if(_matcher.add((const __FlashStringHelper*)pgm_read_ptr(&SIM900_ERROR_TOKENS[i]), i < SIM900_ERROR_TOKEN_COUNT - 1) == SIM900_TOKEN_NONE)
+		{
+			set_error_condition(SIM900_ERROR_CHARACTER_LIMIT_EXCEEDED);
+			return false;
+		}
+	}
+	if(SIM900_LOG_ENABLED(SIM900_LOG_DEBUG)){
+		SIM900_DEBUG_OUTPUT_STREAM->print(F("Waiting for: "));
+		if(flash)
+		{
+			SIM900_DEBUG_OUTPUT_STREAM->println((const __FlashStringHelper*)targets[0]);
+		}else
+		{
+			SIM900_DEBUG_OUTPUT_STREAM->println(targets[0]);
+		}
+	}
+	_target = targets[0];
+	_flash_targets = flash;
+	_targets = count;
+	_command_name[0] = '\0';
+	_capture = size > 0 ? data : NULL;
+	_capture_size = size;
+	_capture_length = _capture != NULL ? strlen(data) : 0;
+	_line_start = _capture_length;
+	_matched = SIM900_TOKEN_NONE;
+	_modem_error_code = -1;
+	_drop_eol = dropLastEOL;
+	_engine_timeout = timeout;
+	_engine_time = millis();
+	_engine_start = _engine_time;
+#if SIM900_TRACE_LENGTH > 0
+	_trace_received = _metrics.bytes_received;
+#endif
+	_engine_result = SIM900_ERROR_NO_ERROR;
+	_engine_state = SIM900_ENGINE_WAITING;
+	return true;
+}
+
+bool Sim900::beginDelay(unsigned long duration)
+{
+	if(!isDone())
+	{
+		set_error_condition(SIM900_ERROR_BUSY);
+		return false;
+	}
+	_engine_timeout = duration;
+	_engine_time = millis();
+	_engine_result = SIM900_ERROR_NO_ERROR;
+	_engine_state = SIM900_ENGINE_DELAYING;
+	return true;
+}
+
+void Sim900::poll()
+{
+	//A sample is only started by a poll() that found the engine idle, so
+	//that the result of the command that just finished can still be read.
+	bool was_idle = _engine_state == SIM900_ENGINE_IDLE;
+	switch(_engine_state)
+	{
+	case SIM900_ENGINE_WAITING:
+		pollWait();
+		break;
+	case SIM900_ENGINE_DELAYING:
+		if((millis() - _engine_time) >= _engine_timeout)
+		{
+			finish(SIM900_ERROR_NO_ERROR);
+		}
+		break;
+	default:
+		pollIdle();
+		break;
+	}
+	if(_engine_state == SIM900_ENGINE_IDLE)
+	{
+		if(_escape_step != SIM900_ESCAPE_IDLE)
+		{
+			stepEscape();
+		}else if(_active != NULL)
+		{
+			_active->step();
+		}else if(_monitor_state != SIM900_MONITOR_IDLE)
+		{
+			stepMonitor(true);
+		}else
+		{
+			stepSession();
+			if(was_idle && isDone())
+			{
+				stepMonitor(true);
+			}
+		}
+	}
+}
+
+void Sim900::pollWait()
+{
+	char _tmp;
+	int token;
+	for(int budget = SIM900_POLL_BYTE_BUDGET; budget > 0 && _serial->available(); budget--)
+	{
+		_tmp = _serial->read();
+		if(SIM900_LOG_ENABLED(SIM900_LOG_DEBUG)){
+			SIM900_DEBUG_OUTPUT_STREAM->write(_tmp);
+		}
+		if(_capture != NULL && _capture_length < _capture_size - 1){
+			_capture[_capture_length++] = _tmp;
+			_capture[_capture_length] = '\0';
+		}
+		_engine_time = millis();
+		token = _matcher.feed(_tmp);
+		if(token == SIM900_TOKEN_NONE)
+		{
+			collectLine(_tmp);
+			continue;
+		}
+		if(token < _targets)
+		{
+			_matched = token;
+			_line_matched = true;
+			collectLine(_tmp);
+			if(_drop_eol)
+			{
+				dropEOL();
+			}
+			if(SIM900_LOG_ENABLED(SIM900_LOG_DEBUG)){SIM900_DEBUG_OUTPUT_STREAM->println();SIM900_DEBUG_OUTPUT_STREAM->println(F("Found it!"));}
+			finish(SIM900_ERROR_NO_ERROR);
+			return;
+		}
+		_modem_error_code = _matcher.code();
+		_line_matched = true;
+		collectLine(_tmp);
+		if(SIM900_LOG_ENABLED(SIM900_LOG_ERROR)){SIM900_DEBUG_OUTPUT_STREAM->println();SIM900_DEBUG_OUTPUT_STREAM->println(F("ERROR"));}
+		finish((int16_t)pgm_read_word(&SIM900_ERROR_TOKEN_CODES[token - _targets]));
+		return;
+	}
+	if(!_serial->available() && (millis() - _engine_time) > _engine_timeout)
+	{
+		if(SIM900_LOG_ENABLED(SIM900_LOG_ERROR)){
+			SIM900_DEBUG_OUTPUT_STREAM->println();
+			SIM900_DEBUG_OUTPUT_STREAM->print(F("Timed out waiting for: "));
+			if(_flash_targets)
+			{
+				SIM900_DEBUG_OUTPUT_STREAM->println((const __FlashStringHelper*)_target);
+			}else
+			{
+				SIM900_DEBUG_OUTPUT_STREAM->println(_target);
+			}
+		}
+		finish(SIM900_ERROR_TIMEOUT);
+	}
+}
+
+//
+//Reads whatever the modem sends between commands so that unsolicited
+//result codes are handled as they arrive.
+//
+void Sim900::pollIdle()
+{
+	char _tmp;
+	if(_data_mode)
+	{
+		return;
+	}
+	for(int budget = SIM900_POLL_BYTE_BUDGET; budget > 0 && _serial->available(); budget--)
+	{
+		_tmp = _serial->read();
+		if(SIM900_LOG_ENABLED(SIM900_LOG_DEBUG)){
+			SIM900_DEBUG_OUTPUT_STREAM->write(_tmp);
+		}
+		collectLine(_tmp);
+	}
+}
+
+//
+//Assembles the modem output into lines, every complete line that did not
+//satisfy the command in progress is checked for an unsolicited result code.
+//
+void Sim900::collectLine(char c)
+{
+	if(c == '\r')
+	{
+		return;
+	}
+	if(_report_line)
+	{
+		if(c != '\n')
+		{
+			reportChar(c);
+			return;
+		}
+		//The report is not part of the command's response either.
+		_report_line = false;
+		if(_engine_state == SIM900_ENGINE_WAITING && _capture != NULL)
+		{
+			_capture_length = _line_start;
+			_capture[_capture_length] = '\0';
+		}
+		_line_len = 0;
+		_line_matched = false;
+		return;
+	}
+	if(c != '\n')
+	{
+		if(_line_len < SIM900_URC_LINE_LENGTH - 1)
+		{
+			_line[_line_len++] = c;
+		}
+		return;
+	}
+	_line[_line_len] = '\0';
+	if(_line_len > 0 && !_line_matched)
+	{
+		//"+CDS: <length>", the delivery report PDU is on the next line.
+		bool report = strncmp_P(_line, PSTR("+CDS:"), 5) == 0;
+		if(report)
+		{
+			_report_line = true;
+			_report_nibble = false;
+			_report_index = 0;
+			_report_field = 0;
+		}
+		bool socket = report || socketURC(_line);
+		if(socket || isURC(_line))
+		{
+			//Keep the unsolicited line out of the command's response.
+			if(_engine_state == SIM900_ENGINE_WAITING && _capture != NULL)
+			{
+				_capture_length = _line_start;
+				_capture[_capture_length] = '\0';
+			}
+			if(!socket)
+			{
+				dispatchURC();
+			}
+		}
+	}
+	_line_len = 0;
+	_line_matched = false;
+	if(_engine_state == SIM900_ENGINE_WAITING && _capture != NULL)
+	{
+		_line_start = _capture_length;
+	}
+}
+
+bool Sim900::isURC(const char* line)
+{
+	if(_engine_state == SIM900_ENGINE_WAITING && _command_name[0] != '\0')
+	{
+		size_t length = strlen(_command_name);
+		if(strncmp(line, _command_name, length) == 0 && line[length] == ':')
+		{
+			return false;
+		}
+	}
+	for(uint8_t i = 0; i < SIM900_MAX_URC_HANDLERS; i++)
+	{
+		if(_urc_handlers[i].prefix != NULL && strncmp(line, _urc_handlers[i].prefix, strlen(_urc_handlers[i].prefix)) == 0)
+		{
+			return true;
+		}
+	}
+	const char* prefix;
+	for(uint8_t i = 0; (prefix = (const char*)pgm_read_ptr(&SIM900_URC_PREFIXES[i])) != NULL; i++)
+	{
+		if(strncmp_P(line, prefix, strlen_P(prefix)) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+//
+//Hands the unsolicited results that belong to sockets to them: data
+//waiting ("+CIPRXGET: 1,<id>") and remote closes ("<id>, CLOSED"). Losing the
+//PDP context closes them all, that line is still passed on as a URC.
+//
+bool Sim900::socketURC(const char* line)
+{
+	int id = -1;
+	if(strncmp_P(line, PSTR("+CIPRXGET: 1,"), 13) == 0)
+	{
+		id = atoi(line + 13);
+	}else if(line[0] >= '0' && line[0] <= '9' && strcmp_P(line + 1, PSTR(", CLOSED")) == 0)
+	{
+		id = line[0] - '0';
+	}else
+	{
+		if(strncmp_P(line, SIM900_URC_PDP_DEACT, 11) == 0)
+		{
+			dropSockets();
+		}
+		return false;
+	}
+	if(id >= 0 && id < SIM900_MAX_SOCKETS && _sockets[id] != NULL)
+	{
+		if(line[0] == '+')
+		{
+			_sockets[id]->_rx_pending = true;
+		}else
+		{
+			_sockets[id]->_connected = false;
+		}
+	}
+	return true;
+}
+
+void Sim900::dispatchURC()
+{
+	if(strncmp_P(_line, SIM900_URC_CMTI, 6) == 0 && _sms_waiting < 255)
+	{
+		_sms_waiting++;
+	}
+	for(uint8_t i = 0; i < SIM900_MAX_URC_HANDLERS; i++)
+	{
+		if(_urc_handlers[i].prefix != NULL && strncmp(_line, _urc_handlers[i].prefix, strlen(_urc_handlers[i].prefix)) == 0)
+		{
+			_urc_handlers[i].handler(_line);
+			return;
+		}
+	}
+	if(_urc_count == SIM900_URC_QUEUE_LENGTH)
+	{
+		_urc_head = (_urc_head + 1) % SIM900_URC_QUEUE_LENGTH;
+		_urc_count--;
+	}
+	strcpy(_urc_queue[(_urc_head + _urc_count) % SIM900_URC_QUEUE_LENGTH], _line);
+	_urc_count++;
+}
+
+bool Sim900::setURCHandler(const char* prefix, URC_HANDLER handler)
+{
+	int free_slot = -1;
+	for(uint8_t i = 0; i < SIM900_MAX_URC_HANDLERS; i++)
+	{
+		if(_urc_handlers[i].prefix != NULL && strcmp(_urc_handlers[i].prefix, prefix) == 0)
+		{
+			if(handler == NULL)
+			{
+				_urc_handlers[i].prefix = NULL;
+			}
+			_urc_handlers[i].handler = handler;
+			return true;
+		}
+		if(_urc_handlers[i].prefix == NULL && free_slot < 0)
+		{
+			free_slot = i;
+		}
+	}
+	if(handler == NULL)
+	{
+		return true;
+	}
+	if(free_slot < 0)
+	{
+		return false;
+	}
+	_urc_handlers[free_slot].prefix = prefix;
+	_urc_handlers[free_slot].handler = handler;
+	return true;
+}
+
+int Sim900::availableURC()
+{
+	return _urc_count;
+}
+
+bool Sim900::readURC(char* buffer, int length)
+{
+	if(_urc_count == 0 || length <= 0)
+	{
+		return false;
+	}
+	strncpy(buffer, _urc_queue[_urc_head], length - 1);
+	buffer[length - 1] = '\0';
+	_urc_head = (_urc_head + 1) % SIM900_URC_QUEUE_LENGTH;
+	_urc_count--;
+	return true;
+}
+
+//
+//Closes an open session once it has been idle for too long, and runs the
+//shutdown started by beginSessionClose().
+//
+void Sim900::stepSession()
+{
+	switch(_session_state)
+	{
+	case SIM900_SESSION_OPEN:
+		if(_session_timeout > 0 && (millis() - _session_time) > _session_timeout)
+		{
+			if(SIM900_LOG_ENABLED(SIM900_LOG_INFO)){
+				SIM900_DEBUG_OUTPUT_STREAM->println(F("Session idle, shutting down."));
+			}
+			beginSessionClose();
+		}
+		return;
+	case SIM900_SESSION_CLOSING_HTTP:
+		_session_state = SIM900_SESSION_CLOSING_BEARER;
+		_serial->print(F("AT+SAPBR=0,"));
+		_serial->println(_session_cid, DEC);
+		beginWait(F("OK"), true, NULL, 0);
+		return;
+	case SIM900_SESSION_CLOSING_BEARER:
+		_session_state = SIM900_SESSION_CLOSED;
+		_session_cid = -1;
+		return;
+	default:
+		return;
+	}
+}
+
+bool Sim900::beginSessionClose()
+{
+	if(_session_state != SIM900_SESSION_OPEN || _active != NULL)
+	{
+		return false;
+	}
+	if(!isDone())
+	{
+		set_error_condition(SIM900_ERROR_BUSY);
+		return false;
+	}
+	if(!beginCommand(F("AT+HTTPTERM\r\n"), F("OK")))
+	{
+		return false;
+	}
+	_session_state = SIM900_SESSION_CLOSING_HTTP;
+	return true;
+}
+
+void Sim900::setSessionMode(bool enabled, unsigned long idle_timeout)
+{
+	_session_mode = enabled;
+	_session_timeout = idle_timeout;
+	if(!enabled)
+	{
+		endSession();
+	}
+}
+
+void Sim900::setValidatorCache(ValidatorCache* cache)
+{
+	_validators = cache;
+}
+
+bool Sim900::endSession()
+{
+	if(_session_state == SIM900_SESSION_OPEN && !beginSessionClose())
+	{
+		return false;
+	}
+	//Runs the rest of the shutdown, see stepSession().
+	complete();
+	return _session_state == SIM900_SESSION_CLOSED;
+}
+
+void Sim900::finish(int result)
+{
+	if(_engine_state == SIM900_ENGINE_WAITING)
+	{
+		recordCommand(result);
+	}
+	_engine_state = SIM900_ENGINE_IDLE;
+	_engine_result = result;
+	set_error_condition(result);
+	_link._command_start = true;
+}
+
+void Sim900::recordCommand(int result)
+{
+	unsigned long elapsed = millis() - _engine_start;
+	uint8_t bucket = 0;
+	while(bucket < SIM900_LATENCY_BUCKETS - 1 && elapsed >= SIM900_LATENCY_BOUNDS[bucket])
+	{
+		bucket++;
+	}
+	increment_metric(_metrics.latency[_active != NULL ? _active->commandClass() : SIM900_COMMAND_GENERAL][bucket]);
+	increment_metric(_metrics.commands);
+	if(result == SIM900_ERROR_TIMEOUT)
+	{
+		increment_metric(_metrics.timeouts);
+	}else if(result <= SIM900_ERROR_MODEM_ERROR && result > SIM900_ERROR_TIMEOUT)
+	{
+		increment_metric(_metrics.modem_errors);
+	}
+#if SIM900_TRACE_LENGTH > 0
+	recordTrace(result, elapsed);
+#endif
+}
+
+#if SIM900_TRACE_LENGTH > 0
+void Sim900::recordTrace(int result, unsigned long elapsed)
+{
+	SIM900_TRACE_EVENT* event = &_trace[(_trace_head + _trace_count) % SIM900_TRACE_LENGTH];
+	if(_trace_count < SIM900_TRACE_LENGTH)
+	{
+		_trace_count++;
+	}else
+	{
+		_trace_head = (_trace_head + 1) % SIM900_TRACE_LENGTH;
+	}
+	uint32_t sent = _metrics.bytes_sent - _trace_sent;
+	uint32_t received = _metrics.bytes_received - _trace_received;
+	event->time = _engine_start;
+	event->duration = elapsed < 0xFFFF ? elapsed : 0xFFFF;
+	event->sent = sent < 0xFFFF ? sent : 0xFFFF;
+	event->received = received < 0xFFFF ? received : 0xFFFF;
+	event->result = result;
+	memcpy(event->command, _link._command, SIM900_TRACE_NAME_LENGTH);
+	_trace_sent = _metrics.bytes_sent;
+	_link._name_state = 0;
+}
+#endif
+
+const SIM900_METRICS* Sim900::getMetrics()
+{
+	return &_metrics;
+}
+
+void Sim900::resetMetrics()
+{
+	memset(&_metrics, 0, sizeof(_metrics));
+#if SIM900_TRACE_LENGTH > 0
+	_trace_sent = 0;
+	_trace_received = 0;
+#endif
+}
+
+uint8_t Sim900::getTraceCount()
+{
+#if SIM900_TRACE_LENGTH > 0
+	return _trace_count;
+#else
+	return 0;
+#endif
+}
+
+const SIM900_TRACE_EVENT* Sim900::getTraceEvent(uint8_t index)
+{
+#if SIM900_TRACE_LENGTH > 0
+	if(index < _trace_count)
+	{
+		return &_trace[(_trace_head + index) % SIM900_TRACE_LENGTH];
+	}
+#else
+	(void)index;
+#endif
+	return NULL;
+}
+
+void Sim900::clearTrace()
+{
+#if SIM900_TRACE_LENGTH > 0
+	_trace_head = 0;
+	_trace_count = 0;
+	_trace_sent = _metrics.bytes_sent;
+	_trace_received = _metrics.bytes_received;
+#endif
+}
+
+void Sim900::dumpTrace(Print* out)
+{
+	const SIM900_TRACE_EVENT* event;
+	for(uint8_t i = 0; (event = getTraceEvent(i)) != NULL; i++)
+	{
+		out->print(event->time);
+		out->print(F(" +"));
+		out->print(event->duration);
+		out->print(F("ms AT+"));
+		for(uint8_t j = 0; j < SIM900_TRACE_NAME_LENGTH && event->command[j] != '\0'; j++)
+		{
+			out->print(event->command[j]);
+		}
+		out->print(F(" sent "));
+		out->print(event->sent);
+		out->print(F(" received "));
+		out->print(event->received);
+		out->print(F(" result "));
+		out->println(event->result);
+	}
+}
+
+bool Sim900::isDone()
+{
+	return _engine_state == SIM900_ENGINE_IDLE;
+}
+
+int Sim900::result()
+{
+	return _engine_result;
+}
+
+int Sim900::matched()
+{
+	return _matched;
+}
+
+long Sim900::modemErrorCode()
+{
+	return _modem_error_code;
+}
+
+//
+//Runs the engine until the current command is done.
+//
+bool Sim900::complete()
+{
+	while(!isDone())
+	{
+		poll();
+	}
+	return result() == SIM900_ERROR_NO_ERROR;
+}
+
+int Sim900::waitFor(const __FlashStringHelper* target, bool dropLastEOL, char* data, uint16_t size, unsigned long timeout)
+{
+	if(!beginWait(target, dropLastEOL, data, size, timeout))
+	{
+		return false;
+	}
+	return complete();
+}
+
+bool Sim900::dropEOL()
+{
+	while(_serial->available() && (_serial->peek() == 10 || _serial->peek() == 13))
+	{
+		collectLine(_serial->read());
+	}
+	return true;
+}
+
+//
+//Pulses PWRKEY and waits for the status pin to show that the modem has
+//switched on or off.
+//
+bool Sim900::powerToggle()
+{
+	bool was_up = isPoweredUp();
+	pinMode(_powerPin, OUTPUT); 
+	digitalWrite(_powerPin, HIGH);
+	delay(SIM900_POWER_KEY_PULSE);
+	digitalWrite(_powerPin, LOW);
+	unsigned long start = millis();
+	while(isPoweredUp() == was_up)
+	{
+		if((millis() - start) > SIM900_POWER_STATUS_TIMEOUT)
+		{
+			set_error_condition(SIM900_ERROR_TIMEOUT);
+			return false;
+		}
+		delay(10);
+	}
+	return true;
+}
+
+//
+//Checks a +CREG: style response for registration, home (1) or roaming (5).
+//
+static bool is_registered(const char* response, const char* prefix)
+{
+	const char* found = strstr_P(response, prefix);
+	if(found == NULL)
+	{
+		return false;
+	}
+	int status = number_field(found, 1);
+	return status == 1 || status == 5;
+}
+
+bool Sim900::queryRegistration(const __FlashStringHelper* command, const char* prefix)
+{
+	_response[0] = '\0';
+	if(!beginCommand(command, F("OK"), _response, sizeof(_response)) || !complete())
+	{
+		return false;
+	}
+	return is_registered(_response, prefix);
+}
+
+enum SIM900_READINESS Sim900::getReadiness()
+{
+	if(!isPoweredUp())
+	{
+		return SIM900_READY_OFF;
+	}
+	suspendTransparent();
+	if(!probe())
+	{
+		return SIM900_READY_POWERED;
+	}
+	_response[0] = '\0';
+	if(!beginCommand(F("AT+CPIN?\r\n"), F("OK"), _response, sizeof(_response)) || !complete() || strstr_P(_response, PSTR("+CPIN: READY")) == NULL)
+	{
+		return SIM900_READY_AT;
+	}
+	if(!queryRegistration(F("AT+CREG?\r\n"), SIM900_URC_CREG))
+	{
+		return SIM900_READY_SIM;
+	}
+	if(!queryRegistration(F("AT+CGREG?\r\n"), SIM900_URC_CGREG))
+	{
+		return SIM900_READY_NETWORK;
+	}
+	return SIM900_READY_GPRS;
+}
+
+bool Sim900::waitForReadiness(enum SIM900_READINESS level, unsigned long timeout)
+{
+	unsigned long start = millis();
+	enum SIM900_READINESS reached;
+	while((reached = getReadiness()) < level)
+	{
+		if((millis() - start) > timeout)
+		{
+			if(SIM900_LOG_ENABLED(SIM900_LOG_ERROR)){
+				SIM900_DEBUG_OUTPUT_STREAM->print(F("Modem stopped at readiness level "));
+				SIM900_DEBUG_OUTPUT_STREAM->println(reached, DEC);
+			}
+			set_error_condition(SIM900_ERROR_TIMEOUT);
+			return false;
+		}
+		delay(SIM900_READINESS_INTERVAL);
+	}
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	return true;
+}
+
+bool Sim900::powerUp(enum SIM900_READINESS level)
+{
+	if(SIM900_LOG_ENABLED(SIM900_LOG_INFO)){
+		SIM900_DEBUG_OUTPUT_STREAM->println(F("Powering up Modem!"));
+	}
+	if(!isPoweredUp())
+	{
+		//if(_ser != NULL)
+		//{
+		//	_ser->listen();
+		//}
+		if(!powerToggle())
+		{
+			return false;
+		}
+		_session_state = SIM900_SESSION_CLOSED;
+		memset(_profile_fields, 0, sizeof(_profile_fields));
+		dropSockets();
+		_transparent = SIM900_TRANSPARENT_OFF;
+		_escape_step = SIM900_ESCAPE_IDLE;
+		_data_mode = false;
+		_link.setSleep(SIM900_SLEEP_OFF, _dtrPin);
+		_sms_setup = false;
+		if(!waitForReadiness(level))
+		{
+			if(isPoweredUp())
+			{
+				powerToggle();
+			}
+			return false;
+		}
+		return true;
+	}
+	return waitForReadiness(level);
+}
+bool Sim900::powerDown()
+{
+	if(isPoweredUp())
+	{
+		_session_state = SIM900_SESSION_CLOSED;
+		memset(_profile_fields, 0, sizeof(_profile_fields));
+		dropSockets();
+		_transparent = SIM900_TRANSPARENT_OFF;
+		_escape_step = SIM900_ESCAPE_IDLE;
+		_data_mode = false;
+		_link.setSleep(SIM900_SLEEP_OFF, _dtrPin);
+		_sms_setup = false;
+		//The status pin going low is enough, the NORMAL POWER DOWN banner
+		//is picked up by poll() like any other unsolicited result code.
+		return powerToggle();
+	}
+	return false;
+}
+
+bool Sim900::beginSignalQuality()
+{
+	//Refused while a connection holds the modem, so that the query does
+	//not interleave with it.
+	if(_lock != 0)
+	{
+		set_error_condition(SIM900_ERROR_COULD_NOT_AQUIRE_LOCK);
+		return false;
+	}
+	_response[0] = '\0';
+	return beginCommand(F("AT+CSQ\r\n"), F("OK"), _response, sizeof(_response));
+}
+
+bool Sim900::getSignalQualityResult(int &strength, int &error_rate)
+{
+	if(!isDone() || result() != SIM900_ERROR_NO_ERROR)
+	{
+		return false;
+	}
+	//"+CSQ: <rssi>,<ber>"
+	const char* found = strstr_P(_response, PSTR("+CSQ:"));
+	if(found == NULL)
+	{
+		return false;
+	}
+	strength = number_field(found + 5, 0);
+	error_rate = number_field(found + 5, 1);
+	return true;
+}
+
+bool Sim900::getSignalQuality(int &strength, int &error_rate)
+{
+	if(_lock == 0 && !suspendTransparent())
+	{
+		return false;
+	}
+	if(beginSignalQuality() && complete())
+	{
+		return getSignalQualityResult(strength, error_rate);
+	}
+	return false;
+}
+
+bool Sim900::waitForSignal(int iterations, int wait_time)
+{
+  int strength = -1, error_rate = -1, strength_count = 0;
+  //99 is what the modem reports before it has measured anything.
+  while(strength <= 0 || strength == SIM900_SIGNAL_UNKNOWN)
+  {
+    if(getSignalQuality(strength, error_rate))
+    {
+    	if(SIM900_LOG_ENABLED(SIM900_LOG_INFO)){
+    		SIM900_DEBUG_OUTPUT_STREAM->print(F("Strength: "));
+    		SIM900_DEBUG_OUTPUT_STREAM->print(strength);
+    		SIM900_DEBUG_OUTPUT_STREAM->print(F(" Error Rate: "));
+    		SIM900_DEBUG_OUTPUT_STREAM->println(error_rate);
+    	}
+    }
+    if(strength <= 0 || strength == SIM900_SIGNAL_UNKNOWN){
+    	if(SIM900_LOG_ENABLED(SIM900_LOG_INFO)){
+    		SIM900_DEBUG_OUTPUT_STREAM->println(F("Waiting for modem to establish connection..."));
+    	}
+
+    	delay(wait_time);
+    	strength_count++;
+    }
+    if(strength_count > iterations)
+    {
+    	if(SIM900_LOG_ENABLED(SIM900_LOG_ERROR)){
+    		SIM900_DEBUG_OUTPUT_STREAM->println(F("Could not establish connection. Not uploading data."));
+    	}
+    	return false;
+    }
+  }
+  return true;
+}
+
+void Sim900::startSignalMonitor(unsigned long interval)
+{
+	_monitor_interval = interval;
+	//The first sample is taken by the next poll().
+	_monitor_time = millis() - interval;
+}
+
+void Sim900::stopSignalMonitor()
+{
+	yieldMonitor();
+	_monitor_interval = 0;
+}
+
+void Sim900::setSignalThresholds(uint8_t good, uint8_t bad, uint8_t max_ber)
+{
+	_signal_good = good;
+	_signal_bad = bad < good ? bad : good;
+	_signal_max_ber = max_ber;
+	updateGoodWindow();
+}
+
+void Sim900::setSignalHandler(SIGNAL_HANDLER handler)
+{
+	_signal_handler = handler;
+}
+
+bool Sim900::isSignalGood()
+{
+	return _good_window;
+}
+
+int Sim900::getSmoothedSignal()
+{
+	return _rssi_average < 0 ? -1 : (_rssi_average + 8) / 16;
+}
+
+int Sim900::getSmoothedErrorRate()
+{
+	return _ber_average < 0 ? -1 : (_ber_average + 8) / 16;
+}
+
+bool Sim900::isRegistered(bool gprs)
+{
+	return gprs ? _gprs_registered : _network_registered;
+}
+
+bool Sim900::canTransmit(bool urgent)
+{
+	return urgent || _monitor_interval == 0 || _good_window;
+}
+
+//
+//Runs a sample one command at a time, called from poll() whenever the
+//engine is idle and no connection is active. next is false to finish the
+//sample with the command that has just completed.
+//
+void Sim900::stepMonitor(bool next)
+{
+	bool ok = result() == SIM900_ERROR_NO_ERROR;
+	const char* found;
+	switch(_monitor_state)
+	{
+	case SIM900_MONITOR_IDLE:
+		if(next && _monitor_interval > 0 && (millis() - _monitor_time) >= _monitor_interval)
+		{
+			_monitor_time = millis();
+			if(_lock != 0 || _transparent != SIM900_TRANSPARENT_OFF || _data_mode || _link.isAsleep() || !isPoweredUp())
+			{
+				return;
+			}
+			beginSample(SIM900_MONITOR_CSQ, F("AT+CSQ\r\n"));
+		}
+		return;
+	case SIM900_MONITOR_CSQ:
+		found = strstr_P(_monitor_response, PSTR("+CSQ:"));
+		if(ok && found != NULL)
+		{
+			sampleSignal(number_field(found + 5, 0), number_field(found + 5, 1));
+			if(next && beginSample(SIM900_MONITOR_CREG, F("AT+CREG?\r\n")))
+			{
+				return;
+			}
+		}else
+		{
+			//The modem did not answer, it cannot be relied on to send.
+			_network_registered = false;
+			_gprs_registered = false;
+		}
+		break;
+	case SIM900_MONITOR_CREG:
+		_network_registered = ok && is_registered(_monitor_response, SIM900_URC_CREG);
+		if(next && beginSample(SIM900_MONITOR_CGREG, F("AT+CGREG?\r\n")))
+		{
+			return;
+		}
+		break;
+	case SIM900_MONITOR_CGREG:
+		_gprs_registered = ok && is_registered(_monitor_response, SIM900_URC_CGREG);
+		break;
+	}
+	_monitor_state = SIM900_MONITOR_IDLE;
+	_error_condition = _monitor_error;
+	updateGoodWindow();
+}
+
+bool Sim900::beginSample(enum SIM900_MONITOR_STATE state, const __FlashStringHelper* command)
+{
+	//The sample's commands must not change what get_error_condition()
+	//reports for the caller's last one.
+	if(_monitor_state == SIM900_MONITOR_IDLE)
+	{
+		_monitor_error = _error_condition;
+	}
+	//Idle while the command is started, see yieldMonitor().
+	_monitor_state = SIM900_MONITOR_IDLE;
+	_monitor_response[0] = '\0';
+	if(!beginCommand(command, F("OK"), _monitor_response, sizeof(_monitor_response)))
+	{
+		_error_condition = _monitor_error;
+		return false;
+	}
+	_engine_timeout = SIM900_SIGNAL_TIMEOUT;
+	_monitor_state = state;
+	return true;
+}
+
+//
+//Moves average 1/SIM900_SIGNAL_SMOOTHING of the way to target, rounding the
+//step up so that a steady input is always reached. Plain integer division
+//stops short once the gap is below SIM900_SIGNAL_SMOOTHING.
+//
+static int16_t smooth(int16_t average, int16_t target)
+{
+	int16_t gap = target - average;
+	if(gap > 0)
+	{
+		return average + (gap + SIM900_SIGNAL_SMOOTHING - 1) / SIM900_SIGNAL_SMOOTHING;
+	}
+	return average - (SIM900_SIGNAL_SMOOTHING - 1 - gap) / SIM900_SIGNAL_SMOOTHING;
+}
+
+void Sim900::sampleSignal(int rssi, int ber)
+{
+	if(rssi == SIM900_SIGNAL_UNKNOWN)
+	{
+		//Not detectable yet, as far as sending goes that is no signal.
+		rssi = 0;
+	}
+	if(_rssi_average < 0)
+	{
+		_rssi_average = rssi * 16;
+	}else
+	{
+		_rssi_average = smooth(_rssi_average, rssi * 16);
+	}
+	if(ber >= 0 && ber != SIM900_SIGNAL_UNKNOWN)
+	{
+		if(_ber_average < 0)
+		{
+			_ber_average = ber * 16;
+		}else
+		{
+			_ber_average = smooth(_ber_average, ber * 16);
+		}
+	}
+	if(SIM900_LOG_ENABLED(SIM900_LOG_INFO)){
+		SIM900_DEBUG_OUTPUT_STREAM->print(F("Strength: "));
+		SIM900_DEBUG_OUTPUT_STREAM->print(rssi);
+		SIM900_DEBUG_OUTPUT_STREAM->print(F(" Smoothed: "));
+		SIM900_DEBUG_OUTPUT_STREAM->println(getSmoothedSignal());
+	}
+}
+
+void Sim900::updateGoodWindow()
+{
+	bool good = _good_window;
+	bool usable = _gprs_registered && _rssi_average >= 0 && (_ber_average < 0 || _ber_average <= _signal_max_ber * 16);
+	if(!usable || _rssi_average < _signal_bad * 16)
+	{
+		good = false;
+	}else if(_rssi_average >= _signal_good * 16)
+	{
+		good = true;
+	}
+	if(good != _good_window)
+	{
+		_good_window = good;
+		if(_signal_handler != NULL)
+		{
+			_signal_handler(good);
+		}
+	}
+}
+
+//
+//Skips the rest of a sample so that another command can be sent. Returns
+//false while the sample's command is still in progress, poll() finishes it
+//within SIM900_SIGNAL_TIMEOUT.
+//
+bool Sim900::releaseMonitor()
+{
+	if(_monitor_state == SIM900_MONITOR_IDLE)
+	{
+		return true;
+	}
+	if(!isDone())
+	{
+		return false;
+	}
+	stepMonitor(false);
+	return true;
+}
+
+//
+//The blocking calls use this instead of releaseMonitor(), it waits for the
+//sample's command in progress so that theirs is not refused as busy.
+//
+void Sim900::yieldMonitor()
+{
+	while(_monitor_state != SIM900_MONITOR_IDLE && _engine_state == SIM900_ENGINE_WAITING)
+	{
+		pollWait();
+	}
+	releaseMonitor();
+}
+
+static uint8_t hex_value(char c)
+{
+	if(c >= 'a')
+	{
+		return c - 'a' + 10;
+	}
+	return c >= 'A' ? c - 'A' + 10 : c - '0';
+}
+
+static void write_hex(Print* out, uint8_t value)
+{
+	static const char digits[] PROGMEM = "0123456789ABCDEF";
+	out->write(pgm_read_byte(digits + (value >> 4)));
+	out->write(pgm_read_byte(digits + (value & 0x0F)));
+}
+
+//
+//Unpacks count GSM 7 bit characters, starting with the first'th, into
+//buffer. The few characters of the GSM alphabet that fall on printable
+//ASCII codes used for something else are mapped, the rest are left as
+//they are. buffer can overlap packed as long as it starts
+//SIM900_SMS_TEXT_LENGTH - SIM900_SMS_LENGTH bytes ahead of it.
+//
+static void unpack_septets(uint8_t* buffer, const uint8_t* packed, uint8_t first, uint8_t count)
+{
+	for(uint8_t i = 0; i < count; i++)
+	{
+		uint16_t bit = (uint16_t)(first + i) * 7;
+		uint8_t septet = packed[bit / 8] >> (bit % 8);
+		if(bit % 8 > 1)
+		{
+			septet |= packed[bit / 8 + 1] << (8 - bit % 8);
+		}
+		septet &= 0x7F;
+		switch(septet)
+		{
+		case 0x00:
+			septet = '@';
+			break;
+		case 0x02:
+			septet = '$';
+			break;
+		case 0x11:
+			septet = '_';
+			break;
+		}
+		buffer[i] = septet;
+	}
+}
+
+//
+//PDU mode, +CMTI for new messages and, if they are wanted, +CDS for
+//delivery reports. Done once after each power up.
+//
+bool Sim900::setupSMS()
+{
+	if(!_sms_setup)
+	{
+		_sms_setup = issueCommand(F("AT+CMGF=0\r\n"), F("OK"), true) &&
+			issueCommand(_report_handler != NULL ? F("AT+CNMI=2,1,0,1,0\r\n") : F("AT+CNMI=2,1,0,0,0\r\n"), F("OK"), true);
+	}
+	return _sms_setup;
+}
+
+void Sim900::setSMSReportHandler(SMS_REPORT_HANDLER handler)
+{
+	if((handler == NULL) != (_report_handler == NULL))
+	{
+		_sms_setup = false;
+	}
+	_report_handler = handler;
+}
+
+uint8_t Sim900::smsWaiting()
+{
+	return _sms_waiting;
+}
+
+bool Sim900::sendSMS(const char* number, const uint8_t* data, uint16_t length, uint8_t* references, uint8_t count)
+{
+	const char* digits = number[0] == '+' ? number + 1 : number;
+	uint16_t parts = length <= SIM900_SMS_LENGTH ? 1 : (length + SIM900_SMS_PART_LENGTH - 1) / SIM900_SMS_PART_LENGTH;
+	bool valid = strlen(number) < SIM900_SMS_NUMBER_LENGTH && *digits != '\0' && parts <= 255;
+	for(const char* c = digits; valid && *c != '\0'; c++)
+	{
+		valid = isdigit((unsigned char)*c) != 0;
+	}
+	if(!valid)
+	{
+		set_error_condition(SIM900_ERROR_CHARACTER_LIMIT_EXCEEDED);
+		return false;
+	}
+	if(!lock())
+	{
+		return false;
+	}
+	bool ok = setupSMS();
+	_sms_reference++;
+	for(uint8_t part = 0; ok && part < parts; part++)
+	{
+		uint16_t offset = part * SIM900_SMS_PART_LENGTH;
+		uint8_t size = length - offset > SIM900_SMS_PART_LENGTH && parts > 1 ? SIM900_SMS_PART_LENGTH : length - offset;
+		uint8_t reference = 0;
+		ok = sendPDU(number, data + offset, size, part + 1, parts, &reference);
+		if(ok && part < count)
+		{
+			references[part] = reference;
+		}
+	}
+	unlock();
+	return ok;
+}
+
+//
+//Sends one SMS-SUBMIT with AT+CMGS=<length>, the PDU follows the > prompt
+//in hex and ends with Ctrl-Z. The modem answers +CMGS: <reference> once the
+//network has taken it. A user data header numbers the parts of a
+//concatenated message.
+//
+bool Sim900::sendPDU(const char* number, const uint8_t* data, uint8_t length, uint8_t part, uint8_t parts, uint8_t* reference)
+{
+	bool international = number[0] == '+';
+	const char* digits = international ? number + 1 : number;
+	uint8_t count = strlen(digits);
+	uint8_t header = parts > 1 ? 6 : 0;
+	_serial->print(F("AT+CMGS="));
+	//The SMSC octet in front is not counted.
+	_serial->print(7 + (count + 1) / 2 + header + length, DEC);
+	//Anything after the carriage return would be taken as part of the PDU.
+	_serial->write('\r');
+	if(!beginWait(F("> "), false, NULL, 0, SIM900_SMS_TIMEOUT) || !complete())
+	{
+		return false;
+	}
+	write_hex(_serial, 0x00);	//The SMSC set in the modem.
+	write_hex(_serial, 0x01 | (header > 0 ? 0x40 : 0) | (_report_handler != NULL ? 0x20 : 0));
+	write_hex(_serial, 0x00);	//Message reference, filled in by the modem.
+	write_hex(_serial, count);
+	write_hex(_serial, international ? 0x91 : 0x81);
+	for(uint8_t i = 0; i < count; i += 2)
+	{
+		write_hex(_serial, (digits[i] - '0') | ((i + 1 < count ? digits[i + 1] - '0' : 0x0F) << 4));
+	}
+	write_hex(_serial, 0x00);	//PID
+	write_hex(_serial, 0x04);	//DCS, 8 bit data.
+	write_hex(_serial, header + length);
+	if(header > 0)
+	{
+		//Concatenation with an 8 bit reference.
+		write_hex(_serial, 0x05);
+		write_hex(_serial, 0x00);
+		write_hex(_serial, 0x03);
+		write_hex(_serial, _sms_reference);
+		write_hex(_serial, parts);
+		write_hex(_serial, part);
+	}
+	for(uint8_t i = 0; i < length; i++)
+	{
+		write_hex(_serial, data[i]);
+	}
+	_serial->write(0x1A);
+	_response[0] = '\0';
+	if(!beginWait(F("+CMGS:"), false, NULL, 0, SIM900_SMS_TIMEOUT) || !complete() ||
+		!waitFor(F("OK"), true, _response, sizeof(_response)))
+	{
+		return false;
+	}
+	*reference = atoi(_response);
+	return true;
+}
+
+//
+//Lists every message with AT+CMGL=4. Each one is a "+CMGL: <index>,<stat>,
+//[<alpha>],<length>" line followed by its PDU in hex, the list ends with
+//OK. Received messages (stat 0 or 1) are passed to handler, and as listing
+//marks them read AT+CMGD=1,1 deletes them all afterwards. Stored SUBMITs
+//(stat 2 or 3) are skipped and left alone.
+//
+int Sim900::readSMS(SMS_HANDLER handler)
+{
+	const char* targets[] = {SIM900_TARGET_CMGL, SIM900_TARGET_OK};
+	SIM900_SMS sms;
+	int count = 0;
+	if(!lock())
+	{
+		return -1;
+	}
+	bool ok = setupSMS();
+	if(ok)
+	{
+		_serial->print(F("AT+CMGL=4\r\n"));
+		ok = beginWait(targets, 2, false, NULL, 0, SIM900_SMS_TIMEOUT, true) && complete();
+	}
+	while(ok && matched() == 0)
+	{
+		_response[0] = '\0';
+		ok = waitFor(F("\n"), false, _response, sizeof(_response));
+		int stat = number_field(_response, 1);
+		if(stat > 1)
+		{
+			//A stored SMS-SUBMIT, not something that can be read as a
+			//DELIVER. Its PDU line is skipped.
+			ok = ok && waitFor(F("\n"), false, NULL, 0);
+		}else
+		{
+			//The PDU is the TPDU length plus the SMSC address ahead of it.
+			ok = ok && readDeliver(&sms, number_field(_response, 3) + 1);
+		}
+		if(ok && stat <= 1)
+		{
+			count++;
+			if(handler != NULL)
+			{
+				handler(&sms);
+			}
+		}
+		ok = ok && beginWait(targets, 2, false, NULL, 0, SIM900_SMS_TIMEOUT, true) && complete();
+	}
+	if(ok && count > 0)
+	{
+		ok = issueCommand(F("AT+CMGD=1,1\r\n"), F("OK"), true);
+	}
+	unlock();
+	if(!ok)
+	{
+		//Whatever was not listed is still stored.
+		return -1;
+	}
+	_sms_waiting = 0;
+	return count;
+}
+
+bool Sim900::readOctet(uint8_t &octet)
+{
+	unsigned long time = millis();
+	uint8_t nibbles = 0;
+	octet = 0;
+	while(nibbles < 2)
+	{
+		if(_serial->available())
+		{
+			octet = (octet << 4) | hex_value(_serial->read());
+			nibbles++;
+			time = millis();
+		}else if((millis() - time) > SIM900_INPUT_TIMEOUT)
+		{
+			set_error_condition(SIM900_ERROR_TIMEOUT);
+			return false;
+		}
+	}
+	return true;
+}
+
+//
+//Decodes an SMS-DELIVER PDU of octets bytes, SMSC address included, into
+//sms. 7 bit user data is read SIM900_SMS_TEXT_LENGTH - SIM900_SMS_LENGTH
+//bytes into sms->data so that it can be unpacked in place.
+//
+bool Sim900::readDeliver(SIM900_SMS* sms, uint16_t octets)
+{
+	uint8_t octet, first, digits, type, dcs = 0, length;
+	uint8_t address[(SIM900_SMS_NUMBER_LENGTH - 2) / 2];
+	memset(sms, 0, sizeof(SIM900_SMS));
+	sms->parts = 1;
+	//SMSC address, first octet, sender length and type.
+	if(!readOctet(octet))
+	{
+		return false;
+	}
+	octets -= octet + 4;
+	for(uint8_t i = 0; i < octet; i++)
+	{
+		if(!readOctet(first))
+		{
+			return false;
+		}
+	}
+	if(!readOctet(first) || !readOctet(digits) || !readOctet(type))
+	{
+		return false;
+	}
+	uint8_t size = (digits + 1) / 2;
+	octets -= size;
+	for(uint8_t i = 0; i < size; i++)
+	{
+		if(!readOctet(octet))
+		{
+			return false;
+		}
+		if(i < sizeof(address))
+		{
+			address[i] = octet;
+		}
+	}
+	if(size > sizeof(address))
+	{
+		size = sizeof(address);
+	}
+	if((type & 0x70) == 0x50)
+	{
+		//Alphanumeric, GSM 7 bit characters.
+		unpack_septets((uint8_t*)sms->sender, address, 0, size * 8 / 7);
+	}else
+	{
+		char* out = sms->sender;
+		if(type == 0x91)
+		{
+			*out++ = '+';
+		}
+		for(uint8_t i = 0; i < size * 2 && i < digits; i++)
+		{
+			*out++ = '0' + ((i & 1) ? address[i / 2] >> 4 : address[i / 2] & 0x0F);
+		}
+	}
+	//PID, DCS, the 7 octet time stamp and the user data length.
+	for(uint8_t i = 0; i < 10; i++)
+	{
+		if(!readOctet(octet))
+		{
+			return false;
+		}
+		if(i == 1)
+		{
+			dcs = octet;
+		}
+	}
+	length = octet;
+	octets -= 10;
+	sms->text = (dcs & 0xCC) == 0x00 || (dcs & 0xF4) == 0xF0;
+	uint8_t offset = sms->text ? SIM900_SMS_TEXT_LENGTH - SIM900_SMS_LENGTH : 0;
+	size = sms->text ? ((uint16_t)length * 7 + 7) / 8 : length;
+	uint8_t* ud = sms->data + offset;
+	for(uint8_t i = 0; i < size; i++)
+	{
+		if(!readOctet(octet))
+		{
+			return false;
+		}
+		if(i < SIM900_SMS_LENGTH)
+		{
+			ud[i] = octet;
+		}
+	}
+	octets -= size;
+	if(size > SIM900_SMS_LENGTH)
+	{
+		size = SIM900_SMS_LENGTH;
+	}
+	uint8_t skip = 0;
+	if(first & 0x40)
+	{
+		//User data header, only concatenation is looked at.
+		skip = ud[0] + 1;
+		for(uint8_t i = 1; i + 1 < skip && i + 1 < size; i += ud[i + 1] + 2)
+		{
+			if(ud[i] == 0x00 && ud[i + 1] == 3)
+			{
+				sms->reference = ud[i + 2];
+				sms->parts = ud[i + 3];
+				sms->part = ud[i + 4];
+			}else if(ud[i] == 0x08 && ud[i + 1] == 4)
+			{
+				sms->reference = (ud[i + 2] << 8) | ud[i + 3];
+				sms->parts = ud[i + 4];
+				sms->part = ud[i + 5];
+			}
+		}
+	}
+	if(sms->text)
+	{
+		//The header is padded out to a whole number of characters.
+		skip = ((uint16_t)skip * 8 + 6) / 7;
+		if(length > SIM900_SMS_TEXT_LENGTH)
+		{
+			length = SIM900_SMS_TEXT_LENGTH;
+		}
+		sms->length = length > skip ? length - skip : 0;
+		unpack_septets(sms->data, ud, skip, sms->length);
+	}else
+	{
+		sms->length = size > skip ? size - skip : 0;
+		memmove(sms->data, ud + skip, sms->length);
+	}
+	if(sms->part == 0)
+	{
+		sms->part = 1;
+	}
+	//Whatever the length said is left over.
+	while((int16_t)octets > 0 && readOctet(octet))
+	{
+		octets--;
+	}
+	return true;
+}
+
+//
+//Picks the reference and status out of an SMS-STATUS-REPORT as its hex
+//arrives: SMSC address, first octet, reference, recipient address, two 7
+//octet time stamps and then the status.
+//
+void Sim900::reportChar(char c)
+{
+	_report_octet = (_report_octet << 4) | hex_value(c);
+	_report_nibble = !_report_nibble;
+	if(_report_nibble)
+	{
+		return;
+	}
+	uint8_t index = _report_index++;
+	if(index == 0)
+	{
+		_report_at = _report_octet + 2;
+	}else if(index == _report_at)
+	{
+		switch(_report_field++)
+		{
+		case 0:
+			_report_reference = _report_octet;
+			_report_at++;
+			break;
+		case 1:
+			_report_at += 2 + (_report_octet + 1) / 2 + 14;
+			break;
+		case 2:
+			if(_report_handler != NULL)
+			{
+				_report_handler(_report_reference, _report_octet);
+			}
+			break;
+		}
+	}
+}
+
+//
+//Brings up the TCP/IP stack, either in multi-connection mode with received
+//data held by the modem until it is asked for (AT+CIPRXGET=1), or for a
+//single transparent connection.
+//
+bool Sim900::startIP(CONN &settings, bool transparent)
+{
+	if(settings.apn == NULL)
+	{
+		set_error_condition(SIM900_ERROR_INVALID_CONNECTION_TYPE);
+		return false;
+	}
+	//Transparent mode only works with a single connection.
+	if(!issueCommand(F("AT+CIPSHUT\r\n"), F("SHUT OK"), true) ||
+		!issueCommand(transparent ? F("AT+CIPMUX=0\r\n") : F("AT+CIPMUX=1\r\n"), F("OK"), true) ||
+		!issueCommand(transparent ? F("AT+CIPMODE=1\r\n") : F("AT+CIPMODE=0\r\n"), F("OK"), true) ||
+		(!transparent && !issueCommand(F("AT+CIPRXGET=1\r\n"), F("OK"), true)))
+	{
+		return false;
+	}
+	_serial->print(F("AT+CSTT=\""));
+	_serial->write(settings.apn);
+	_serial->print(F("\",\""));
+	if(settings.user != NULL)
+	{
+		_serial->write(settings.user);
+	}
+	_serial->print(F("\",\""));
+	if(settings.pwd != NULL)
+	{
+		_serial->write(settings.pwd);
+	}
+	_serial->print(F("\"\r\n"));
+	if(!waitFor(F("OK"), true, NULL, 0))
+	{
+		return false;
+	}
+	_serial->print(F("AT+CIICR\r\n"));
+	if(!waitFor(F("OK"), true, NULL, 0, SIM900_CIICR_TIMEOUT))
+	{
+		return false;
+	}
+	//CIFSR answers with the local address alone, no OK follows it.
+	_serial->print(F("AT+CIFSR\r\n"));
+	if(!waitFor(F("."), true, NULL, 0))
+	{
+		return false;
+	}
+	_ip_up = !transparent;
+	return true;
+}
+
+//
+//Marks every socket closed, used when the modem loses the TCP/IP stack.
+//
+void Sim900::dropSockets()
+{
+	_ip_up = false;
+	for(uint8_t i = 0; i < SIM900_MAX_SOCKETS; i++)
+	{
+		if(_sockets[i] != NULL)
+		{
+			_sockets[i]->_connected = false;
+			_sockets[i]->_rx_pending = false;
+		}
+	}
+}
+
+//The socket pool, shared by every modem and aligned for any member of
+//GPRSSocket.
+static union
+{
+	uint8_t bytes[sizeof(GPRSSocket)];
+	uint32_t word;
+	void* pointer;
+} socket_pool[SIM900_SOCKET_POOL];
+static bool socket_used[SIM900_SOCKET_POOL];
+
+static bool socket_free()
+{
+	for(uint8_t i = 0; i < SIM900_SOCKET_POOL; i++)
+	{
+		if(!socket_used[i])
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void* GPRSSocket::operator new(size_t size) throw()
+{
+	for(uint8_t i = 0; i < SIM900_SOCKET_POOL; i++)
+	{
+		if(!socket_used[i] && size <= sizeof(socket_pool[i]))
+		{
+			socket_used[i] = true;
+			return &socket_pool[i];
+		}
+	}
+	return NULL;
+}
+
+void GPRSSocket::operator delete(void* socket)
+{
+	for(uint8_t i = 0; i < SIM900_SOCKET_POOL; i++)
+	{
+		if(socket == &socket_pool[i])
+		{
+			socket_used[i] = false;
+			return;
+		}
+	}
+}
+
+GPRSSocket* Sim900::createSocket(CONN settings, enum SIM900_SOCKET_TYPE type, const char* host, uint16_t port)
+{
+	const char* targets[] = {SIM900_TARGET_CONNECT_OK, SIM900_TARGET_CONNECT_FAIL, SIM900_TARGET_ALREADY_CONNECT};
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	complete();
+	uint8_t id = 0;
+	while(id < SIM900_MAX_SOCKETS && _sockets[id] != NULL)
+	{
+		id++;
+	}
+	if(id == SIM900_MAX_SOCKETS || !socket_free())
+	{
+		set_error_condition(SIM900_ERROR_NO_FREE_SOCKET);
+		return NULL;
+	}
+	if(!lock())
+	{
+		return NULL;
+	}
+	if(_transparent != SIM900_TRANSPARENT_OFF)
+	{
+		set_error_condition(SIM900_ERROR_BUSY);
+		unlock();
+		return NULL;
+	}
+	if(!_ip_up && !startIP(settings, false))
+	{
+		unlock();
+		return NULL;
+	}
+	_serial->print(F("AT+CIPSTART="));
+	_serial->print(id, DEC);
+	_serial->print(type == SIM900_UDP ? F(",\"UDP\",\"") : F(",\"TCP\",\""));
+	_serial->write(host);
+	_serial->print(F("\","));
+	_serial->println(port, DEC);
+	if(!beginWait(targets, 3, true, NULL, 0, SIM900_CONNECT_TIMEOUT, true) || !complete())
+	{
+		unlock();
+		return NULL;
+	}
+	unlock();
+	if(matched() != 0)
+	{
+		set_error_condition(SIM900_ERROR_CONNECT_FAILED);
+		return NULL;
+	}
+	_sockets[id] = new GPRSSocket(this, id);
+	return _sockets[id];
+}
+
+Stream* Sim900::beginTransparent(CONN settings, const char* host, uint16_t port)
+{
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	complete();
+	for(uint8_t i = 0; i < SIM900_MAX_SOCKETS; i++)
+	{
+		if(_sockets[i] != NULL || _transparent != SIM900_TRANSPARENT_OFF)
+		{
+			set_error_condition(SIM900_ERROR_BUSY);
+			return NULL;
+		}
+	}
+	if(!lock())
+	{
+		return NULL;
+	}
+	if(!startIP(settings, true))
+	{
+		unlock();
+		return NULL;
+	}
+	_serial->print(F("AT+CIPSTART=\"TCP\",\""));
+	_serial->write(host);
+	_serial->print(F("\","));
+	_serial->println(port, DEC);
+	//CONNECT FAIL and ALREADY CONNECT both contain CONNECT, so the rest of
+	//the line is needed to tell them apart from success.
+	_response[0] = '\0';
+	bool ok = waitFor(F("CONNECT"), false, _response, sizeof(_response), SIM900_CONNECT_TIMEOUT) && waitFor(F("\n"), false, _response, sizeof(_response));
+	ok = ok && strstr_P(_response, PSTR("FAIL")) == NULL && strstr_P(_response, PSTR("ALREADY")) == NULL;
+	unlock();
+	if(!ok)
+	{
+		set_error_condition(SIM900_ERROR_CONNECT_FAILED);
+		return NULL;
+	}
+	_transparent = SIM900_TRANSPARENT_DATA;
+	_link._command_start = false;
+	_data_mode = true;
+	return &_transparent_link;
+}
+
+//
+//Starts switching a transparent session to command mode with +++, which
+//the modem only accepts with SIM900_ESCAPE_GUARD_TIME of silence on either
+//side. poll() waits out the guard times, see stepEscape().
+//
+bool Sim900::beginEscape()
+{
+	if(_transparent != SIM900_TRANSPARENT_DATA || _escape_step != SIM900_ESCAPE_IDLE)
+	{
+		return _transparent != SIM900_TRANSPARENT_OFF;
+	}
+	_serial->flush();
+	if(!beginDelay(SIM900_ESCAPE_GUARD_TIME))
+	{
+		return false;
+	}
+	_escape_step = SIM900_ESCAPE_BEFORE;
+	return true;
+}
+
+void Sim900::stepEscape()
+{
+	switch(_escape_step)
+	{
+	case SIM900_ESCAPE_BEFORE:
+		_serial->print(F("+++"));
+		_escape_step = SIM900_ESCAPE_AFTER;
+		beginDelay(SIM900_ESCAPE_GUARD_TIME);
+		return;
+	case SIM900_ESCAPE_AFTER:
+		_data_mode = false;
+		_escape_step = SIM900_ESCAPE_OK;
+		beginWait(F("OK"), true, NULL, 0, SIM900_ESCAPE_GUARD_TIME);
+		return;
+	default:
+		_escape_step = SIM900_ESCAPE_IDLE;
+		if(result() == SIM900_ERROR_NO_ERROR)
+		{
+			_transparent = SIM900_TRANSPARENT_COMMAND;
+		}else
+		{
+			_data_mode = true;
+		}
+		return;
+	}
+}
+
+bool Sim900::escapeTransparent()
+{
+	if(!beginEscape())
+	{
+		return false;
+	}
+	while(_escape_step != SIM900_ESCAPE_IDLE)
+	{
+		poll();
+	}
+	return _transparent == SIM900_TRANSPARENT_COMMAND;
+}
+
+bool Sim900::resumeTransparent()
+{
+	const char* targets[] = {SIM900_TARGET_CONNECT, SIM900_TARGET_NO_CARRIER};
+	if(_escape_step != SIM900_ESCAPE_IDLE)
+	{
+		//Nothing may be sent until the escape is over.
+		return false;
+	}
+	if(_transparent != SIM900_TRANSPARENT_COMMAND)
+	{
+		return _transparent == SIM900_TRANSPARENT_DATA;
+	}
+	if(_lock != 0 || !isDone())
+	{
+		set_error_condition(SIM900_ERROR_BUSY);
+		return false;
+	}
+	_serial->print(F("ATO\r\n"));
+	if(!beginWait(targets, 2, true, NULL, 0, SIM900_INPUT_TIMEOUT, true) || !complete() || matched() != 0)
+	{
+		//The remote end has gone, the connection is finished with.
+		_transparent = SIM900_TRANSPARENT_OFF;
+		if(get_error_condition() == SIM900_ERROR_NO_ERROR)
+		{
+			set_error_condition(SIM900_ERROR_SOCKET_CLOSED);
+		}
+		return false;
+	}
+	_transparent = SIM900_TRANSPARENT_DATA;
+	_link._command_start = false;
+	_data_mode = true;
+	return true;
+}
+
+bool Sim900::endTransparent()
+{
+	if(_transparent == SIM900_TRANSPARENT_OFF)
+	{
+		return false;
+	}
+	bool ok = escapeTransparent();
+	_transparent = SIM900_TRANSPARENT_OFF;
+	_data_mode = false;
+	ok = issueCommand(F("AT+CIPCLOSE\r\n"), F("CLOSE OK"), true) && ok;
+	return issueCommand(F("AT+CIPSHUT\r\n"), F("SHUT OK"), true) && ok;
+}
+
+enum SIM900_TRANSPARENT_STATE Sim900::getTransparentState()
+{
+	return _transparent;
+}
+
+//
+//Called by the blocking calls before they issue a command. Waits for the
+//signal monitor and escapes a transparent session in data mode.
+//
+bool Sim900::suspendTransparent()
+{
+	yieldMonitor();
+	if(_transparent == SIM900_TRANSPARENT_DATA && !escapeTransparent())
+	{
+		set_error_condition(SIM900_ERROR_BUSY);
+		return false;
+	}
+	return true;
+}
+
+void TransparentStream::attach(Sim900* sim)
+{
+	_sim = sim;
+}
+
+int TransparentStream::available()
+{
+	if(!_sim->resumeTransparent())
+	{
+		return 0;
+	}
+	return _sim->_serial->available();
+}
+
+int TransparentStream::read()
+{
+	if(!_sim->resumeTransparent())
+	{
+		return -1;
+	}
+	return _sim->_serial->read();
+}
+
+int TransparentStream::peek()
+{
+	if(!_sim->resumeTransparent())
+	{
+		return -1;
+	}
+	return _sim->_serial->peek();
+}
+
+size_t TransparentStream::write(uint8_t byte)
+{
+	if(!_sim->resumeTransparent())
+	{
+		return 0;
+	}
+	return _sim->_serial->write(byte);
+}
+
+size_t TransparentStream::write(const uint8_t* buffer, size_t size)
+{
+	if(!_sim->resumeTransparent())
+	{
+		return 0;
+	}
+	return _sim->_serial->write(buffer, size);
+}
+
+void TransparentStream::flush()
+{
+	_sim->_serial->flush();
+}
+
+bool Sim900::shutdownIP()
+{
+	complete();
+	if(!lock())
+	{
+		return false;
+	}
+	dropSockets();
+	bool ok = issueCommand(F("AT+CIPSHUT\r\n"), F("SHUT OK"), true);
+	unlock();
+	return ok;
+}
+
+bool Sim900::setPortBaudRate(unsigned long rate)
+{
+	if(_ser != NULL)
+	{
+		_ser->begin(rate);
+	}else if(_hw != NULL)
+	{
+		_hw->flush();
+		_hw->begin(rate);
+	}else
+	{
+		set_error_condition(SIM900_ERROR_BAUD_RATE_FIXED);
+		return false;
+	}
+	_baud_rate = rate;
+	return true;
+}
+
+bool Sim900::probe()
+{
+	for(int i = 0; i < SIM900_BAUD_PROBES; i++)
+	{
+		_serial->print(F("AT\r\n"));
+		if(waitFor(F("OK"), true, NULL, 0, SIM900_BAUD_PROBE_TIMEOUT))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Sim900::detectBaudRate()
+{
+	suspendTransparent();
+	unsigned long start = _baud_rate;
+	if(start != 0 && setPortBaudRate(start) && probe())
+	{
+		return true;
+	}
+	if(_ser == NULL && _hw == NULL)
+	{
+		set_error_condition(SIM900_ERROR_BAUD_RATE_FIXED);
+		return false;
+	}
+	for(uint8_t i = 0; SIM900_BAUD_RATES[i] != 0; i++)
+	{
+		if(SIM900_BAUD_RATES[i] != start && setPortBaudRate(SIM900_BAUD_RATES[i]) && probe())
+		{
+			if(SIM900_LOG_ENABLED(SIM900_LOG_INFO)){
+				SIM900_DEBUG_OUTPUT_STREAM->print(F("Modem found at "));
+				SIM900_DEBUG_OUTPUT_STREAM->println(_baud_rate, DEC);
+			}
+			return true;
+		}
+	}
+	if(start != 0)
+	{
+		setPortBaudRate(start);
+	}
+	set_error_condition(SIM900_ERROR_BAUD_RATE_NOT_FOUND);
+	return false;
+}
+
+//
+//Moves the modem and the port to rate and checks that commands still get
+//through. If they do not the modem is asked to go back to the old rate.
+//
+bool Sim900::switchBaudRate(unsigned long rate)
+{
+	unsigned long previous = _baud_rate;
+	//A late answer to an earlier probe must not be taken for this OK.
+	while(_serial->available())
+	{
+		_serial->read();
+	}
+	_serial->print(F("AT+IPR="));
+	_serial->println(rate, DEC);
+	if(!waitFor(F("OK"), true, NULL, 0, SIM900_BAUD_PROBE_TIMEOUT))
+	{
+		return false;
+	}
+	setPortBaudRate(rate);
+	if(probe() && probe())
+	{
+		issueCommand(F("AT&W\r\n"), F("OK"), true);
+		return true;
+	}
+	//The modem has switched but the link does not work at this rate, the
+	//command may still get through on one of a few attempts.
+	for(int i = 0; i < SIM900_BAUD_PROBES; i++)
+	{
+		_serial->print(F("AT+IPR="));
+		_serial->println(previous, DEC);
+		delay(SIM900_BAUD_PROBE_TIMEOUT);
+	}
+	setPortBaudRate(previous);
+	if(!probe())
+	{
+		detectBaudRate();
+	}
+	return false;
+}
+
+bool Sim900::negotiateBaudRate(unsigned long max_rate)
+{
+	if(!detectBaudRate())
+	{
+		return false;
+	}
+	if(_ser != NULL && max_rate > SIM900_MAX_SOFTWARE_BAUD_RATE)
+	{
+		max_rate = SIM900_MAX_SOFTWARE_BAUD_RATE;
+	}
+	for(uint8_t i = 0; SIM900_BAUD_RATES[i] > _baud_rate; i++)
+	{
+		if(SIM900_BAUD_RATES[i] <= max_rate && switchBaudRate(SIM900_BAUD_RATES[i]))
+		{
+			break;
+		}
+	}
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	return true;
+}
+
+bool Sim900::setFlowControl(int rtsPin, int ctsPin)
+{
+	suspendTransparent();
+	if(rtsPin >= 0 && ctsPin >= 0)
+	{
+		//RTS has to be low before the modem starts to watch it.
+		_link.setFlowControl(rtsPin, -1);
+		if(!issueCommand(F("AT+IFC=2,2\r\n"), F("OK"), true))
+		{
+			_link.setFlowControl(-1, -1);
+			return false;
+		}
+		_link.setFlowControl(rtsPin, ctsPin);
+		return true;
+	}
+	if(!issueCommand(F("AT+IFC=0,0\r\n"), F("OK"), true))
+	{
+		return false;
+	}
+	_link.setFlowControl(-1, -1);
+	return true;
+}
+
+void Sim900::setDTRPin(int dtrPin)
+{
+	_dtrPin = dtrPin;
+	_link._dtr_pin = dtrPin;
+	if(dtrPin >= 0)
+	{
+		//Low keeps the modem awake until sleep() is called.
+		pinMode(dtrPin, OUTPUT);
+		digitalWrite(dtrPin, LOW);
+		_link._asleep = false;
+	}
+}
+
+bool Sim900::sleep(enum SIM900_SLEEP_MODE mode)
+{
+	if(mode == SIM900_SLEEP_DTR && _dtrPin < 0)
+	{
+		set_error_condition(SIM900_ERROR_NO_DTR_PIN);
+		return false;
+	}
+	//Not while a connection is using the modem.
+	if(!lock())
+	{
+		return false;
+	}
+	bool ok = true;
+	if(mode != _link._sleep_mode)
+	{
+		//Sent through _link, so a sleeping modem is woken for it.
+		_serial->print(F("AT+CSCLK="));
+		_serial->println((int)mode, DEC);
+		ok = waitFor(F("OK"), true, NULL, 0);
+	}
+	unlock();
+	if(ok)
+	{
+		_link.setSleep(mode, _dtrPin);
+	}
+	return ok;
+}
+
+bool Sim900::wake()
+{
+	return sleep(SIM900_SLEEP_OFF);
+}
+
+enum SIM900_POWER_STATE Sim900::getPowerState()
+{
+	if(!isPoweredUp())
+	{
+		return SIM900_POWER_OFF;
+	}
+	return _link.isAsleep() ? SIM900_POWER_ASLEEP : SIM900_POWER_AWAKE;
+}
+
+unsigned long Sim900::getBaudRate()
+{
+	return _baud_rate;
+}
+
+bool Sim900::issueCommand(const __FlashStringHelper* command, const __FlashStringHelper* ok, bool dropLastEOL)
+{
+	yieldMonitor();
+	_serial->print(command);
+	return waitFor(ok, dropLastEOL, NULL, 0);
+}
+
+
+void Sim900::dumpStream()
+{
+	while(_serial->available())
+	{
+		Serial.write(_serial->read());
+	}
+}
+
+bool Sim900::is_valid_connection_settings(CONN settings)
+{
+	if(!(settings.cid >= 0 && settings.cid <= 5))
+	{
+		set_error_condition(SIM900_ERROR_INVALID_CID_VALUE);
+		return false;
+	}
+	if(!is_valid_connection_type(settings.contype))
+	{
+		set_error_condition(SIM900_ERROR_INVALID_CONNECTION_TYPE);
+		return false;
+	}
+	if(settings.apn != NULL && !(strlen(settings.apn) <= SIM900_MAX_CONNECTION_SETTING_CHARACTERS))
+	{
+		set_error_condition(SIM900_ERROR_CHARACTER_LIMIT_EXCEEDED);
+		return false;
+	}
+	if(settings.user!= NULL && !(strlen(settings.user) <= SIM900_MAX_CONNECTION_SETTING_CHARACTERS))
+	{
+		set_error_condition(SIM900_ERROR_CHARACTER_LIMIT_EXCEEDED);
+		return false;
+	}
+	if(settings.pwd != NULL && !(strlen(settings.pwd) <= SIM900_MAX_CONNECTION_SETTING_CHARACTERS))
+	{
+		set_error_condition(SIM900_ERROR_CHARACTER_LIMIT_EXCEEDED);
+		return false;
+	}
+	if(settings.rate != NULL && !is_valid_connection_rate(settings.rate))
+	{
+		set_error_condition(SIM900_ERROR_INVALID_CONNECTION_RATE);
+		return false;
+	}
+	return true;
+}
+
+//
+//Starts reading the bearer profile of a CID back with AT+SAPBR=4 so that
+//GPRSHTTP::nextProfileField() only has to send what differs from it.
+//
+bool Sim900::readBearerProfile(int cid)
+{
+	_response[0] = '\0';
+	_serial->print(F("AT+SAPBR=4,"));
+	_serial->println(cid, DEC);
+	return beginWait(F("OK"), true, _response, sizeof(_response));
+}
+
+void Sim900::parseBearerProfile(int cid)
+{
+	//Each field is reported on its own line as "<NAME>: <value>".
+	const char* response = _response;
+	for(uint8_t i = 0; i < SIM900_BEARER_FIELDS; i++)
+	{
+		const char* name = (const char*)pgm_read_ptr(&SIM900_BEARER_FIELD_NAMES[i]);
+		int name_len = strlen_P(name);
+		const char* found = strstr_P(response, name);
+		while(found != NULL && (found == response || found[-1] != '\n' || found[name_len] != ':'))
+		{
+			found = strstr_P(found + 1, name);
+		}
+		if(found == NULL)
+		{
+			continue;
+		}
+		const char* value = found + name_len + 1;
+		if(*value == ' ')
+		{
+			value++;
+		}
+		const char* end = strchr(value, '\r');
+		if(end == NULL)
+		{
+			continue;
+		}
+		_profile_hash[cid][i] = hash_setting(value, end - value);
+		_profile_fields[cid] |= 1 << i;
+	}
+}
+
+//The connection pool, aligned for any member of GPRSHTTP.
+static union
+{
+	uint8_t bytes[sizeof(GPRSHTTP)];
+	uint32_t word;
+	void* pointer;
+} http_connections[SIM900_HTTP_CONNECTIONS];
+static bool http_connection_used[SIM900_HTTP_CONNECTIONS];
+
+static bool http_connection_free()
+{
+	for(uint8_t i = 0; i < SIM900_HTTP_CONNECTIONS; i++)
+	{
+		if(!http_connection_used[i])
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void* GPRSHTTP::operator new(size_t size) throw()
+{
+	for(uint8_t i = 0; i < SIM900_HTTP_CONNECTIONS; i++)
+	{
+		if(!http_connection_used[i] && size <= sizeof(http_connections[i]))
+		{
+			http_connection_used[i] = true;
+			return &http_connections[i];
+		}
+	}
+	//No heap fallback, new GPRSHTTP(...) gives NULL once the pool is used up.
+	return NULL;
+}
+
+void GPRSHTTP::operator delete(void* connection)
+{
+	for(uint8_t i = 0; i < SIM900_HTTP_CONNECTIONS; i++)
+	{
+		if(connection == &http_connections[i])
+		{
+			http_connection_used[i] = false;
+			return;
+		}
+	}
+}
+
+GPRSHTTP* Sim900::beginHTTPConnection(CONN settings, char URL[])
+{
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	if(!is_valid_connection_settings(settings))
+	{
+		return NULL;
+	}
+	//An idle session shutdown or a sample may be under way.
+	if(!releaseMonitor() || !isDone() || _escape_step != SIM900_ESCAPE_IDLE)
+	{
+		set_error_condition(SIM900_ERROR_BUSY);
+		return NULL;
+	}
+	if(_transparent == SIM900_TRANSPARENT_DATA)
+	{
+		beginEscape();
+		set_error_condition(SIM900_ERROR_BUSY);
+		return NULL;
+	}
+	if(_lock != 0)
+	{
+		set_error_condition(SIM900_ERROR_COULD_NOT_AQUIRE_LOCK);
+		return NULL;
+	}
+	if(!http_connection_free())
+	{
+		set_error_condition(SIM900_ERROR_NO_FREE_CONNECTION);
+		return NULL;
+	}
+	_lock = 1;
+	_active = new GPRSHTTP(this, settings.cid, URL);
+	_active->_settings = settings;
+	_active->_profile_pending = true;
+	return _active;
+}
+
+GPRSHTTP* Sim900::createHTTPConnection(CONN settings, char URL[])
+{
+	GPRSHTTP* connection;
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	//Let an idle session shutdown that is under way finish first.
+	complete();
+	if(!is_valid_connection_settings(settings) || !suspendTransparent())
+	{
+		return NULL;
+	}
+	connection = beginHTTPConnection(settings, URL);
+	if(connection == NULL)
+	{
+		return NULL;
+	}
+	if(!connection->beginProfile() || !connection->complete())
+	{
+		//Nothing was started, there is nothing to terminate.
+		set_error_condition(connection->get_error_condition());
+		connection->release();
+		delete connection;
+		return NULL;
+	}
+	return connection;
+}
+
+GPRSHTTP::GPRSHTTP(Sim900* sim, int cid, char URL[])
+{
+	_sim = sim;
+	_cid = cid;
 	url = URL;
+	_settings.cid = cid;
+	_profile_pending = false;
+	_profile_field = 0;
+	clear();
+}
+
+//
+//Puts everything but the modem, CID, URL and settings back to how a new
+//connection starts out.
+//
+void GPRSHTTP::clear()
+{
 	initialized = false;
 	_data_ready = false;
-	write_count = 0;
-	write_limit = 0;
-	read_limit = 0;
-	read_count = 0;
-	sequence_bit_map = 0;
+	write_count = 0;
+	write_limit = 0;
+	read_limit = 0;
+	read_count = 0;
+	sequence_bit_map = 0;
+	_error_condition = SIM900_ERROR_NO_ERROR;
+	_step = GPRSHTTP_STEP_IDLE;
+	_result = SIM900_ERROR_NO_ERROR;
+	_retries = 0;
+	_retry_delay = 0;
+	_content_length = 0;
+	_action_timeout = 0;
+	_chunk_time = 0;
+	_range_buffer = NULL;
+	_range_offset = 0;
+	_range_length = 0;
+	_range_expected = 0;
+	_range_got = 0;
+	_range_time = 0;
+	_received = 0;
+	_sink = NULL;
+	_attached = 0;
+	_reused = false;
+	_failed = false;
+	_http_timeout = 0;
+	_action_cid = 0;
+	_http_code = 0;
+	_response_length = 0;
+	_method = POST;
+	_headers = NULL;
+	_conditional = false;
+	_validator = NULL;
+	_header_length = 0;
+	_header_left = 0;
+	_header_time = 0;
+}
+
+GPRSHTTP::~GPRSHTTP()
+{
+	if(_sim->_active == this)
+	{
+		//Still holding the modem, let whatever is under way finish.
+		_sim->complete();
+		if(!terminate() && _sim->_active == this)
+		{
+			release();
+		}
+	}
+}
+
+bool GPRSHTTP::reset(char URL[])
+{
+	if(_step != GPRSHTTP_STEP_IDLE || !_sim->isDone())
+	{
+		set_error_condition(SIM900_ERROR_BUSY);
+		return false;
+	}
+	if(_sim->_active == this && initialized && !terminate())
+	{
+		return false;
+	}
+	if(_sim->_active != this)
+	{
+		_sim->complete();
+		if(!_sim->lock())
+		{
+			set_error_condition(_sim->get_error_condition());
+			return false;
+		}
+		//The next beginInit() applies the settings again.
+		_profile_pending = _settings.contype != NULL;
+		_sim->_active = this;
+	}
+	if(URL != NULL)
+	{
+		url = URL;
+	}
+	clear();
+	return true;
+}
+
+//
+//Starts AT+HTTPPARA, the value is printed by the caller and endParam()
+//completes the command.
+//
+bool GPRSHTTP::beginParam(const char* param, bool flash)
+{
+	if(!initialized)
+	{
+		if(SIM900_LOG_ENABLED(SIM900_LOG_ERROR))
+		{
+			SIM900_DEBUG_OUTPUT_STREAM->println(F("GPRSHTTP must have been initialized before setParam can be called."));
+		}
+		return false;
+	}
+	if(SIM900_LOG_ENABLED(SIM900_LOG_DEBUG))
+	{
+		SIM900_DEBUG_OUTPUT_STREAM->print(F("Setting HTTP Param "));
+		if(flash)
+		{
+			SIM900_DEBUG_OUTPUT_STREAM->println((const __FlashStringHelper*)param);
+		}else
+		{
+			SIM900_DEBUG_OUTPUT_STREAM->println(param);
+		}
+	}
+	_sim->_serial->print(F("AT+HTTPPARA=\""));
+	if(flash)
+	{
+		_sim->_serial->print((const __FlashStringHelper*)param);
+	}else
+	{
+		_sim->_serial->print(param);
+	}
+	_sim->_serial->print(F("\",\""));
+	return true;
+}
+
+bool GPRSHTTP::endParam()
+{
+	_sim->_serial->println(F("\""));
+	return _sim->beginWait(F("OK"), true, NULL, 0);
+}
+
+bool GPRSHTTP::sendParam(const __FlashStringHelper* param, const char* value)
+{
+	return sendParam((const char*)param, true, value, false);
+}
+
+bool GPRSHTTP::sendParam(const __FlashStringHelper* param, uint32_t value)
+{
+	if(!beginParam((const char*)param, true))
+	{
+		return false;
+	}
+	_sim->_serial->print(value, DEC);
+	return endParam();
+}
+
+bool GPRSHTTP::sendParam(const char* param, bool flash, const char* value, bool value_flash)
+{
+	if(!beginParam(param, flash))
+	{
+		return false;
+	}
+	if(value_flash)
+	{
+		_sim->_serial->print((const __FlashStringHelper*)value);
+	}else
+	{
+		_sim->_serial->print(value);
+	}
+	return endParam();
+}
+
+bool GPRSHTTP::setParam(char* param, const String& value)
+{
+	return setParam(param, false, value.c_str(), false);
+}
+
+bool GPRSHTTP::setParam(const __FlashStringHelper* param, const String& value)
+{
+	return setParam((const char*)param, true, value.c_str(), false);
+}
+
+bool GPRSHTTP::setParam(const __FlashStringHelper* param, const __FlashStringHelper* value)
+{
+	return setParam((const char*)param, true, (const char*)value, true);
+}
+
+bool GPRSHTTP::setParam(const char* param, bool flash, const char* value, bool value_flash)
+{
+	if(!beginOperation())
+	{
+		return false;
+	}
+	if(text_equals_P(param, flash, SIM900_PARAM_USERDATA))
+	{
+		//A reused session has to clear these for the next request.
+		_sim->_session_userdata = text_char(value, 0, value_flash) != '\0';
+	}
+	return sendParam(param, flash, value, value_flash) && _sim->complete();
+}
+bool GPRSHTTP::setParam(char* param, uint32_t value)
+{
+	if(!beginOperation() || !beginParam(param, false))
+	{
+		return false;
+	}
+	_sim->_serial->print(value, DEC);
+	return endParam() && _sim->complete();
+}
+
+bool GPRSHTTP::setHeaders(const char* headers)
+{
+	_headers = headers;
+	_conditional = false;
+	return setParam((const char*)SIM900_PARAM_USERDATA, true, headers != NULL ? headers : "", false);
+}
+bool GPRSHTTP::setParam(char* param, char* value)
+{
+	return setParam(param, false, value, false);
+}
+bool GPRSHTTP::isCGATT()
+{
+	_sim->_response[0] = '\0';
+	_sim->_serial->println(F("AT+CGATT?"));
+	return _sim->beginWait(F("OK"), true, _sim->_response, sizeof(_sim->_response));
+}
+int GPRSHTTP::parseCGATT()
+{
+	const char* found = strstr_P(_sim->_response, PSTR("+CGATT:"));
+	int connected = found != NULL ? number_field(found + 7, 0) : 0;
+	if(SIM900_LOG_ENABLED(SIM900_LOG_DEBUG))
+	{
+		SIM900_DEBUG_OUTPUT_STREAM->print(F("CGATT result:  "));
+		SIM900_DEBUG_OUTPUT_STREAM->println(connected);
+	}
+	return connected;
+
+}
+bool GPRSHTTP::bearerStatus()
+{
+	_sim->_response[0] = '\0';
+	_sim->_serial->print(F("AT+SAPBR=2,"));
+	_sim->_serial->println(_cid, DEC);
+	return _sim->beginWait(F("OK"), true, _sim->_response, sizeof(_sim->_response));
+}
+//
+//Returns the status from "+SAPBR: <cid>,<status>,<ip>", 1 is connected.
+//
+int GPRSHTTP::parseBearerStatus()
+{
+	const char* found = strstr_P(_sim->_response, PSTR("+SAPBR:"));
+	if(found == NULL || strchr(found, ',') == NULL)
+	{
+		return -1;
+	}
+	int status = number_field(found, 1);
+	if(SIM900_LOG_ENABLED(SIM900_LOG_DEBUG))
+	{
+		SIM900_DEBUG_OUTPUT_STREAM->print(F("Bearer status:  "));
+		SIM900_DEBUG_OUTPUT_STREAM->println(status);
+	}
+	return status;
+}
+bool GPRSHTTP::HTTPTERM()
+{
+	_sim->_serial->println(F("AT+HTTPTERM"));
+	return _sim->beginWait(F("OK"), true, NULL, 0);
+}
+bool GPRSHTTP::HTTPINIT()
+{
+	//Initialize the HTTP Application context.
+	_sim->_serial->println(F("AT+HTTPINIT"));
+	return _sim->beginWait(F("OK"), true, NULL, 0);
+}
+
+bool GPRSHTTP::stopBearer()
+{
+	//Shutdown the connection first.
+	_sim->_serial->print(F("AT+SAPBR=0,"));
+	_sim->_serial->println(_cid, DEC);
+	return _sim->beginWait(F("OK"), true, NULL, 0);
+}
+bool GPRSHTTP::startBearer()
+{
+	//Start the connection.	
+	_sim->_serial->print(F("AT+SAPBR=1,"));
+	_sim->_serial->println(_cid, DEC);
+	return _sim->beginWait(F("OK"), true, NULL, 0);
+}
+
+bool GPRSHTTP::beginOperation()
+{
+	if(_step != GPRSHTTP_STEP_IDLE || !_sim->isDone())
+	{
+		set_error_condition(SIM900_ERROR_BUSY);
+		return false;
+	}
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	_result = SIM900_ERROR_NO_ERROR;
+	_sim->_data_mode = false;
+	return true;
+}
+
+void GPRSHTTP::finish(int result)
+{
+	//Modem errors and timeouts leave the session in an unknown state,
+	//terminate() will shut it down.
+	if(result == SIM900_ERROR_TIMEOUT || (result <= SIM900_ERROR_MODEM_ERROR && result > SIM900_ERROR_TIMEOUT))
+	{
+		_failed = true;
+	}
+	_step = GPRSHTTP_STEP_IDLE;
+	_result = result;
+	set_error_condition(result);
+}
+
+//
+//Schedules another attempt of the current step after _retry_delay,
+//returns false once the retries have been used up.
+//
+bool GPRSHTTP::retry(enum GPRSHTTP_STEP retry_step)
+{
+	if(--_retries > 0)
+	{
+		increment_metric(_sim->_metrics.retries);
+		_step = retry_step;
+		_sim->beginDelay(_retry_delay);
+		return true;
+	}
+	return false;
+}
+
+//The class the command issued by the current step is recorded under.
+enum SIM900_COMMAND_CLASS GPRSHTTP::commandClass()
+{
+	switch(_step)
+	{
+	case GPRSHTTP_STEP_BEARER_STATUS:
+	case GPRSHTTP_STEP_CGATT:
+	case GPRSHTTP_STEP_STOP_BEARER:
+	case GPRSHTTP_STEP_START_BEARER:
+	case GPRSHTTP_STEP_START_BEARER_RETRY:
+	case GPRSHTTP_STEP_TERM_BEARER:
+	case GPRSHTTP_STEP_TERM_BEARER_RETRY:
+		return SIM900_COMMAND_BEARER;
+	case GPRSHTTP_STEP_DOWNLOAD:
+	case GPRSHTTP_STEP_UPLOAD:
+	case GPRSHTTP_STEP_DISCARD:
+		return SIM900_COMMAND_UPLOAD;
+	case GPRSHTTP_STEP_ACTION:
+	case GPRSHTTP_STEP_ACTION_RESULT:
+		return SIM900_COMMAND_ACTION;
+	case GPRSHTTP_STEP_HEADERS:
+	case GPRSHTTP_STEP_HEADERS_LENGTH:
+	case GPRSHTTP_STEP_HEADERS_BODY:
+	case GPRSHTTP_STEP_HEADERS_OK:
+	case GPRSHTTP_STEP_READ:
+	case GPRSHTTP_STEP_READ_HEADER:
+	case GPRSHTTP_STEP_RANGE:
+	case GPRSHTTP_STEP_RANGE_HEADER:
+	case GPRSHTTP_STEP_RANGE_BODY:
+	case GPRSHTTP_STEP_RANGE_OK:
+		return SIM900_COMMAND_READ;
+	case GPRSHTTP_STEP_IDLE:
+	case GPRSHTTP_STEP_SETTLE:
+		return SIM900_COMMAND_GENERAL;
+	default:
+		return SIM900_COMMAND_HTTP;
+	}
+}
+
+bool GPRSHTTP::isDone()
+{
+	return _step == GPRSHTTP_STEP_IDLE;
+}
+
+int GPRSHTTP::result()
+{
+	return _result;
+}
+
+bool GPRSHTTP::complete()
+{
+	while(!isDone())
+	{
+		_sim->poll();
+	}
+	return result() == SIM900_ERROR_NO_ERROR;
+}
+
+//
+//Called by Sim900::poll() whenever the command engine is idle, moves the
+//current operation on to its next command.
+//
+void GPRSHTTP::step()
+{
+	int engine_result = _sim->result();
+	bool ok = engine_result == SIM900_ERROR_NO_ERROR;
+	switch(_step)
+	{
+	case GPRSHTTP_STEP_IDLE:
+		return;
+
+	case GPRSHTTP_STEP_PROFILE_READ:
+		//Without the profile every field is sent.
+		if(ok)
+		{
+			_sim->parseBearerProfile(_cid);
+		}
+		nextProfileField();
+		return;
+
+	case GPRSHTTP_STEP_PROFILE_FIELD:
+		if(!ok)
+		{
+			//Nothing can be assumed about the profile after a failure.
+			_sim->_profile_fields[_cid] = 0;
+			finish(engine_result);
+			return;
+		}
+		_sim->_profile_fields[_cid] |= 1 << _profile_field;
+		_profile_field++;
+		nextProfileField();
+		return;
+
+	case GPRSHTTP_STEP_BEARER_STATUS:
+		if(!ok)
+		{
+			finish(engine_result);
+			return;
+		}
+		if(parseBearerStatus() == 1)
+		{
+			if(_sim->_session_state == SIM900_SESSION_OPEN && _sim->_session_cid == _cid)
+			{
+				_reused = true;
+				initialized = true;
+				nextParam();
+				return;
+			}
+			_step = GPRSHTTP_STEP_HTTP_RESET;
+			HTTPTERM();
+			return;
+		}
+		_retries = 5;
+		_retry_delay = 2000;
+		_step = GPRSHTTP_STEP_START_BEARER;
+		startBearer();
+		return;
+
+	case GPRSHTTP_STEP_CGATT:
+		if(!ok)
+		{
+			finish(engine_result);
+			return;
+		}
+		_attached = parseCGATT();
+		_step = GPRSHTTP_STEP_SETTLE;
+		_sim->beginDelay(1000);
+		return;
+
+	case GPRSHTTP_STEP_SETTLE:
+		if(_attached == 1)
+		{
+			_step = GPRSHTTP_STEP_STOP_BEARER;
+			stopBearer();
+			return;
+		}
+		//There is no bearer to stop.
+		// fall through
+	case GPRSHTTP_STEP_STOP_BEARER:
+		if(_step == GPRSHTTP_STEP_STOP_BEARER && !ok && SIM900_LOG_ENABLED(SIM900_LOG_ERROR))
+		{
+			SIM900_DEBUG_OUTPUT_STREAM->println(F("Not Shutdown."));
+		}
+		_retries = 5;
+		_retry_delay = 2000;
+		// fall through
+	case GPRSHTTP_STEP_START_BEARER_RETRY:
+		_step = GPRSHTTP_STEP_START_BEARER;
+		startBearer();
+		return;
+
+	case GPRSHTTP_STEP_START_BEARER:
+		if(!ok)
+		{
+			if(SIM900_LOG_ENABLED(SIM900_LOG_INFO))
+			{
+				SIM900_DEBUG_OUTPUT_STREAM->println(F("Failed to connect, waiting to retry."));
+			}
+			if(!retry(GPRSHTTP_STEP_START_BEARER_RETRY))
+			{
+				finish(engine_result);
+			}
+			return;
+		}
+		if(SIM900_LOG_ENABLED(SIM900_LOG_INFO))
+		{
+			SIM900_DEBUG_OUTPUT_STREAM->println(F("Connected!"));
+		}
+		if(_sim->_session_mode)
+		{
+			//An earlier session may have left the HTTP service running.
+			_step = GPRSHTTP_STEP_HTTP_RESET;
+			HTTPTERM();
+			return;
+		}
+		// fall through
+	case GPRSHTTP_STEP_HTTP_RESET:
+		_sim->_session_state = SIM900_SESSION_CLOSED;
+		_retries = 5;
+		_retry_delay = 2000;
+		// fall through
+	case GPRSHTTP_STEP_HTTPINIT_RETRY:
+		_step = GPRSHTTP_STEP_HTTPINIT;
+		HTTPINIT();
+		return;
+
+	case GPRSHTTP_STEP_HTTPINIT:
+		if(!ok)
+		{
+			if(SIM900_LOG_ENABLED(SIM900_LOG_INFO))
+			{
+				SIM900_DEBUG_OUTPUT_STREAM->println(F("Failed to initialize HTTP context, waiting to retry."));
+			}
+			if(!retry(GPRSHTTP_STEP_HTTPINIT_RETRY))
+			{
+				finish(engine_result);
+			}
+			return;
+		}
+		if(SIM900_LOG_ENABLED(SIM900_LOG_INFO))
+		{
+			SIM900_DEBUG_OUTPUT_STREAM->println(F("HTTP Initialized!"));
+		}
+		initialized = true;
+		nextParam();
+		return;
+
+	case GPRSHTTP_STEP_PARAM_CID:
+	case GPRSHTTP_STEP_PARAM_URL:
+	case GPRSHTTP_STEP_PARAM_TIMEOUT:
+	case GPRSHTTP_STEP_PARAM_USERDATA:
+		if(!ok)
+		{
+			finish(engine_result);
+			return;
+		}
+		if(_step == GPRSHTTP_STEP_PARAM_USERDATA)
+		{
+			_sim->_session_userdata = false;
+		}
+		nextParam();
+		return;
+
+	case GPRSHTTP_STEP_DOWNLOAD:
+		if(ok)
+		{
+			write_limit = _content_length;
+			_sim->_data_mode = true;
+			_chunk_time = micros() - SIM900_WRITE_CHUNK_INTERVAL;
+		}
+		finish(engine_result);
+		return;
+
+	case GPRSHTTP_STEP_UPLOAD:
+		if(!ok)
+		{
+			finish(engine_result);
+			return;
+		}
+		_method = POST;
+		sendAction(false);
+		return;
+
+	case GPRSHTTP_STEP_DISCARD:
+		//Nothing more can be written to this upload.
+		write_limit = write_count;
+		finish(engine_result);
+		return;
+
+	case GPRSHTTP_STEP_CONDITION:
+		if(!ok)
+		{
+			finish(engine_result);
+			return;
+		}
+		sendAction(true);
+		return;
+
+	case GPRSHTTP_STEP_ACTION:
+		if(!ok)
+		{
+			finish(engine_result);
+			return;
+		}
+		_sim->_response[0] = '\0';
+		_step = GPRSHTTP_STEP_ACTION_RESULT;
+		_sim->beginWait(F("\n"), true, _sim->_response, sizeof(_sim->_response));
+		return;
+
+	case GPRSHTTP_STEP_ACTION_RESULT:
+		//"<method>,<status>,<length>"
+		_action_cid = number_field(_sim->_response, 0);
+		_http_code = number_field(_sim->_response, 1);
+		_response_length = number_field(_sim->_response, 2);
+		read_limit = _response_length;
+		if(_method == GET && _http_code == 200 && _sim->_validators != NULL)
+		{
+			//Pick the validators out of the response headers.
+			_sim->_serial->println(F("AT+HTTPHEAD"));
+			_step = GPRSHTTP_STEP_HEADERS;
+			_sim->beginWait(F("+HTTPHEAD:"), true, NULL, 0);
+			return;
+		}
+		finish(SIM900_ERROR_NO_ERROR);
+		return;
+
+	case GPRSHTTP_STEP_HEADERS:
+		if(!ok)
+		{
+			//Older firmware has no AT+HTTPHEAD, the GET itself worked.
+			_sim->_validators->forget(url);
+			finish(SIM900_ERROR_NO_ERROR);
+			return;
+		}
+		_sim->_response[0] = '\0';
+		_step = GPRSHTTP_STEP_HEADERS_LENGTH;
+		_sim->beginWait(F("\n"), false, _sim->_response, sizeof(_sim->_response));
+		return;
+
+	case GPRSHTTP_STEP_HEADERS_LENGTH:
+		if(!ok)
+		{
+			finish(engine_result);
+			return;
+		}
+		_header_left = atol(_sim->_response);
+		_header_length = 0;
+		_header_time = millis();
+		_validator = _sim->_validators->add(url);
+		_sim->_data_mode = true;
+		_step = GPRSHTTP_STEP_HEADERS_BODY;
+		// fall through
+	case GPRSHTTP_STEP_HEADERS_BODY:
+		parseHeaders();
+		return;
+
+	case GPRSHTTP_STEP_HEADERS_OK:
+		if(_validator->etag[0] == '\0' && _validator->modified[0] == '\0')
+		{
+			_sim->_validators->forget(url);
+		}
+		_validator = NULL;
+		finish(engine_result);
+		return;
+
+	case GPRSHTTP_STEP_READ:
+		if(!ok)
+		{
+			finish(engine_result);
+			return;
+		}
+		_step = GPRSHTTP_STEP_READ_HEADER;
+		_sim->beginWait(F("\n"), true, NULL, 0);
+		return;
+
+	case GPRSHTTP_STEP_READ_HEADER:
+		_data_ready = true;
+		_sim->_data_mode = read_limit > 0;
+		finish(SIM900_ERROR_NO_ERROR);
+		return;
+
+	case GPRSHTTP_STEP_RANGE:
+		if(!ok)
+		{
+			finish(engine_result);
+			return;
+		}
+		if(_sim->matched() != 0)
+		{
+			//A bare OK, there is no data at this offset.
+			finish(SIM900_ERROR_NO_ERROR);
+			return;
+		}
+		_sim->_response[0] = '\0';
+		_step = GPRSHTTP_STEP_RANGE_HEADER;
+		//The line ending is left alone, the body may start with one.
+		_sim->beginWait(F("\n"), false, _sim->_response, sizeof(_sim->_response));
+		return;
+
+	case GPRSHTTP_STEP_RANGE_HEADER:
+		if(!ok)
+		{
+			finish(engine_result);
+			return;
+		}
+		_range_expected = atol(_sim->_response);
+		if(_range_expected > _range_length)
+		{
+			_range_expected = _range_length;
+		}
+		_range_got = 0;
+		_range_time = millis();
+		_sim->_data_mode = true;
+		_step = GPRSHTTP_STEP_RANGE_BODY;
+		// fall through
+	case GPRSHTTP_STEP_RANGE_BODY:
+		copyRange();
+		return;
+
+	case GPRSHTTP_STEP_RANGE_OK:
+		if(!ok)
+		{
+			finish(engine_result);
+			return;
+		}
+		_received += _range_got;
+		_range_offset += _range_got;
+		if(_sink != NULL)
+		{
+			_sink(_range_buffer, _range_got);
+			if(_range_got == _range_length && (read_limit == 0 || _range_offset < read_limit))
+			{
+				readRangeWindow();
+				return;
+			}
+		}
+		finish(SIM900_ERROR_NO_ERROR);
+		return;
+
+	case GPRSHTTP_STEP_TERM:
+		_retries = 5;
+		_retry_delay = 1000;
+		// fall through
+	case GPRSHTTP_STEP_TERM_BEARER_RETRY:
+		_step = GPRSHTTP_STEP_TERM_BEARER;
+		stopBearer();
+		return;
+
+	case GPRSHTTP_STEP_TERM_BEARER:
+		if(!ok)
+		{
+			if(SIM900_LOG_ENABLED(SIM900_LOG_ERROR))
+			{
+				SIM900_DEBUG_OUTPUT_STREAM->println(F("Not Shutdown."));
+			}
+			if(retry(GPRSHTTP_STEP_TERM_BEARER_RETRY))
+			{
+				return;
+			}
+		}
+		_sim->_session_state = SIM900_SESSION_CLOSED;
+		release();
+		finish(engine_result);
+		return;
+	}
+}
+
+//
+//Sends the HTTP parameter that follows the current step, a reused session
+//only needs the ones that change between requests.
+//
+void GPRSHTTP::nextParam()
+{
+	switch(_step)
+	{
+	case GPRSHTTP_STEP_HTTPINIT:
+		//Set the CID
+		_step = GPRSHTTP_STEP_PARAM_CID;
+		sendParam(F("CID"), (uint32_t)_cid);
+		return;
+
+	case GPRSHTTP_STEP_BEARER_STATUS:
+	case GPRSHTTP_STEP_PARAM_CID:
+		//Set the URL
+		_step = GPRSHTTP_STEP_PARAM_URL;
+		sendParam(F("URL"), url);
+		return;
+
+	case GPRSHTTP_STEP_PARAM_URL:
+		if(!_reused || _sim->_session_http_timeout != _http_timeout)
+		{
+			//Set the HTTP Timeout
+			_step = GPRSHTTP_STEP_PARAM_TIMEOUT;
+			sendParam(F("TIMEOUT"), (uint32_t)_http_timeout);
+			return;
+		}
+		// fall through
+	case GPRSHTTP_STEP_PARAM_TIMEOUT:
+		if(_reused && _sim->_session_userdata)
+		{
+			//Clear the headers left by the previous request.
+			_step = GPRSHTTP_STEP_PARAM_USERDATA;
+			sendParam((const __FlashStringHelper*)SIM900_PARAM_USERDATA, "");
+			return;
+		}
+		// fall through
+	default:
+		if(SIM900_LOG_ENABLED(SIM900_LOG_INFO))
+		{
+			SIM900_DEBUG_OUTPUT_STREAM->print(F("URL: "));
+			SIM900_DEBUG_OUTPUT_STREAM->println(url);
+		}
+		if(_sim->_session_mode)
+		{
+			_sim->_session_state = SIM900_SESSION_OPEN;
+			_sim->_session_cid = _cid;
+			_sim->_session_http_timeout = _http_timeout;
+		}
+		finish(SIM900_ERROR_NO_ERROR);
+		return;
+	}
+}
+
+//
+//Sends AT+HTTPACTION for _method. A GET of a URL in the validator cache is
+//made conditional first, and the conditional headers are taken off again
+//for the next request that does not need them.
+//
+void GPRSHTTP::sendAction(bool conditions_sent)
+{
+	validator_entry* entry = NULL;
+	if(_method == GET && _sim->_validators != NULL)
+	{
+		entry = _sim->_validators->find(url);
+	}
+	if(!conditions_sent && (entry != NULL || _conditional))
+	{
+		//The headers are printed straight to the modem, one after the
+		//other.
+		bool empty = _headers == NULL || _headers[0] == '\0';
+		_step = GPRSHTTP_STEP_CONDITION;
+		if(!beginParam(SIM900_PARAM_USERDATA, true))
+		{
+			return;
+		}
+		if(!empty)
+		{
+			_sim->_serial->print(_headers);
+		}
+		if(entry != NULL && entry->etag[0] != '\0')
+		{
+			if(!empty)
+			{
+				_sim->_serial->print(F("\\r\\n"));
+			}
+			_sim->_serial->print(F("If-None-Match: "));
+			_sim->_serial->print(entry->etag);
+			empty = false;
+		}
+		if(entry != NULL && entry->modified[0] != '\0')
+		{
+			if(!empty)
+			{
+				_sim->_serial->print(F("\\r\\n"));
+			}
+			_sim->_serial->print(F("If-Modified-Since: "));
+			_sim->_serial->print(entry->modified);
+			empty = false;
+		}
+		_conditional = entry != NULL;
+		_sim->_session_userdata = !empty;
+		endParam();
+		return;
+	}
+	_sim->_serial->print(F("AT+HTTPACTION="));
+	_sim->_serial->println(_method, DEC);
+	_step = GPRSHTTP_STEP_ACTION;
+	_sim->beginWait(F("+HTTPACTION:"), true, NULL, 0, _action_timeout);
+}
+
+//
+//Reads the +HTTPHEAD data line by line, without holding more of it than
+//one line that might carry a validator.
+//
+void GPRSHTTP::parseHeaders()
+{
+	char c;
+	while(_header_left > 0 && _sim->_serial->available() > 0)
+	{
+		c = _sim->_serial->read();
+		_header_left--;
+		_header_time = millis();
+		if(c == '\n')
+		{
+			headerLine();
+			_header_length = 0;
+		}else if(c != '\r' && _header_length < sizeof(_header_line) - 1)
+		{
+			_header_line[_header_length++] = c;
+		}
+	}
+	if(_header_left > 0)
+	{
+		if((millis() - _header_time) > SIM900_INPUT_TIMEOUT)
+		{
+			_sim->_data_mode = false;
+			increment_metric(_sim->_metrics.timeouts);
+			finish(SIM900_ERROR_TIMEOUT);
+		}
+		return;
+	}
+	headerLine();
+	_sim->_data_mode = false;
+	_step = GPRSHTTP_STEP_HEADERS_OK;
+	_sim->beginWait(F("OK"), true, NULL, 0);
+}
+
+static const char SIM900_HEADER_ETAG[] PROGMEM = "etag:";
+static const char SIM900_HEADER_LAST_MODIFIED[] PROGMEM = "last-modified:";
+
+//
+//Copies the value of an ETag or Last-Modified header line into the cache
+//entry, unless it was too long to keep whole.
+//
+void GPRSHTTP::headerLine()
+{
+	const char* names[] = {SIM900_HEADER_ETAG, SIM900_HEADER_LAST_MODIFIED};
+	char* fields[] = {_validator->etag, _validator->modified};
+	_header_line[_header_length] = '\0';
+	if(_header_length >= sizeof(_header_line) - 1)
+	{
+		return;
+	}
+	for(uint8_t i = 0; i < 2; i++)
+	{
+		size_t name = strlen_P(names[i]);
+		if(strncasecmp_P(_header_line, names[i], name) == 0)
+		{
+			const char* value = _header_line + name;
+			while(*value == ' ')
+			{
+				value++;
+			}
+			if(strlen(value) < SIM900_VALIDATOR_LENGTH)
+			{
+				strcpy(fields[i], value);
+			}
+		}
+	}
+}
+
+//
+//Asks for the next window of the response body.
+//
+void GPRSHTTP::readRangeWindow()
+{
+	const char* targets[] = {SIM900_TARGET_HTTPREAD, SIM900_TARGET_OK};
+	uint32_t length = _range_length;
+	if(read_limit > 0 && _range_offset < read_limit && _range_offset + length > read_limit)
+	{
+		length = read_limit - _range_offset;
+	}
+	_sim->_serial->print(F("AT+HTTPREAD="));
+	_sim->_serial->print(_range_offset, DEC);
+	_sim->_serial->print(F(","));
+	_sim->_serial->println(length, DEC);
+	_step = GPRSHTTP_STEP_RANGE;
+	_sim->beginWait(targets, 2, true, NULL, 0, SIM900_INPUT_TIMEOUT, true);
+}
+
+//
+//Moves whatever part of the window has arrived into the caller's buffer,
+//without the per byte bookkeeping of read().
+//
+void GPRSHTTP::copyRange()
+{
+	int avail = _sim->_serial->available();
+	if(avail > 0)
+	{
+		if((uint32_t)avail > _range_expected - _range_got)
+		{
+			avail = _range_expected - _range_got;
+		}
+		uint8_t* dest = _range_buffer + _range_got;
+		for(int i = 0; i < avail; i++)
+		{
+			dest[i] = _sim->_serial->read();
+		}
+		_range_got += avail;
+		_range_time = millis();
+	}
+	if(_range_got < _range_expected)
+	{
+		if((millis() - _range_time) > SIM900_INPUT_TIMEOUT)
+		{
+			if(SIM900_LOG_ENABLED(SIM900_LOG_ERROR))
+			{
+				SIM900_DEBUG_OUTPUT_STREAM->println(F("The timeout was reached whilst trying to read the HTTP response."));
+			}
+			_sim->_data_mode = false;
+			increment_metric(_sim->_metrics.timeouts);
+			finish(SIM900_ERROR_TIMEOUT);
+		}
+		return;
+	}
+	_sim->_data_mode = false;
+	_step = GPRSHTTP_STEP_RANGE_OK;
+	_sim->beginWait(F("OK"), true, NULL, 0);
+}
+
+//
+//Gives the modem back once the connection is finished with it.
+//
+bool GPRSHTTP::holdsModem()
+{
+	return _sim->_active == this;
+}
+
+void GPRSHTTP::release()
+{
+	_sim->unlock();
+	if(_sim->_active == this)
+	{
+		_sim->_active = NULL;
+	}
+}
+
+bool GPRSHTTP::beginInit(int timeout)
+{
+	if(!beginOperation())
+	{
+		return false;
+	}
+	if(timeout > 1000 || timeout < 30)
+	{
+		finish(SIM900_ERROR_INVALID_HTTP_TIMEOUT);
+		if(SIM900_LOG_ENABLED(SIM900_LOG_ERROR))
+		{
+			SIM900_DEBUG_OUTPUT_STREAM->println(get_error_message(SIM900_ERROR_INVALID_HTTP_TIMEOUT));
+		}
+		return false;
+	}
+	_http_timeout = timeout;
+	if(_profile_pending)
+	{
+		return beginProfile();
+	}
+	return beginBearer();
+}
+
+//
+//Applies the connection's settings to the bearer profile, one AT+SAPBR=3
+//for each field that differs from what the CID holds. When started by
+//beginInit() the bearer is brought up next.
+//
+bool GPRSHTTP::beginProfile()
+{
+	_profile_field = 0;
+	if(_sim->_profile_fields[_cid] != 0)
+	{
+		return nextProfileField();
+	}
+	_step = GPRSHTTP_STEP_PROFILE_READ;
+	if(!_sim->readBearerProfile(_cid))
+	{
+		finish(_sim->get_error_condition());
+		return false;
+	}
+	return true;
+}
+
+bool GPRSHTTP::nextProfileField()
+{
+	const char* values[SIM900_BEARER_FIELDS] =
+	{
+		_settings.contype,
+		_settings.apn,
+		_settings.user,
+		_settings.pwd,
+		_settings.phone,
+		_settings.rate
+	};
+	const char* value;
+	uint16_t hash;
+	for(; _profile_field < SIM900_BEARER_FIELDS; _profile_field++)
+	{
+		value = values[_profile_field];
+		if(value == NULL)
+		{
+			continue;
+		}
+		hash = hash_setting(value, strlen(value));
+		if((_sim->_profile_fields[_cid] & (1 << _profile_field)) && _sim->_profile_hash[_cid][_profile_field] == hash)
+		{
+			continue;
+		}
+		//The field counts as known once the modem has taken it.
+		_sim->_profile_hash[_cid][_profile_field] = hash;
+		_sim->_profile_fields[_cid] &= ~(1 << _profile_field);
+		_sim->_serial->print(F("AT+SAPBR=3,"));
+		_sim->_serial->print(_cid, DEC);
+		_sim->_serial->print(F(",\""));
+		_sim->_serial->print((const __FlashStringHelper*)pgm_read_ptr(&SIM900_BEARER_FIELD_NAMES[_profile_field]));
+		_sim->_serial->print(F("\",\""));
+		_sim->_serial->write(value);
+		_sim->_serial->println(F("\""));
+		_step = GPRSHTTP_STEP_PROFILE_FIELD;
+		if(!_sim->beginWait(F("OK"), true, NULL, 0))
+		{
+			finish(_sim->get_error_condition());
+			return false;
+		}
+		return true;
+	}
+	_profile_pending = false;
+	if(_http_timeout == 0)
+	{
+		//Only the profile was asked for, see Sim900::createHTTPConnection().
+		finish(SIM900_ERROR_NO_ERROR);
+		return true;
+	}
+	return beginBearer();
+}
+
+bool GPRSHTTP::beginBearer()
+{
+	if(_sim->_session_mode)
+	{
+		_step = GPRSHTTP_STEP_BEARER_STATUS;
+		if(!bearerStatus())
+		{
+			finish(_sim->get_error_condition());
+			return false;
+		}
+		return true;
+	}
+	_step = GPRSHTTP_STEP_CGATT;
+	if(!isCGATT())
+	{
+		finish(_sim->get_error_condition());
+		return false;
+	}
+	return true;
+}
+
+bool GPRSHTTP::init(int timeout)
+{
+	return beginInit(timeout) && complete();
+}
+
+bool GPRSHTTP::beginPostInit(uint32_t content_length)
+{
+	if(!beginOperation())
+	{
+		return false;
+	}
+	if(content_length > _sim->max_http_post_size)
+	{
+		if(SIM900_LOG_ENABLED(SIM900_LOG_ERROR))
+		{
+			SIM900_DEBUG_OUTPUT_STREAM->print(F("Specified Content Length: "));
+			SIM900_DEBUG_OUTPUT_STREAM->print(content_length);
+			SIM900_DEBUG_OUTPUT_STREAM->print(F(" is greater than the maximum allowed post size of "));
+			SIM900_DEBUG_OUTPUT_STREAM->println(_sim->max_http_post_size);
+		}
+		finish(SIM900_ERROR_MAX_POST_DATA_SIZE_EXCEEDED);
+		return false;
+	}
+	_sim->_serial->print(F("AT+HTTPDATA="));
+	_sim->_serial->print(content_length, DEC);
+	_sim->_serial->print(F(","));
+	_sim->_serial->println(SIM900_HTTP_TIMEOUT, DEC);
+	_content_length = content_length;
+	_step = GPRSHTTP_STEP_DOWNLOAD;
+	_sim->beginWait(F("DOWNLOAD"), true, NULL, 0);
+	return true;
+}
+
+bool GPRSHTTP::post_init(uint32_t content_length){
+	return beginPostInit(content_length) && complete();
+}
+
+bool GPRSHTTP::beginPost()
+{
+	if(!beginOperation())
+	{
+		return false;
+	}
+	unsigned long upload_time_out = SIM900_INPUT_TIMEOUT;
+	if(SIM900_LOG_ENABLED(SIM900_LOG_DEBUG))
+	{
+		SIM900_DEBUG_OUTPUT_STREAM->print(F("Write Count: "));
+		SIM900_DEBUG_OUTPUT_STREAM->print(write_count);
+		SIM900_DEBUG_OUTPUT_STREAM->print(F(" Write Limit: "));
+		SIM900_DEBUG_OUTPUT_STREAM->println(write_limit);
+	}
+	if(write_limit * 10 > upload_time_out)
+	{
+		upload_time_out = write_limit * 10;
+	}
+	_action_timeout = upload_time_out;
+	_step = GPRSHTTP_STEP_UPLOAD;
+	_sim->beginWait(F("OK"), true, NULL, 0);
+	return true;
+}
+
+bool GPRSHTTP::beginDiscard()
+{
+	if(!beginOperation())
+	{
+		return false;
+	}
+	_step = GPRSHTTP_STEP_DISCARD;
+	_sim->beginWait(F("OK"), true, NULL, 0, SIM900_HTTP_TIMEOUT + SIM900_INPUT_TIMEOUT);
+	return true;
+}
+
+bool GPRSHTTP::getPostResult(int &cid, int &HTTP_CODE, int32_t &length)
+{
+	if(!isDone() || result() != SIM900_ERROR_NO_ERROR)
+	{
+		return false;
+	}
+	cid = _action_cid;
+	HTTP_CODE = _http_code;
+	length = _response_length;
+	return true;
+}
+
+//If the response from the server does not have a Content-Length header
+//then length will always be zero.
+bool GPRSHTTP::post(int &cid, int &HTTP_CODE, int32_t &length){
+	return beginPost() && complete() && getPostResult(cid, HTTP_CODE, length);
+}
+
+//
+//GET and HEAD have no data to upload, so they go straight to the action.
+//
+bool GPRSHTTP::beginAction(int method)
+{
+	if(!beginOperation())
+	{
+		return false;
+	}
+	_method = method;
+	_action_timeout = SIM900_INPUT_TIMEOUT;
+	_data_ready = false;
+	sendAction(false);
+	return true;
+}
+
+bool GPRSHTTP::beginGet()
+{
+	return beginAction(GET);
+}
+
+bool GPRSHTTP::beginHead()
+{
+	return beginAction(HEAD);
+}
+
+bool GPRSHTTP::get(int &cid, int &HTTP_CODE, int32_t &length)
+{
+	return beginGet() && complete() && getPostResult(cid, HTTP_CODE, length);
+}
+
+bool GPRSHTTP::head(int &cid, int &HTTP_CODE, int32_t &length)
+{
+	return beginHead() && complete() && getPostResult(cid, HTTP_CODE, length);
+}
+
+bool GPRSHTTP::beginRetrieve()
+{
+	if(!beginOperation())
+	{
+		return false;
+	}
+	if(SIM900_LOG_ENABLED(SIM900_LOG_INFO))
+	{
+		SIM900_DEBUG_OUTPUT_STREAM->println(F("Getting Data."));
+	}
+	_sim->_serial->print(F("AT+HTTPREAD=0,"));
+	_sim->_serial->println(read_limit, DEC);
+	_step = GPRSHTTP_STEP_READ;
+	_sim->beginWait(F("+HTTPREAD:"), true, NULL, 0);
+	return true;
+}
+
+int GPRSHTTP::init_retrieve()
+{
+	return beginRetrieve() && complete();
+}
+
+bool GPRSHTTP::beginReadRange(uint32_t offset, uint8_t* buffer, uint32_t length)
+{
+	if(!beginOperation())
+	{
+		return false;
+	}
+	_range_buffer = buffer;
+	_range_offset = offset;
+	_range_length = length;
+	_range_got = 0;
+	_received = 0;
+	_sink = NULL;
+	readRangeWindow();
+	return true;
+}
+
+int32_t GPRSHTTP::readRange(uint32_t offset, uint8_t* buffer, uint32_t length)
+{
+	if(!beginReadRange(offset, buffer, length) || !complete())
+	{
+		return get_error_condition();
+	}
+	return _received;
+}
+
+bool GPRSHTTP::beginStreamBody(HTTP_SINK sink, uint8_t* buffer, uint32_t window)
+{
+	if(window == 0 || !beginReadRange(0, buffer, window))
+	{
+		return false;
+	}
+	_sink = sink;
+	return true;
+}
+
+int32_t GPRSHTTP::streamBody(HTTP_SINK sink, uint8_t* buffer, uint32_t window)
+{
+	if(!beginStreamBody(sink, buffer, window) || !complete())
+	{
+		return get_error_condition();
+	}
+	return _received;
+}
+
+uint32_t GPRSHTTP::received()
+{
+	return _received;
+}
+
+bool GPRSHTTP::beginTerminate()
+{
+	if(!beginOperation())
+	{
+		return false;
+	}
+	if(_sim->_session_mode && !_failed && _sim->_session_state == SIM900_SESSION_OPEN && _sim->_session_cid == _cid)
+	{
+		//Leave the bearer and HTTP service up for the next connection.
+		_sim->_session_time = millis();
+		release();
+		finish(SIM900_ERROR_NO_ERROR);
+		return true;
+	}
+	_step = GPRSHTTP_STEP_TERM;
+	HTTPTERM();
+	return true;
+}
+
+bool GPRSHTTP::terminate()
+{
+	return beginTerminate() && complete();
+}
+
+size_t GPRSHTTP::write(uint8_t byte)
+{
+	if(write_count++ < write_limit)
+	{
+		
+		size_t toRet = _sim->_serial->write(byte);
+		if(SIM900_LOG_ENABLED(SIM900_LOG_DEBUG) && _sim->_serial->available())
+		{
+			SIM900_DEBUG_OUTPUT_STREAM->println();
+			while(_sim->_serial->available())
+			{
+				SIM900_DEBUG_OUTPUT_STREAM->print((char)_sim->_serial->read());
+			}
+			SIM900_DEBUG_OUTPUT_STREAM->println();
+		}
+		return toRet;
+	}
+	return 0;
+}
+
+//
+//Hands whole chunks to the serial port instead of going through
+//write(uint8_t) for every byte. Returns the number of bytes accepted, which
+//is less than size when the write limit set by post_init is reached.
+//
+size_t GPRSHTTP::write(const uint8_t* buffer, size_t size)
+{
+	size_t written = 0, chunk, sent;
+	unsigned long waited;
+	if(write_count >= write_limit)
+	{
+		return 0;
+	}
+	if(size > write_limit - write_count)
+	{
+		size = write_limit - write_count;
+	}
+	while(written < size)
+	{
+		chunk = size - written;
+		if(chunk > SIM900_WRITE_CHUNK_SIZE)
+		{
+			chunk = SIM900_WRITE_CHUNK_SIZE;
+		}
+		waited = micros() - _chunk_time;
+		if(waited < SIM900_WRITE_CHUNK_INTERVAL)
+		{
+			delayMicroseconds(SIM900_WRITE_CHUNK_INTERVAL - waited);
+		}
+		_chunk_time = micros();
+		sent = _sim->_serial->write(buffer + written, chunk);
+		written += sent;
+		write_count += sent;
+		if(sent < chunk)
+		{
+			break;
+		}
+	}
+	if(SIM900_LOG_ENABLED(SIM900_LOG_DEBUG) && _sim->_serial->available())
+	{
+		SIM900_DEBUG_OUTPUT_STREAM->println();
+		while(_sim->_serial->available())
+		{
+			SIM900_DEBUG_OUTPUT_STREAM->print((char)_sim->_serial->read());
+		}
+		SIM900_DEBUG_OUTPUT_STREAM->println();
+	}
+	return written;
+}
+
+//
+//How much write() takes right now without waiting, a chunk once
+//SIM900_WRITE_CHUNK_INTERVAL has passed since the last one and 0 before.
+//
+int GPRSHTTP::availableForWrite()
+{
+	uint32_t left = write_limit - write_count;
+	if(write_count >= write_limit || (micros() - _chunk_time) < SIM900_WRITE_CHUNK_INTERVAL)
+	{
+		return 0;
+	}
+	return left < SIM900_WRITE_CHUNK_SIZE ? left : SIM900_WRITE_CHUNK_SIZE;
+}
+
+
+size_t GPRSHTTP::read(char* buf, int length)
+{
+	return read((byte*)buf, length);
+}
+
+//
+//Copies whatever has arrived in one go, as copyRange() does, instead of a
+//read() per byte. Returns the number of bytes copied, which is less than
+//length if the body ends first (SIM900_ERROR_READ_LIMIT_EXCEEDED) or
+//nothing arrives for SIM900_INPUT_TIMEOUT.
+//
+size_t GPRSHTTP::read(byte* buf, int length)
+{
+	int copied = 0, avail;
+	unsigned long time = millis();
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	if(!_data_ready)
+	{
+		set_error_condition(SIM900_ERROR_DATA_NOT_READY);
+		return 0;
+	}
+	while(copied < length)
+	{
+		if(read_count >= read_limit)
+		{
+			set_error_condition(SIM900_ERROR_READ_LIMIT_EXCEEDED);
+			break;
+		}
+		avail = _sim->_serial->available();
+		if(avail <= 0)
+		{
+			if((millis() - time) > SIM900_INPUT_TIMEOUT)
+			{
+				if(SIM900_LOG_ENABLED(SIM900_LOG_ERROR))
+				{
+					SIM900_DEBUG_OUTPUT_STREAM->println(F("The timeout was reached whilst trying to read the HTTP response."));
+				}
+				increment_metric(_sim->_metrics.timeouts);
+				set_error_condition(SIM900_ERROR_TIMEOUT);
+				break;
+			}
+			continue;
+		}
+		if(avail > length - copied)
+		{
+			avail = length - copied;
+		}
+		if((uint32_t)avail > read_limit - read_count)
+		{
+			avail = read_limit - read_count;
+		}
+		for(int i = 0; i < avail; i++)
+		{
+			buf[copied + i] = _sim->_serial->read();
+		}
+		copied += avail;
+		read_count += avail;
+		time = millis();
+	}
+	if(read_count >= read_limit)
+	{
+		//The whole body has been read, hand the stream back.
+		_sim->_data_mode = false;
+	}
+	return copied;
+}
+
+int GPRSHTTP::read()
+{
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	unsigned long time = millis();
+	int avail = 0;
+	if(!_data_ready)
+	{
+		set_error_condition(SIM900_ERROR_DATA_NOT_READY);
+		return SIM900_ERROR_DATA_NOT_READY;
+	}
+	if(read_count++ <= read_limit)
+	{
+		while((avail = available()) == false)
+		{
+			if((millis() - time) > SIM900_INPUT_TIMEOUT)
+			{
+				if(SIM900_LOG_ENABLED(SIM900_LOG_ERROR))
+				{
+					SIM900_DEBUG_OUTPUT_STREAM->println(F("The timeout was reached whilst trying to read the HTTP response."));
+				}
+				increment_metric(_sim->_metrics.timeouts);
+				return SIM900_ERROR_TIMEOUT;
+			}
+		}
+		if(avail > 0)
+		{
+			if(read_count >= read_limit)
+			{
+				//The whole body has been read, hand the stream back.
+				_sim->_data_mode = false;
+			}
+			return _sim->_serial->read();
+		}else
+		{
+			set_error_condition(avail);
+			return avail;
+		}
+	}
+	else
+	{
+		if(SIM900_LOG_ENABLED(SIM900_LOG_ERROR))
+		{
+			set_error_condition(SIM900_ERROR_READ_LIMIT_EXCEEDED);
+			SIM900_DEBUG_OUTPUT_STREAM->print(F("Read limit: "));
+			SIM900_DEBUG_OUTPUT_STREAM->print(read_limit);
+			SIM900_DEBUG_OUTPUT_STREAM->print(F(" has been exceed by read count: "));
+			SIM900_DEBUG_OUTPUT_STREAM->println(read_count);
+		}
+	}
+	return -1;
 }
 
-bool GPRSHTTP::setParam(char* param, String value)
+int GPRSHTTP::available()
 {
-	if(!initialized)
+	if(read_count <= read_limit)
+	{
+		return _sim->_serial->available();
+	}
+	else
+	{
+		if(SIM900_LOG_ENABLED(SIM900_LOG_ERROR))
+		{
+			SIM900_DEBUG_OUTPUT_STREAM->print(F("Read limit: "));
+			SIM900_DEBUG_OUTPUT_STREAM->print(read_limit);
+			SIM900_DEBUG_OUTPUT_STREAM->print(F(" has been exceed by read count: "));
+			SIM900_DEBUG_OUTPUT_STREAM->println(read_count);
+		}
+		return SIM900_ERROR_READ_LIMIT_EXCEEDED;
+	}
+	return false;
+}
+
+void GPRSHTTP::flush()
+{
+	_sim->_serial->flush();
+}
+
+int GPRSHTTP::peek()
+{
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	if(read_count <= read_limit)
+	{
+		return _sim->_serial->peek();
+	}
+	else
+	{
+		if(SIM900_LOG_ENABLED(SIM900_LOG_ERROR))
+		{
+			set_error_condition(SIM900_ERROR_READ_LIMIT_EXCEEDED);
+			SIM900_DEBUG_OUTPUT_STREAM->print(F("Read limit: "));
+			SIM900_DEBUG_OUTPUT_STREAM->print(read_limit);
+			SIM900_DEBUG_OUTPUT_STREAM->print(F(" has been exceed by read count: "));
+			SIM900_DEBUG_OUTPUT_STREAM->print(read_count);
+		}
+	}
+	return -1;
+	
+}
+
+void GPRSHTTP::set_error_condition(int error_value)
+{
+	_error_condition = error_value;
+}
+
+int GPRSHTTP::get_error_condition()
+{
+	return _error_condition;
+}
+
+
+GPRSSocket::GPRSSocket(Sim900* sim, uint8_t id)
+{
+	_sim = sim;
+	_id = id;
+	_connected = true;
+	_rx_pending = false;
+	_rx_head = 0;
+	_rx_count = 0;
+	_tx_count = 0;
+	_error_condition = SIM900_ERROR_NO_ERROR;
+}
+
+GPRSSocket::~GPRSSocket()
+{
+	if(_connected)
+	{
+		close();
+	}
+	_sim->_sockets[_id] = NULL;
+}
+
+void GPRSSocket::set_error_condition(int error_value)
+{
+	_error_condition = error_value;
+}
+
+int GPRSSocket::get_error_condition()
+{
+	return _error_condition;
+}
+
+bool GPRSSocket::connected()
+{
+	if(_sim->isDone())
+	{
+		_sim->poll();
+	}
+	return _connected || _rx_count > 0 || _rx_pending;
+}
+
+bool GPRSSocket::close()
+{
+	flush();
+	_sim->complete();
+	if(!_sim->lock())
+	{
+		set_error_condition(SIM900_ERROR_COULD_NOT_AQUIRE_LOCK);
+		return false;
+	}
+	bool was_connected = _connected;
+	_connected = false;
+	_rx_pending = false;
+	_sim->_serial->print(F("AT+CIPCLOSE="));
+	_sim->_serial->println(_id, DEC);
+	//The modem answers ERROR if the other end has already closed.
+	bool ok = _sim->waitFor(F("CLOSE OK"), true, NULL, 0);
+	_sim->unlock();
+	return ok || !was_connected;
+}
+
+//
+//Reads as much of the data held by the modem as fits in the receive buffer
+//with AT+CIPRXGET=2. The reply is +CIPRXGET: 2,<id>,<length>,<left> followed
+//by the data and OK.
+//
+bool GPRSSocket::fetch()
+{
+	const char* targets[] = {SIM900_TARGET_CIPRXGET, SIM900_TARGET_OK};
+	_sim->complete();
+	if(!_sim->lock())
+	{
+		set_error_condition(SIM900_ERROR_COULD_NOT_AQUIRE_LOCK);
+		return false;
+	}
+	_sim->_serial->print(F("AT+CIPRXGET=2,"));
+	_sim->_serial->print(_id, DEC);
+	_sim->_serial->print(F(","));
+	_sim->_serial->println(SIM900_SOCKET_BUFFER - _rx_count, DEC);
+	bool ok = _sim->beginWait(targets, 2, false, NULL, 0, SIM900_INPUT_TIMEOUT, true) && _sim->complete();
+	if(ok && _sim->matched() == 0)
+	{
+		_sim->_response[0] = '\0';
+		//The line ending is left alone, the data may start with one.
+		ok = _sim->waitFor(F("\n"), false, _sim->_response, sizeof(_sim->_response));
+		//"<id>,<length>,<pending>"
+		int length = number_field(_sim->_response, 1);
+		_rx_pending = number_field(_sim->_response, 2) > 0;
+		unsigned long time = millis();
+		while(ok && length > 0)
+		{
+			if(_sim->_serial->available())
+			{
+				_rx[(_rx_head + _rx_count) % SIM900_SOCKET_BUFFER] = _sim->_serial->read();
+				_rx_count++;
+				length--;
+				time = millis();
+			}else if((millis() - time) > SIM900_INPUT_TIMEOUT)
+			{
+				_sim->set_error_condition(SIM900_ERROR_TIMEOUT);
+				ok = false;
+			}
+		}
+		ok = ok && _sim->waitFor(F("OK"), true, NULL, 0);
+	}else if(ok)
+	{
+		//A bare OK, nothing is waiting.
+		_rx_pending = false;
+	}
+	_sim->unlock();
+	if(!ok)
+	{
+		set_error_condition(_sim->get_error_condition());
+	}
+	return ok;
+}
+
+//
+//Sends data with AT+CIPSEND=<id>,<length>, the data follows the > prompt and
+//the modem answers "<id>, SEND OK" once it has been sent.
+//
+bool GPRSSocket::send(const uint8_t* data, size_t length)
+{
+	const char* targets[] = {SIM900_TARGET_SEND_OK, SIM900_TARGET_SEND_FAIL};
+	if(!_connected)
+	{
+		set_error_condition(SIM900_ERROR_SOCKET_CLOSED);
+		return false;
+	}
+	_sim->complete();
+	if(!_sim->lock())
+	{
+		set_error_condition(SIM900_ERROR_COULD_NOT_AQUIRE_LOCK);
+		return false;
+	}
+	_sim->_serial->print(F("AT+CIPSEND="));
+	_sim->_serial->print(_id, DEC);
+	_sim->_serial->print(F(","));
+	_sim->_serial->println(length, DEC);
+	bool ok = _sim->waitFor(F(">"), false, NULL, 0);
+	if(ok)
+	{
+		_sim->_serial->write(data, length);
+		ok = _sim->beginWait(targets, 2, true, NULL, 0, SIM900_INPUT_TIMEOUT, true) && _sim->complete();
+		if(ok && _sim->matched() != 0)
+		{
+			_sim->set_error_condition(SIM900_ERROR_SEND_FAILED);
+			ok = false;
+		}
+	}
+	_sim->unlock();
+	set_error_condition(_sim->get_error_condition());
+	return ok;
+}
+
+int GPRSSocket::available()
+{
+	if(_rx_count == 0)
+	{
+		if(_sim->isDone())
+		{
+			_sim->poll();
+		}
+		if(_rx_pending)
+		{
+			fetch();
+		}
+	}
+	return _rx_count;
+}
+
+int GPRSSocket::read()
+{
+	if(available() == 0)
+	{
+		return -1;
+	}
+	uint8_t c = _rx[_rx_head];
+	_rx_head = (_rx_head + 1) % SIM900_SOCKET_BUFFER;
+	_rx_count--;
+	return c;
+}
+
+int GPRSSocket::peek()
+{
+	if(available() == 0)
+	{
+		return -1;
+	}
+	return _rx[_rx_head];
+}
+
+size_t GPRSSocket::write(uint8_t byte)
+{
+	if(_tx_count == SIM900_SOCKET_BUFFER)
+	{
+		flush();
+		if(_tx_count == SIM900_SOCKET_BUFFER)
+		{
+			return 0;
+		}
+	}
+	_tx[_tx_count++] = byte;
+	return 1;
+}
+
+size_t GPRSSocket::write(const uint8_t* buffer, size_t size)
+{
+	flush();
+	if(_tx_count > 0)
+	{
+		return 0;
+	}
+	size_t sent = 0;
+	while(sent < size)
+	{
+		size_t chunk = size - sent;
+		if(chunk > SIM900_SOCKET_SEND_LIMIT)
+		{
+			chunk = SIM900_SOCKET_SEND_LIMIT;
+		}
+		if(!send(buffer + sent, chunk))
+		{
+			break;
+		}
+		sent += chunk;
+	}
+	return sent;
+}
+
+void GPRSSocket::flush()
+{
+	if(_tx_count > 0 && send(_tx, _tx_count))
+	{
+		_tx_count = 0;
+	}
+}
+
+OutboundQueue::OutboundQueue(QueueStorage* storage)
+{
+	_storage = storage;
+	_capacity = 0;
+	_head = 0;
+	_used = 0;
+	_count = 0;
+	_error_condition = SIM900_ERROR_NO_ERROR;
+}
+
+void OutboundQueue::set_error_condition(int error_value)
+{
+	_error_condition = error_value;
+}
+
+int OutboundQueue::get_error_condition()
+{
+	return _error_condition;
+}
+
+//
+//Offsets are relative to the oldest record and wrap around the end of the
+//storage.
+//
+uint8_t OutboundQueue::readData(uint16_t offset)
+{
+	return _storage->read(SIM900_QUEUE_HEADER + (uint16_t)(((uint32_t)_head + offset) % _capacity));
+}
+
+void OutboundQueue::writeData(uint16_t offset, uint8_t value)
+{
+	_storage->write(SIM900_QUEUE_HEADER + (uint16_t)(((uint32_t)_head + offset) % _capacity), value);
+}
+
+uint16_t OutboundQueue::recordLength(uint16_t offset)
+{
+	return ((uint16_t)readData(offset) << 8) | readData(offset + 1);
+}
+
+//
+//The header is written after the records it describes, so a reset part way
+//through a push loses at most that record.
+//
+void OutboundQueue::saveHeader()
+{
+	uint16_t header[4] = {SIM900_QUEUE_MAGIC, _head, _used, _count};
+	for(uint8_t i = 0; i < 4; i++)
+	{
+		_storage->write(i * 2, header[i] >> 8);
+		_storage->write(i * 2 + 1, header[i] & 0xFF);
+	}
+	_storage->commit();
+}
+
+bool OutboundQueue::begin()
+{
+	uint16_t header[4];
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	if(_storage->size() <= SIM900_QUEUE_HEADER + 2)
 	{
-		Serial.println("GPRSHTTP must have been initialized before setParam can be called.");
+		set_error_condition(SIM900_ERROR_QUEUE_FULL);
 		return false;
 	}
-        //Set the PARAM
-	Serial.print("Setting HTTP Param ");
-	Serial.print(param);
-	Serial.print(" to ");
-	Serial.println(value);
-        _sim->_serial->write("AT+HTTPPARA=\"");
-	_sim->_serial->print(param);
-	_sim->_serial->print("\",\"");
-        _sim->_serial->print(value);
-        _sim->_serial->println("\"");
-        if(!_sim->waitFor("OK", true, NULL))
-        {	
-                return false;
-        }
+	_capacity = _storage->size() - SIM900_QUEUE_HEADER;
+	for(uint8_t i = 0; i < 4; i++)
+	{
+		header[i] = ((uint16_t)_storage->read(i * 2) << 8) | _storage->read(i * 2 + 1);
+	}
+	_head = header[1];
+	_used = header[2];
+	_count = header[3];
+	//Walk the records to make sure the header agrees with them.
+	uint32_t offset = 0;
+	uint16_t records = 0;
+	bool valid = header[0] == SIM900_QUEUE_MAGIC && _head < _capacity && _used <= _capacity;
+	while(valid && offset < _used)
+	{
+		offset += 2 + (uint32_t)recordLength(offset);
+		records++;
+	}
+	if(!valid || offset != _used || records != _count)
+	{
+		clear();
+	}
 	return true;
 }
-bool GPRSHTTP::setParam(char* param, uint32_t value)
+
+bool OutboundQueue::push(const uint8_t* data, uint16_t length)
+{
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	if(_capacity == 0 || length > space())
+	{
+		set_error_condition(SIM900_ERROR_QUEUE_FULL);
+		return false;
+	}
+	writeData(_used, length >> 8);
+	writeData(_used + 1, length & 0xFF);
+	for(uint16_t i = 0; i < length; i++)
+	{
+		writeData(_used + 2 + i, data[i]);
+	}
+	_used += 2 + length;
+	_count++;
+	saveHeader();
+	return true;
+}
+
+bool OutboundQueue::push(const char* text)
 {
-	return setParam(param, String(value));
+	return push((const uint8_t*)text, strlen(text));
 }
-bool GPRSHTTP::setParam(char* param, char* value)
+
+int32_t OutboundQueue::peek(uint8_t* buffer, uint16_t length)
+{
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	if(_count == 0)
+	{
+		set_error_condition(SIM900_ERROR_QUEUE_EMPTY);
+		return SIM900_ERROR_QUEUE_EMPTY;
+	}
+	uint16_t record = recordLength(0);
+	for(uint16_t i = 0; i < length && i < record; i++)
+	{
+		buffer[i] = readData(2 + i);
+	}
+	return record;
+}
+
+void OutboundQueue::drop(uint16_t records, uint16_t bytes)
+{
+	_head = ((uint32_t)_head + bytes) % _capacity;
+	_used -= bytes;
+	_count -= records;
+	saveHeader();
+}
+
+bool OutboundQueue::pop()
+{
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	if(_count == 0)
+	{
+		set_error_condition(SIM900_ERROR_QUEUE_EMPTY);
+		return false;
+	}
+	drop(1, 2 + recordLength(0));
+	return true;
+}
+
+void OutboundQueue::clear()
+{
+	_head = 0;
+	_used = 0;
+	_count = 0;
+	saveHeader();
+}
+
+uint16_t OutboundQueue::count()
+{
+	return _count;
+}
+
+uint16_t OutboundQueue::used()
 {
-	return setParam(param, String(value));
+	return _used;
 }
-int GPRSHTTP::isCGATT()
+
+uint16_t OutboundQueue::space()
 {
-	_sim->_serial->println("AT+CGATT?");
-	String connected;
-	if(!_sim->waitFor("OK", true, &connected))
-	{
-		return -1;
-	}
-	int pos = connected.indexOf("+CGATT: ");
-	pos = connected.indexOf(" ", pos);
-	connected = connected.substring(pos, connected.indexOf("\r", pos));
-	connected.trim();
-	if(SIM900_DEBUG_OUTPUT)
+	if(_capacity - _used < 2)
 	{
-		SIM900_DEBUG_OUTPUT_STREAM->print("CGATT result:  ");
-		SIM900_DEBUG_OUTPUT_STREAM->println(connected);
+		return 0;
 	}
-	return connected.toInt();
-
+	return _capacity - _used - 2;
 }
-bool GPRSHTTP::HTTPINIT(int retries, int _delay)
+
+//
+//Posts the records at the front of the queue that fit in one body. The body
+//is the queue's own framing, so it is copied straight out of the storage.
+//
+bool OutboundQueue::postBatch(Sim900* sim, CONN &settings, char URL[])
 {
-	//Initialize the HTTP Application context.
-	for(int i = 0; i < retries; i++)
+	uint32_t limit = sim->get_max_http_post_size();
+	uint32_t bytes = 0, record;
+	uint16_t records = 0;
+	while(records < _count)
 	{
-		_sim->_serial->println("AT+HTTPINIT");
-		if(_sim->waitFor("OK", true, NULL))
+		record = 2 + (uint32_t)recordLength(bytes);
+		if(records > 0 && bytes + record > limit)
 		{
-
-			SIM900_DEBUG_OUTPUT_STREAM->println("HTTP Initialized!");
-			return true;
+			break;
 		}
-		SIM900_DEBUG_OUTPUT_STREAM->println("Failed to initialize HTTP context, waiting to retry.");
-		delay(_delay);
+		bytes += record;
+		records++;
 	}
-	return false;
-}
 
-bool GPRSHTTP::stopBearer(int retries, int _delay)
-{
-		//Shutdown the connection first.
-	for(int i = 0; i < retries; i++)
+	GPRSHTTP* con = sim->createHTTPConnection(settings, URL);
+	if(con == NULL)
 	{
-		_sim->_serial->write("AT+SAPBR=0,");
-		_sim->_serial->println(_cid, DEC);
-		if(_sim->waitFor("OK", true, NULL))
-		{
-			return true;
-		}else
+		set_error_condition(sim->get_error_condition());
+		return false;
+	}
+	int cid = 0, code = 0;
+	int32_t length = 0;
+	bool sent = false, short_write = false;
+	if(con->init() && con->setParam(F("CONTENT"), F("application/octet-stream")) && con->post_init(bytes))
+	{
+		uint8_t chunk[SIM900_WRITE_CHUNK_SIZE];
+		uint32_t done = 0;
+		uint16_t size;
+		while(done < bytes)
 		{
-			if(SIM900_DEBUG_OUTPUT)
+			size = bytes - done < sizeof(chunk) ? bytes - done : sizeof(chunk);
+			for(uint16_t i = 0; i < size; i++)
+			{
+				chunk[i] = readData(done + i);
+			}
+			if(con->write(chunk, size) < size)
 			{
-				SIM900_DEBUG_OUTPUT_STREAM->println("Not Shutdown.");
+				break;
 			}
+			done += size;
 		}
-		delay(_delay);
+		//A short upload is not posted, the whole batch stays queued.
+		short_write = done < bytes;
+		sent = !short_write && con->post(cid, code, length);
 	}
-	return false;
+	set_error_condition(short_write ? SIM900_ERROR_SEND_FAILED : con->get_error_condition());
+	con->terminate();
+	delete con;
+	if(!sent)
+	{
+		return false;
+	}
+	if(code < 200 || code > 299)
+	{
+		set_error_condition(SIM900_ERROR_HTTP_STATUS);
+		return false;
+	}
+	drop(records, bytes);
+	return true;
 }
-bool GPRSHTTP::startBearer(int retries, int _delay)
+
+bool OutboundQueue::flushSMS(Sim900* sim, const char* number)
 {
-	//Start the connection.	
-	for(int i = 0; i < retries; i++)
+	uint8_t message[SIM900_SMS_LENGTH];
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	while(_count > 0)
 	{
-		_sim->_serial->write("AT+SAPBR=1,");
-		_sim->_serial->println(_cid, DEC);
-		if(_sim->waitFor("OK", true, NULL))
+		uint16_t bytes = 0, record;
+		uint16_t records = 0;
+		while(records < _count)
 		{
-			if(SIM900_DEBUG_OUTPUT)
+			record = 2 + recordLength(bytes);
+			if(bytes + record > sizeof(message))
 			{
-				SIM900_DEBUG_OUTPUT_STREAM->println("Connected!");
+				break;
 			}
-			return true;
+			bytes += record;
+			records++;
+		}
+		if(records == 0)
+		{
+			//Too long for one message, it has to go by HTTP.
+			set_error_condition(SIM900_ERROR_CHARACTER_LIMIT_EXCEEDED);
+			return false;
+		}
+		for(uint16_t i = 0; i < bytes; i++)
+		{
+			message[i] = readData(i);
 		}
-		if(SIM900_DEBUG_OUTPUT)
+		if(!sim->sendSMS(number, message, bytes))
 		{
-			SIM900_DEBUG_OUTPUT_STREAM->println("Failed to connect, waiting to retry.");
+			set_error_condition(sim->get_error_condition());
+			return false;
 		}
-		delay(_delay);
+		drop(records, bytes);
 	}
-	return false;
+	return true;
 }
 
-bool GPRSHTTP::init(int timeout)
+bool OutboundQueue::flush(Sim900* sim, CONN settings, char URL[], bool urgent)
 {
-	if(timeout > 1000 || timeout < 30)
+	if(_count > 0 && !sim->canTransmit(urgent))
 	{
-		_error_condition = SIM900_ERROR_INVALID_HTTP_TIMEOUT;
-		if(SIM900_DEBUG_OUTPUT)
-		{
-			SIM900_DEBUG_OUTPUT_STREAM->println(get_error_message(SIM900_ERROR_INVALID_HTTP_TIMEOUT));
-		}
+		set_error_condition(SIM900_ERROR_WEAK_SIGNAL);
 		return false;
 	}
-	int connected = isCGATT();
-	if(connected == -1)
+	set_error_condition(SIM900_ERROR_NO_ERROR);
+	while(_count > 0)
 	{
-		return false;
+		if(!postBatch(sim, settings, URL))
+		{
+			return false;
+		}
 	}
-	delay(1000);
+	return true;
+}
 
-	if(connected == 1){
-		stopBearer(1, 0);
-	}
-	
-	if(!startBearer(5, 2000))
-	{
-		return false;
-	}
+ValidatorCache::ValidatorCache()
+{
+	clear();
+}
 
-	initialized = HTTPINIT(5, 2000);
-	if(!initialized)
+validator_entry* ValidatorCache::find(const char* url)
+{
+	uint16_t hash = hash_setting(url, strlen(url)) | 1;
+	for(uint8_t i = 0; i < SIM900_VALIDATOR_CACHE_SIZE; i++)
 	{
-		return false;
+		if(_entries[i].url == hash)
+		{
+			return &_entries[i];
+		}
 	}
+	return NULL;
+}
 
-	//Set the CID
-	if(!setParam("CID", _cid))
+validator_entry* ValidatorCache::add(const char* url)
+{
+	validator_entry* entry = find(url);
+	if(entry == NULL)
 	{
-		return false;
+		entry = &_entries[_next];
+		_next = (_next + 1) % SIM900_VALIDATOR_CACHE_SIZE;
+		entry->url = hash_setting(url, strlen(url)) | 1;
 	}
+	entry->etag[0] = '\0';
+	entry->modified[0] = '\0';
+	return entry;
+}
 
-	//Set the URL
-	if(!setParam("URL", url))
+void ValidatorCache::forget(const char* url)
+{
+	validator_entry* entry = find(url);
+	if(entry != NULL)
 	{
-		return false;
+		entry->url = 0;
 	}
+}
 
-	//Set the HTTP Timeout
-	if(!setParam("TIMEOUT", timeout))
-	{
-		return false;
-	}
+void ValidatorCache::clear()
+{
+	memset(_entries, 0, sizeof(_entries));
+	_next = 0;
+}
 
-	Serial.print("URL: "); Serial.println(url);
-	return true;
+ModemManager::ModemManager()
+{
+	memset(_modems, 0, sizeof(_modems));
+	memset(_connections, 0, sizeof(_connections));
+	memset(_running, 0, sizeof(_running));
+	memset(_failures, 0, sizeof(_failures));
+	_count = 0;
+	_queued = 0;
+	_handler = NULL;
+	_error_condition = SIM900_ERROR_NO_ERROR;
 }
 
-bool GPRSHTTP::post_init(uint32_t content_length){
-	set_error_condition(SIM900_ERROR_NO_ERROR);
-	if(content_length > _sim->max_http_post_size)
-	{
-		if(SIM900_DEBUG_OUTPUT)
-		{
-			SIM900_DEBUG_OUTPUT_STREAM->print("Specified Content Length: ");
-			SIM900_DEBUG_OUTPUT_STREAM->print(content_length);
-			SIM900_DEBUG_OUTPUT_STREAM->print(" is greater than the maximum allowed post size of ");
-			SIM900_DEBUG_OUTPUT_STREAM->println(_sim->max_http_post_size);
-		}
-		set_error_condition(SIM900_ERROR_MAX_POST_DATA_SIZE_EXCEEDED);
-		return false;
-	}
-	_sim->_serial->write("AT+HTTPDATA=");
-	_sim->_serial->print(content_length, DEC);
-	_sim->_serial->write(",");
-	_sim->_serial->println(SIM900_HTTP_TIMEOUT, DEC);
-	if(!_sim->waitFor("DOWNLOAD", true, NULL))
+int ModemManager::addModem(Sim900* modem, CONN settings)
+{
+	if(_count == SIM900_MAX_MODEMS)
 	{
-		return false;
+		return -1;
 	}
-	write_limit = content_length;
-//	return _sim->_serial;
-	return true;
+	_modems[_count] = modem;
+	_settings[_count] = settings;
+	return _count++;
+}
 
+uint8_t ModemManager::count()
+{
+	return _count;
 }
 
+Sim900* ModemManager::getModem(uint8_t index)
+{
+	return index < _count ? _modems[index] : NULL;
+}
 
-//If the response from the server does not have a Content-Length header
-//then length will always be zero.
-bool GPRSHTTP::post(int &cid, int &HTTP_CODE, int32_t &length){
-	unsigned long upload_time_out = SIM900_INPUT_TIMEOUT;
-	if(SIM900_DEBUG_OUTPUT)
-	{
-		SIM900_DEBUG_OUTPUT_STREAM->print("Write Count: ");
-		SIM900_DEBUG_OUTPUT_STREAM->print(write_count);
-		SIM900_DEBUG_OUTPUT_STREAM->print(" Write Limit: ");
-		SIM900_DEBUG_OUTPUT_STREAM->println(write_limit);
-	}
-	if(write_limit * 10 > upload_time_out)
-	{
-		upload_time_out = write_limit * 10;
-	}
-	if(!_sim->waitFor("OK", true, NULL))
-	{
-		return false;
-	}
-	_sim->_serial->write("AT+HTTPACTION=");
-	_sim->_serial->println(POST, DEC);
-	if(!_sim->waitFor("+HTTPACTION:", true, NULL, upload_time_out))
+void ModemManager::setUploadHandler(UPLOAD_HANDLER handler)
+{
+	_handler = handler;
+}
+
+bool ModemManager::submit(SIM900_UPLOAD* upload)
+{
+	if(_queued == SIM900_MAX_UPLOADS)
 	{
+		set_error_condition(SIM900_ERROR_QUEUE_FULL);
 		return false;
 	}
-	String* tmp = new String();
-	_sim->waitFor("\n", true, tmp);
-	int _start = tmp->indexOf(",");
-	cid = tmp->substring(0, _start).toInt();
-	int _end = tmp->indexOf(",", _start+1);
-	HTTP_CODE = tmp->substring(_start + 1, _end).toInt();
-	_start = _end + 1;
-	length = tmp->substring(_start).toInt();
-	read_limit = length;
-	delete tmp;
+	upload->state = SIM900_UPLOAD_QUEUED;
+	upload->modem = -1;
+	upload->attempts = 0;
+	upload->sent = 0;
+	upload->result = SIM900_ERROR_NO_ERROR;
+	upload->code = 0;
+	_queue[_queued++] = upload;
+	set_error_condition(SIM900_ERROR_NO_ERROR);
 	return true;
+}
 
+uint8_t ModemManager::queued()
+{
+	return _queued;
 }
 
-int GPRSHTTP::init_retrieve()
+uint8_t ModemManager::inFlight()
 {
-	Serial.println("Getting Data.");
-	_sim->_serial->print("AT+HTTPREAD=0,");
-	_sim->_serial->println(read_limit, DEC);
-	if(!_sim->waitFor("+HTTPREAD:", true, NULL))
+	uint8_t running = 0;
+	for(uint8_t i = 0; i < _count; i++)
 	{
-		return false;
+		if(_running[i] != NULL)
+		{
+			running++;
+		}
 	}
-	_sim->waitFor("\n", true, NULL);
-	_data_ready = true;
-	return true;
+	return running;
 }
 
-bool GPRSHTTP::terminate()
+void ModemManager::poll()
 {
-	_sim->_serial->println("AT+HTTPTERM");
-	_sim->waitFor("OK", true, NULL);
-	stopBearer(5,1000);
-	_sim->unlock();
+	for(uint8_t i = 0; i < _count; i++)
+	{
+		_modems[i]->poll();
+		step(i);
+	}
+	dispatch();
 }
 
-size_t GPRSHTTP::write(uint8_t byte)
+//
+//The idle modem an upload should go to: the fewest failures in a row
+//first, then the best smoothed signal. A modem that is busy with a
+//command of its own, or is waiting for its signal, is passed over.
+//
+int ModemManager::pickModem(bool urgent)
 {
-	if(write_count++ < write_limit)
+	int best = -1;
+	for(uint8_t i = 0; i < _count; i++)
 	{
-		
-		size_t toRet = _sim->_serial->write(byte);
-		if(SIM900_DEBUG_OUTPUT && _sim->_serial->available())
+		if(_running[i] != NULL || !_modems[i]->isDone() || !_modems[i]->canTransmit(urgent))
 		{
-			SIM900_DEBUG_OUTPUT_STREAM->println();
-			while(_sim->_serial->available())
-			{
-				SIM900_DEBUG_OUTPUT_STREAM->print((char)_sim->_serial->read());
-			}
-			SIM900_DEBUG_OUTPUT_STREAM->println();
+			continue;
+		}
+		if(best < 0 || _failures[i] < _failures[best] ||
+			(_failures[i] == _failures[best] && _modems[i]->getSmoothedSignal() > _modems[best]->getSmoothedSignal()))
+		{
+			best = i;
 		}
-		return toRet;
 	}
-	return -1;
+	return best;
 }
 
-
-size_t GPRSHTTP::read(char* buf, int length)
+//
+//Starts queued uploads, oldest first, on whichever modems are free. One
+//that no modem can take yet stays queued without holding up those behind
+//it, e.g. an urgent one while the signal is poor.
+//
+void ModemManager::dispatch()
 {
-	return read((byte*)buf, length);
+	uint8_t i = 0;
+	while(i < _queued)
+	{
+		int index = pickModem(_queue[i]->urgent);
+		if(index < 0 || !start(_queue[i], index))
+		{
+			i++;
+			continue;
+		}
+		_queued--;
+		memmove(_queue + i, _queue + i + 1, (_queued - i) * sizeof(SIM900_UPLOAD*));
+	}
 }
 
-size_t GPRSHTTP::read(byte* buf, int length)
+//
+//Takes a connection without waiting for the modem, beginInit() applies the
+//bearer profile as its first steps.
+//
+bool ModemManager::start(SIM900_UPLOAD* upload, uint8_t index)
 {
-	int tmp = -1;
-	for(int i = 0; i < length;)	
+	GPRSHTTP* con = _modems[index]->beginHTTPConnection(_settings[index], upload->url);
+	if(con == NULL)
 	{
-		tmp = read();
-		if(tmp < 0)
+		int error = _modems[index]->get_error_condition();
+		if(error == SIM900_ERROR_BUSY || error == SIM900_ERROR_NO_FREE_CONNECTION)
 		{
-			return i;
+			//A sample, a session shutdown or the escape from a transparent
+			//session is under way, or the pool is in use elsewhere. Neither
+			//is the modem's fault, a later poll() tries again.
+			return false;
 		}
-		buf[i] = tmp;
-		i++;
+		//Left queued for another modem, or this one once it has recovered.
+		if(_failures[index] < 255)
+		{
+			_failures[index]++;
+		}
+		return false;
+	}
+	_connections[index] = con;
+	_running[index] = upload;
+	upload->modem = index;
+	upload->attempts++;
+	upload->sent = 0;
+	upload->result = SIM900_ERROR_NO_ERROR;
+	upload->state = SIM900_UPLOAD_INIT;
+	if(!con->beginInit())
+	{
+		fail(index, con->get_error_condition());
 	}
+	return true;
 }
 
-int GPRSHTTP::read()
+//
+//Moves the upload on modem index to its next step once the connection
+//has finished the last one. The body goes out a chunk per call.
+//
+void ModemManager::step(uint8_t index)
 {
-	set_error_condition(SIM900_ERROR_NO_ERROR);
-	unsigned long time = millis();
-	int avail = 0;
-	if(!_data_ready)
+	SIM900_UPLOAD* upload = _running[index];
+	GPRSHTTP* con = _connections[index];
+	if(upload == NULL || !con->isDone())
 	{
-		set_error_condition(SIM900_ERROR_DATA_NOT_READY);
-		return SIM900_ERROR_DATA_NOT_READY;
+		return;
 	}
-	if(read_count++ <= read_limit)
+	if(upload->state == SIM900_UPLOAD_TERMINATE)
 	{
-		while((avail = available()) == false)
+		finishUpload(index);
+		return;
+	}
+	if(upload->state == SIM900_UPLOAD_DISCARD)
+	{
+		//Out of DOWNLOAD mode, however it ended.
+		terminate(index);
+		return;
+	}
+	if(con->result() != SIM900_ERROR_NO_ERROR)
+	{
+		fail(index, con->result());
+		return;
+	}
+	int cid = 0;
+	int32_t length = 0;
+	uint32_t chunk, room;
+	switch(upload->state)
+	{
+	case SIM900_UPLOAD_INIT:
+		upload->state = SIM900_UPLOAD_DOWNLOAD;
+		if(!con->beginPostInit(upload->length))
 		{
-			if((millis() - time) > SIM900_INPUT_TIMEOUT)
+			fail(index, con->get_error_condition());
+		}
+		return;
+	case SIM900_UPLOAD_DOWNLOAD:
+		upload->state = SIM900_UPLOAD_WRITE;
+		// fall through
+	case SIM900_UPLOAD_WRITE:
+		//No more than write() takes without waiting out the chunk interval,
+		//nothing until it has passed.
+		chunk = upload->length - upload->sent;
+		room = con->availableForWrite();
+		if(chunk > room)
+		{
+			chunk = room;
+		}
+		if(chunk > 0)
+		{
+			chunk = con->write(upload->data + upload->sent, chunk);
+			if(chunk == 0)
 			{
-				if(SIM900_DEBUG_OUTPUT)
-				{
-					SIM900_DEBUG_OUTPUT_STREAM->println("The timeout was reached whilst trying to read the HTTP response.");
-				}
-				return SIM900_ERROR_TIMEOUT;
+				fail(index, SIM900_ERROR_SEND_FAILED);
+				return;
 			}
+			upload->sent += chunk;
 		}
-		if(avail > 0)
+		if(upload->sent == upload->length)
 		{
-			return _sim->_serial->read();
-		}else
+			upload->state = SIM900_UPLOAD_POST;
+			if(!con->beginPost())
+			{
+				fail(index, con->get_error_condition());
+			}
+		}
+		return;
+	case SIM900_UPLOAD_DRAIN:
+		//The modem counts the body bytes it has been promised, so the rest
+		//is sent as it would have been. If that fails too its AT+HTTPDATA
+		//time has to run out instead.
+		chunk = upload->length - upload->sent;
+		room = con->availableForWrite();
+		if(chunk > room)
 		{
-			set_error_condition(avail);
-			return avail;
+			chunk = room;
 		}
-	}
-	else
-	{
-		if(SIM900_DEBUG_OUTPUT)
+		if(chunk > 0)
 		{
-			set_error_condition(SIM900_ERROR_READ_LIMIT_EXCEEDED);
-			SIM900_DEBUG_OUTPUT_STREAM->print("Read limit: ");
-			SIM900_DEBUG_OUTPUT_STREAM->print(read_limit);
-			SIM900_DEBUG_OUTPUT_STREAM->print(" has been exceed by read count: ");
-			SIM900_DEBUG_OUTPUT_STREAM->println(read_count);
+			room = chunk;
+			chunk = con->write(upload->data + upload->sent, chunk);
+			upload->sent += chunk;
+		}
+		if(upload->sent == upload->length || chunk < room)
+		{
+			upload->state = SIM900_UPLOAD_DISCARD;
+			if(!con->beginDiscard())
+			{
+				terminate(index);
+			}
+		}
+		return;
+	case SIM900_UPLOAD_POST:
+		con->getPostResult(cid, upload->code, length);
+		if(upload->code < 200 || upload->code > 299)
+		{
+			fail(index, SIM900_ERROR_HTTP_STATUS);
+			return;
+		}
+		upload->state = SIM900_UPLOAD_TERMINATE;
+		if(!con->beginTerminate())
+		{
+			finishUpload(index);
 		}
+		return;
+	default:
+		return;
 	}
-	return -1;
 }
 
-int GPRSHTTP::available()
+void ModemManager::fail(uint8_t index, int result)
 {
-	if(read_count <= read_limit)
-	{
-		return _sim->_serial->available();
-	}
-	else
+	SIM900_UPLOAD* upload = _running[index];
+	upload->result = result;
+	if(upload->state == SIM900_UPLOAD_WRITE)
 	{
-		if(SIM900_DEBUG_OUTPUT)
-		{
-			SIM900_DEBUG_OUTPUT_STREAM->print("Read limit: ");
-			SIM900_DEBUG_OUTPUT_STREAM->print(read_limit);
-			SIM900_DEBUG_OUTPUT_STREAM->print(" has been exceed by read count: ");
-			SIM900_DEBUG_OUTPUT_STREAM->println(read_count);
-		}
-		return SIM900_ERROR_READ_LIMIT_EXCEEDED;
+		//The modem is taking everything as body bytes, AT+HTTPTERM would
+		//only be more of them.
+		upload->state = SIM900_UPLOAD_DRAIN;
+		return;
 	}
-	return false;
+	terminate(index);
 }
 
-void GPRSHTTP::flush()
+void ModemManager::terminate(uint8_t index)
 {
-	_sim->_serial->flush();
+	_running[index]->state = SIM900_UPLOAD_TERMINATE;
+	if(!_connections[index]->beginTerminate())
+	{
+		finishUpload(index);
+	}
 }
 
-int GPRSHTTP::peek()
+//
+//Gives the modem back and either hands the upload to the handler or, if
+//it failed and has attempts left, queues it again at the front.
+//
+void ModemManager::finishUpload(uint8_t index)
 {
-	set_error_condition(SIM900_ERROR_NO_ERROR);
-	if(read_count <= read_limit)
+	SIM900_UPLOAD* upload = _running[index];
+	GPRSHTTP* con = _connections[index];
+	//If terminating could not be started the modem is given back here,
+	//deleting a connection that still holds it would wait for
+	//terminate() inside poll().
+	if(con->holdsModem())
 	{
-		return _sim->_serial->peek();
+		con->release();
 	}
-	else
+	delete con;
+	_connections[index] = NULL;
+	_running[index] = NULL;
+	if(upload->result == SIM900_ERROR_NO_ERROR)
 	{
-		if(SIM900_DEBUG_OUTPUT)
-		{
-			set_error_condition(SIM900_ERROR_READ_LIMIT_EXCEEDED);
-			SIM900_DEBUG_OUTPUT_STREAM->print("Read limit: ");
-			SIM900_DEBUG_OUTPUT_STREAM->print(read_limit);
-			SIM900_DEBUG_OUTPUT_STREAM->print(" has been exceed by read count: ");
-			SIM900_DEBUG_OUTPUT_STREAM->print(read_count);
-		}
+		_failures[index] = 0;
+	}else if(_failures[index] < 255)
+	{
+		_failures[index]++;
+	}
+	if(upload->result != SIM900_ERROR_NO_ERROR && upload->attempts < SIM900_UPLOAD_ATTEMPTS && _queued < SIM900_MAX_UPLOADS)
+	{
+		memmove(_queue + 1, _queue, _queued * sizeof(SIM900_UPLOAD*));
+		_queue[0] = upload;
+		_queued++;
+		upload->state = SIM900_UPLOAD_QUEUED;
+		return;
+	}
+	upload->state = SIM900_UPLOAD_DONE;
+	if(_handler != NULL)
+	{
+		_handler(upload);
 	}
-	return -1;
-	
 }
 
-void GPRSHTTP::set_error_condition(int error_value)
+void ModemManager::set_error_condition(int error_value)
 {
 	_error_condition = error_value;
 }
 
-int GPRSHTTP::get_error_condition()
+int ModemManager::get_error_condition()
 {
 	return _error_condition;
 }
-
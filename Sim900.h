@@ -29,15 +29,93 @@
 #define SIM900_POWERUP_THRESHOLD 100
 #endif
 
+//PWRKEY is held low for this many milliseconds to switch the modem on or
+//off, the datasheet asks for at least one second. The status pin is then
+//given up to SIM900_POWER_STATUS_TIMEOUT to follow.
+#ifndef SIM900_POWER_KEY_PULSE
+#define SIM900_POWER_KEY_PULSE 1100
+#endif
+
+#ifndef SIM900_POWER_STATUS_TIMEOUT
+#define SIM900_POWER_STATUS_TIMEOUT 5000
+#endif
+
+//How long powerUp() waits for the requested readiness level, and the pause
+//between readiness checks.
+#ifndef SIM900_POWERUP_TIMEOUT
+#define SIM900_POWERUP_TIMEOUT 60000
+#endif
+
+#ifndef SIM900_READINESS_INTERVAL
+#define SIM900_READINESS_INTERVAL 250
+#endif
+
 #ifndef SIM900_HTTP_TIMEOUT
 #define SIM900_HTTP_TIMEOUT 100000
 #endif
 
+//How long an idle session keeps the bearer and HTTP service up, in
+//milliseconds. See Sim900::setSessionMode.
+#ifndef SIM900_SESSION_IDLE_TIMEOUT
+#define SIM900_SESSION_IDLE_TIMEOUT 120000
+#endif
+
+//The signal monitor's defaults, see Sim900::startSignalMonitor(). Signal
+//levels are AT+CSQ <rssi> values (0-31, -113dBm in 2dBm steps) and error
+//rates its <ber> (RXQUAL 0-7), 99 means unknown for both.
+#ifndef SIM900_SIGNAL_INTERVAL
+#define SIM900_SIGNAL_INTERVAL 30000
+#endif
+
+#ifndef SIM900_SIGNAL_GOOD
+#define SIM900_SIGNAL_GOOD 12
+#endif
+
+#ifndef SIM900_SIGNAL_BAD
+#define SIM900_SIGNAL_BAD 8
+#endif
+
+#ifndef SIM900_SIGNAL_MAX_BER
+#define SIM900_SIGNAL_MAX_BER 5
+#endif
+
+//Each sample moves the smoothed values 1/SIM900_SIGNAL_SMOOTHING of the
+//way towards it.
+#ifndef SIM900_SIGNAL_SMOOTHING
+#define SIM900_SIGNAL_SMOOTHING 4
+#endif
+
+//How long a sample waits for each answer, shorter than the usual timeout
+//so that it cannot hold up the commands that follow it for long.
+#ifndef SIM900_SIGNAL_TIMEOUT
+#define SIM900_SIGNAL_TIMEOUT 2000
+#endif
+
+#define SIM900_SIGNAL_UNKNOWN 99
 
+//SMS are sent as 8 bit data in PDU mode, see Sim900::sendSMS(). One
+//message carries SIM900_SMS_LENGTH bytes, each part of a concatenated one
+//SIM900_SMS_PART_LENGTH after its header. A received 7 bit text message
+//unpacks to up to SIM900_SMS_TEXT_LENGTH characters.
+#define SIM900_SMS_LENGTH 140
+#define SIM900_SMS_PART_LENGTH 134
+#define SIM900_SMS_TEXT_LENGTH 160
+//20 digits, the leading + and the NUL.
+#define SIM900_SMS_NUMBER_LENGTH 22
+
+#ifndef SIM900_SMS_TIMEOUT
+#define SIM900_SMS_TIMEOUT 60000
+#endif
+
+//Each error code has a message in the table at the top of Sim900.cpp, see
+//get_error_message().
 #define SIM900_ERROR_LIST_TERMINATOR 1
 #define SIM900_ERROR_NO_ERROR 0
 #define SIM900_ERROR_COULD_NOT_AQUIRE_LOCK -1
+#define SIM900_ERROR_BUSY -2
 #define SIM900_ERROR_MODEM_ERROR -10
+#define SIM900_ERROR_CME_ERROR -11
+#define SIM900_ERROR_CMS_ERROR -12
 #define SIM900_ERROR_TIMEOUT -20
 #define SIM900_ERROR_DATA_NOT_READY -30
 #define SIM900_ERROR_MAX_POST_DATA_SIZE_EXCEEDED -40
@@ -47,11 +125,247 @@
 #define SIM900_ERROR_INVALID_CONNECTION_TYPE -52
 #define SIM900_ERROR_INVALID_CONNECTION_RATE -53
 #define SIM900_ERROR_INVALID_HTTP_TIMEOUT -54
+#define SIM900_ERROR_BAUD_RATE_NOT_FOUND -60
+#define SIM900_ERROR_BAUD_RATE_FIXED -61
+#define SIM900_ERROR_NO_DTR_PIN -62
+#define SIM900_ERROR_NO_FREE_SOCKET -70
+#define SIM900_ERROR_CONNECT_FAILED -71
+#define SIM900_ERROR_SEND_FAILED -72
+#define SIM900_ERROR_SOCKET_CLOSED -73
+#define SIM900_ERROR_NO_FREE_CONNECTION -74
+#define SIM900_ERROR_QUEUE_FULL -80
+#define SIM900_ERROR_QUEUE_EMPTY -81
+#define SIM900_ERROR_HTTP_STATUS -82
+#define SIM900_ERROR_WEAK_SIGNAL -90
 
 #define SIM900_MAX_POST_DATA_V1 318976
 #define SIM900_MAX_POST_DATA_V2 102400
 #define SIM900_CONNECTION_INIT = 2;
 #define SIM900_MAX_CONNECTION_SETTING_CHARACTERS 50
+#define SIM900_BEARER_PROFILES 6
+#define SIM900_BEARER_FIELDS 6
+
+//Bulk writes to a GPRSHTTP connection are sent in chunks of this many
+//bytes, started at least SIM900_WRITE_CHUNK_INTERVAL microseconds apart so
+//that the modem's input buffer is not overrun. The default interval keeps
+//the average rate at about what a 115200 baud link carries.
+#ifndef SIM900_WRITE_CHUNK_SIZE
+#define SIM900_WRITE_CHUNK_SIZE 64
+#endif
+
+#ifndef SIM900_WRITE_CHUNK_INTERVAL
+#define SIM900_WRITE_CHUNK_INTERVAL 5000
+#endif
+
+//The longest response token the command engine can wait for.
+#ifndef SIM900_MAX_TARGET_LENGTH
+#define SIM900_MAX_TARGET_LENGTH 20
+#endif
+
+//The number of tokens a ResponseMatcher can watch at once.
+#ifndef SIM900_MAX_MATCH_TOKENS
+#define SIM900_MAX_MATCH_TOKENS 8
+#endif
+
+#define SIM900_TOKEN_NONE -1
+
+//Unsolicited result codes longer than this are truncated.
+#ifndef SIM900_URC_LINE_LENGTH
+#define SIM900_URC_LINE_LENGTH 48
+#endif
+
+//The number of unsolicited result codes kept for readURC() when no
+//handler is registered for them, the oldest is dropped when it is full.
+#ifndef SIM900_URC_QUEUE_LENGTH
+#define SIM900_URC_QUEUE_LENGTH 3
+#endif
+
+#ifndef SIM900_MAX_URC_HANDLERS
+#define SIM900_MAX_URC_HANDLERS 4
+#endif
+
+//The longest command name (e.g. "+CGREG") tracked to tell a query response
+//apart from an unsolicited result code with the same prefix.
+#define SIM900_MAX_COMMAND_NAME 10
+
+//The number of modems a ModemManager can drive, the uploads it holds while
+//they wait for one, and how many modems an upload is tried on before it
+//is given up.
+#ifndef SIM900_MAX_MODEMS
+#define SIM900_MAX_MODEMS 4
+#endif
+
+#ifndef SIM900_MAX_UPLOADS
+#define SIM900_MAX_UPLOADS 8
+#endif
+
+#ifndef SIM900_UPLOAD_ATTEMPTS
+#define SIM900_UPLOAD_ATTEMPTS 3
+#endif
+
+//The number of GPRSHTTP objects kept in a static pool instead of being
+//allocated on the heap, one per modem that has a connection open.
+//createHTTPConnection() fails with SIM900_ERROR_NO_FREE_CONNECTION once
+//they are all in use. There is one for each modem a ModemManager can
+//drive, so all of them can upload at once.
+#ifndef SIM900_HTTP_CONNECTIONS
+#define SIM900_HTTP_CONNECTIONS SIM900_MAX_MODEMS
+#endif
+
+//The buffer the library captures responses in (e.g. "+CSQ: 20,0"), it has
+//to hold an AT+SAPBR=4 profile listing for the bearer profile to be read
+//back. Anything past its end is dropped.
+#ifndef SIM900_RESPONSE_LENGTH
+#define SIM900_RESPONSE_LENGTH 128
+#endif
+
+//The maximum number of bytes consumed by a single call to poll(), this
+//bounds the time spent inside poll() regardless of how much data is waiting.
+#ifndef SIM900_POLL_BYTE_BUDGET
+#define SIM900_POLL_BYTE_BUDGET 16
+#endif
+
+//The fastest rate negotiateBaudRate() will ask for, and the fastest it will
+//ask for over SoftwareSerial, which does not receive reliably above 57600 on
+//a 16MHz board.
+#ifndef SIM900_MAX_BAUD_RATE
+#define SIM900_MAX_BAUD_RATE 115200
+#endif
+
+#ifndef SIM900_MAX_SOFTWARE_BAUD_RATE
+#define SIM900_MAX_SOFTWARE_BAUD_RATE 57600
+#endif
+
+//The size of the ring buffer the library drains the port's receive buffer
+//(SIM900_SERIAL_BUFFER bytes in the core) into whenever it touches the
+//link, 0 to read the port directly.
+#ifndef SIM900_RX_BUFFER
+#define SIM900_RX_BUFFER 0
+#endif
+
+#ifndef SIM900_SERIAL_BUFFER
+#define SIM900_SERIAL_BUFFER 64
+#endif
+
+//With hardware flow control on (see Sim900::setFlowControl) RTS pauses the
+//modem once SIM900_FLOW_STOP received bytes are waiting and lets it go on
+//once they are down to SIM900_FLOW_RESUME. Writes wait up to
+//SIM900_CTS_TIMEOUT milliseconds for the modem to raise CTS.
+#ifndef SIM900_FLOW_STOP
+#define SIM900_FLOW_STOP ((SIM900_RX_BUFFER + SIM900_SERIAL_BUFFER) / 2)
+#endif
+
+#ifndef SIM900_FLOW_RESUME
+#define SIM900_FLOW_RESUME (SIM900_FLOW_STOP / 2)
+#endif
+
+#ifndef SIM900_CTS_TIMEOUT
+#define SIM900_CTS_TIMEOUT 1000
+#endif
+
+//How long the serial port has to be quiet before a modem in
+//SIM900_SLEEP_AUTO may be asleep, a little under the modem's own 5
+//seconds, and how long it takes to wake up once woken by DTR or a
+//character.
+#ifndef SIM900_SLEEP_IDLE_TIME
+#define SIM900_SLEEP_IDLE_TIME 4000
+#endif
+
+#ifndef SIM900_WAKE_TIME
+#define SIM900_WAKE_TIME 100
+#endif
+
+//How long to wait for the OK to an AT probe during baud rate detection, and
+//how many probes are sent at each rate. The modem needs a few to lock on
+//when it is autobauding.
+#ifndef SIM900_BAUD_PROBE_TIMEOUT
+#define SIM900_BAUD_PROBE_TIMEOUT 300
+#endif
+#define SIM900_BAUD_PROBES 3
+
+//The number of sockets that can be open at once with AT+CIPMUX=1, the
+//modem allows up to 8. Each open socket buffers SIM900_SOCKET_BUFFER bytes
+//in each direction.
+#ifndef SIM900_MAX_SOCKETS
+#define SIM900_MAX_SOCKETS 4
+#endif
+
+//The number of GPRSSocket objects kept in a static pool shared by all
+//modems, createSocket() fails with SIM900_ERROR_NO_FREE_SOCKET once they
+//are all in use.
+#ifndef SIM900_SOCKET_POOL
+#define SIM900_SOCKET_POOL SIM900_MAX_SOCKETS
+#endif
+
+#ifndef SIM900_SOCKET_BUFFER
+#define SIM900_SOCKET_BUFFER 32
+#endif
+
+//The most data sent with a single AT+CIPSEND, larger writes are split.
+#ifndef SIM900_SOCKET_SEND_LIMIT
+#define SIM900_SOCKET_SEND_LIMIT 1024
+#endif
+
+//AT+CIICR and AT+CIPSTART can each take over a minute to complete.
+#ifndef SIM900_CIICR_TIMEOUT
+#define SIM900_CIICR_TIMEOUT 85000
+#endif
+
+#ifndef SIM900_CONNECT_TIMEOUT
+#define SIM900_CONNECT_TIMEOUT 75000
+#endif
+
+//The silence kept on each side of the +++ that leaves transparent mode.
+#ifndef SIM900_ESCAPE_GUARD_TIME
+#define SIM900_ESCAPE_GUARD_TIME 1000
+#endif
+
+//The number of URLs a ValidatorCache remembers, and the longest ETag or
+//Last-Modified value it keeps. Longer values are not cached.
+#ifndef SIM900_VALIDATOR_CACHE_SIZE
+#define SIM900_VALIDATOR_CACHE_SIZE 2
+#endif
+
+#ifndef SIM900_VALIDATOR_LENGTH
+#define SIM900_VALIDATOR_LENGTH 32
+#endif
+
+//An OutboundQueue keeps this many bytes of bookkeeping at the start of its
+//storage, each record then takes 2 bytes more than its length.
+#define SIM900_QUEUE_HEADER 8
+#define SIM900_QUEUE_MAGIC 0x5351
+
+//The number of buckets in each command latency histogram, see
+//SIM900_LATENCY_BOUNDS in Sim900.cpp for their limits.
+#define SIM900_LATENCY_BUCKETS 6
+
+//The library's messages are compiled in up to SIM900_LOG_LEVEL, anything
+//above it compiles to nothing. DEBUG adds the per command chatter and echoes
+//the modem's output byte by byte, which is slow enough to overrun a
+//SoftwareSerial port. Messages that are compiled in are only printed while
+//set_sim900_debug_mode() is on.
+#define SIM900_LOG_NONE 0
+#define SIM900_LOG_ERROR 1
+#define SIM900_LOG_INFO 2
+#define SIM900_LOG_DEBUG 3
+
+#ifndef SIM900_LOG_LEVEL
+#define SIM900_LOG_LEVEL SIM900_LOG_ERROR
+#endif
+
+#define SIM900_LOG_ENABLED(level) ((level) <= SIM900_LOG_LEVEL && SIM900_DEBUG_OUTPUT)
+
+//The number of commands kept in the trace, see Sim900::dumpTrace(). Each
+//takes sizeof(SIM900_TRACE_EVENT) bytes of RAM, 0 leaves the trace out.
+#ifndef SIM900_TRACE_LENGTH
+#define SIM900_TRACE_LENGTH 0
+#endif
+
+//How much of a command's name (e.g. "HTTPPARA" from AT+HTTPPARA=...) the
+//trace keeps.
+#ifndef SIM900_TRACE_NAME_LENGTH
+#define SIM900_TRACE_NAME_LENGTH 8
+#endif
 
 
 #include <Stream.h>
@@ -78,6 +392,134 @@ enum MODEM_VARIANT
 	VARIANT_2
 } ;
 
+enum SIM900_ENGINE_STATE
+{
+	SIM900_ENGINE_IDLE,
+	SIM900_ENGINE_WAITING,
+	SIM900_ENGINE_DELAYING
+};
+
+//How far the modem has come since it was switched on, each level implies
+//the ones before it.
+enum SIM900_READINESS
+{
+	SIM900_READY_OFF,
+	SIM900_READY_POWERED,	//The status pin is high.
+	SIM900_READY_AT,	//Commands are answered.
+	SIM900_READY_SIM,	//+CPIN: READY
+	SIM900_READY_NETWORK,	//Registered with +CREG, home or roaming.
+	SIM900_READY_GPRS	//Registered with +CGREG.
+};
+
+//The AT+CSCLK slow clock modes, see Sim900::sleep().
+enum SIM900_SLEEP_MODE
+{
+	SIM900_SLEEP_OFF,	//AT+CSCLK=0
+	SIM900_SLEEP_DTR,	//AT+CSCLK=1, asleep while DTR is high.
+	SIM900_SLEEP_AUTO	//AT+CSCLK=2, asleep once the port has been quiet.
+};
+
+enum SIM900_POWER_STATE
+{
+	SIM900_POWER_OFF,
+	SIM900_POWER_AWAKE,
+	SIM900_POWER_ASLEEP	//Slow clock, still registered and attached.
+};
+
+//What the signal monitor is waiting for, see Sim900::stepMonitor().
+enum SIM900_MONITOR_STATE
+{
+	SIM900_MONITOR_IDLE,
+	SIM900_MONITOR_CSQ,
+	SIM900_MONITOR_CREG,
+	SIM900_MONITOR_CGREG
+};
+
+enum SIM900_SOCKET_TYPE
+{
+	SIM900_TCP,
+	SIM900_UDP
+};
+
+enum SIM900_TRANSPARENT_STATE
+{
+	SIM900_TRANSPARENT_OFF,
+	SIM900_TRANSPARENT_DATA,	//Everything sent goes to the remote end.
+	SIM900_TRANSPARENT_COMMAND	//Escaped with +++, ATO goes back to data.
+};
+
+//Escaping a transparent session, run from poll() by the command engine.
+enum SIM900_ESCAPE_STEP
+{
+	SIM900_ESCAPE_IDLE,
+	SIM900_ESCAPE_BEFORE,	//The guard time before +++.
+	SIM900_ESCAPE_AFTER,	//The guard time after it.
+	SIM900_ESCAPE_OK
+};
+
+enum SIM900_SESSION_STATE
+{
+	SIM900_SESSION_CLOSED,
+	SIM900_SESSION_OPEN,
+	SIM900_SESSION_CLOSING_HTTP,
+	SIM900_SESSION_CLOSING_BEARER
+};
+
+//Where a ModemManager upload has got to.
+enum SIM900_UPLOAD_STATE
+{
+	SIM900_UPLOAD_QUEUED,
+	SIM900_UPLOAD_INIT,
+	SIM900_UPLOAD_DOWNLOAD,	//AT+HTTPDATA sent, waiting for DOWNLOAD.
+	SIM900_UPLOAD_WRITE,
+	SIM900_UPLOAD_DRAIN,	//A write fell short, the rest goes out unposted.
+	SIM900_UPLOAD_DISCARD,	//Waiting for the modem to end the upload.
+	SIM900_UPLOAD_POST,
+	SIM900_UPLOAD_TERMINATE,
+	SIM900_UPLOAD_DONE
+};
+
+//The steps a GPRSHTTP connection works through while an operation started
+//by one of the begin* methods is in progress.
+enum GPRSHTTP_STEP
+{
+	GPRSHTTP_STEP_IDLE,
+	GPRSHTTP_STEP_PROFILE_READ,
+	GPRSHTTP_STEP_PROFILE_FIELD,
+	GPRSHTTP_STEP_BEARER_STATUS,
+	GPRSHTTP_STEP_HTTP_RESET,
+	GPRSHTTP_STEP_CGATT,
+	GPRSHTTP_STEP_SETTLE,
+	GPRSHTTP_STEP_STOP_BEARER,
+	GPRSHTTP_STEP_START_BEARER,
+	GPRSHTTP_STEP_START_BEARER_RETRY,
+	GPRSHTTP_STEP_HTTPINIT,
+	GPRSHTTP_STEP_HTTPINIT_RETRY,
+	GPRSHTTP_STEP_PARAM_CID,
+	GPRSHTTP_STEP_PARAM_URL,
+	GPRSHTTP_STEP_PARAM_TIMEOUT,
+	GPRSHTTP_STEP_PARAM_USERDATA,
+	GPRSHTTP_STEP_DOWNLOAD,
+	GPRSHTTP_STEP_UPLOAD,
+	GPRSHTTP_STEP_DISCARD,
+	GPRSHTTP_STEP_CONDITION,
+	GPRSHTTP_STEP_ACTION,
+	GPRSHTTP_STEP_ACTION_RESULT,
+	GPRSHTTP_STEP_HEADERS,
+	GPRSHTTP_STEP_HEADERS_LENGTH,
+	GPRSHTTP_STEP_HEADERS_BODY,
+	GPRSHTTP_STEP_HEADERS_OK,
+	GPRSHTTP_STEP_READ,
+	GPRSHTTP_STEP_READ_HEADER,
+	GPRSHTTP_STEP_RANGE,
+	GPRSHTTP_STEP_RANGE_HEADER,
+	GPRSHTTP_STEP_RANGE_BODY,
+	GPRSHTTP_STEP_RANGE_OK,
+	GPRSHTTP_STEP_TERM,
+	GPRSHTTP_STEP_TERM_BEARER,
+	GPRSHTTP_STEP_TERM_BEARER_RETRY
+};
+
 struct CONN
 {
 	int  cid;      // Bearer profile identifier.
@@ -91,102 +533,714 @@ struct CONN
 	CONN() : cid(-1), contype(NULL), apn(NULL), user(NULL), pwd(NULL), phone(NULL), rate(NULL) {}
 };
 
+//An entry of the error message table in Sim900.cpp, the message is kept in
+//flash (PROGMEM).
 struct error_message
 {
-	int code;
-	char* message;
+	int16_t code;
+	const char* message;
 };
 
-static error_message messages[] =
-{
-	{SIM900_ERROR_NO_ERROR, "No Error"},
-	{SIM900_ERROR_COULD_NOT_AQUIRE_LOCK, "Only one connection at a time can use the modem."},
-	{SIM900_ERROR_MODEM_ERROR, "Modem Error"},
-	{SIM900_ERROR_TIMEOUT, "Timed out waiting for modem response."},
-	{SIM900_ERROR_DATA_NOT_READY, "init_retrieve needs to be called before data can be read."},
-	{SIM900_ERROR_MAX_POST_DATA_SIZE_EXCEEDED, "The maximum post data size was exceeded."},
-	{SIM900_ERROR_READ_LIMIT_EXCEEDED, "The read limit was exceeded."},
-	{SIM900_ERROR_INVALID_CID_VALUE, "Invalid Bearer profile Identifier"},
-	{SIM900_ERROR_CHARACTER_LIMIT_EXCEEDED, "The Maximum character limit was exceeded"},
-	{SIM900_ERROR_INVALID_CONNECTION_TYPE, "The specified connection type is not valid."},
-	{SIM900_ERROR_INVALID_CONNECTION_RATE, "The specified connection rate is not valid."},
-	{SIM900_ERROR_INVALID_HTTP_TIMEOUT, "The HTTP Timeout value must be between 30 and 1000 seconds."},
+bool is_valid_connection_type(char* to_check);
+bool is_valid_connection_rate(char* to_check);
+void set_sim900_debug_mode(bool mode);
+void set_sim900_debug_stream(Stream* stream);
+void set_sim900_input_timeout(unsigned long timeout);
+//The message is in flash, it can be passed straight to print().
+const __FlashStringHelper* get_error_message(int error_code);
 
+//Called from poll() with the complete line (without the line ending).
+//Handlers must not start modem commands themselves.
+typedef void (*URC_HANDLER)(const char* line);
 
-	//This needs to be the last element or things will go badly wrong.
-	{SIM900_ERROR_LIST_TERMINATOR, NULL} 
+//Called by the signal monitor when the good window opens or closes.
+typedef void (*SIGNAL_HANDLER)(bool good);
+
+//A received SMS, see Sim900::readSMS(). The parts of a concatenated
+//message are passed on one at a time with the same reference, part
+//counts from 1 and parts is 1 for a message that was not split.
+struct SIM900_SMS
+{
+	char sender[SIM900_SMS_NUMBER_LENGTH];
+	uint8_t data[SIM900_SMS_TEXT_LENGTH];
+	uint8_t length;
+	bool text;	//7 bit text unpacked to a character per byte, else 8 bit data.
+	uint16_t reference;
+	uint8_t part;
+	uint8_t parts;
 };
 
-static const char *VALID_CONNECTION_TYPES[] = {
-	"GPRS",
-	"CSD",
-	NULL
+typedef void (*SMS_HANDLER)(const SIM900_SMS* sms);
+
+//Called for each delivery report with the reference +CMGS gave the
+//message and its TP-Status: below 0x20 delivered, below 0x40 still being
+//tried, anything higher failed.
+typedef void (*SMS_REPORT_HANDLER)(uint8_t reference, uint8_t status);
+
+struct urc_entry
+{
+	const char* prefix;
+	URC_HANDLER handler;
 };
 
-static const int VALID_CONNECTION_SPEEDS[] =
+//Receives the response body window by window, see GPRSHTTP::streamBody.
+typedef void (*HTTP_SINK)(const uint8_t* data, uint32_t length);
+
+//The groups of AT commands that latencies are recorded for.
+enum SIM900_COMMAND_CLASS
 {
-	2400,
-	4800,
-	9600,
-	14400,
-	NULL
+	SIM900_COMMAND_GENERAL,
+	SIM900_COMMAND_BEARER,	//CGATT, SAPBR
+	SIM900_COMMAND_HTTP,	//HTTPINIT, HTTPPARA, HTTPTERM
+	SIM900_COMMAND_UPLOAD,	//HTTPDATA and the data itself
+	SIM900_COMMAND_ACTION,	//HTTPACTION
+	SIM900_COMMAND_READ,	//HTTPREAD
+	SIM900_COMMAND_CLASSES
 };
 
-bool is_valid_connection_type(char* to_check);
-bool is_valid_connection_rate(char* to_check);
-void set_sim900_debug_mode(bool mode);
-void set_sim900_debug_stream(Stream* stream);
-void set_sim900_input_timeout(unsigned long timeout);
-char* get_error_message(int error_code);
+//Counters kept by Sim900, see Sim900::getMetrics(). The 16 bit counters stop
+//at their maximum instead of wrapping.
+typedef struct sim900_metrics
+{
+	uint32_t bytes_sent;
+	uint32_t bytes_received;
+	uint16_t commands;
+	uint16_t retries;
+	uint16_t timeouts;
+	uint16_t modem_errors;
+	uint16_t rx_overruns;	//times the SoftwareSerial buffer overflowed
+	uint16_t rx_peak;	//most bytes held in the SIM900_RX_BUFFER ring
+	uint16_t latency[SIM900_COMMAND_CLASSES][SIM900_LATENCY_BUCKETS];
+} SIM900_METRICS;
+
+//A command recorded in the trace. Counts stop at their maximum instead of
+//wrapping, command is not terminated when it fills the array.
+typedef struct sim900_trace_event
+{
+	uint32_t time;		//millis() when the wait for the response began
+	uint16_t duration;	//milliseconds until the command completed
+	uint16_t sent;		//bytes written since the previous command completed
+	uint16_t received;	//bytes read while waiting for the response
+	int8_t result;		//SIM900_ERROR_* code
+	char command[SIM900_TRACE_NAME_LENGTH];
+} SIM900_TRACE_EVENT;
+
+//Passes everything through to the modem's stream, counting the bytes that
+//go each way. It also holds the receive ring buffer and works the flow
+//control lines.
+class MeteredStream : public Stream
+{
+	private:
+		Stream* _stream;
+		SoftwareSerial* _soft;
+		SIM900_METRICS* _metrics;
+#if SIM900_RX_BUFFER > 0
+		uint8_t _rx[SIM900_RX_BUFFER];
+		uint16_t _rx_head;
+		uint16_t _rx_count;
+#endif
+		//RTS and CTS pins, -1 while flow control is off.
+		int _rts_pin;
+		int _cts_pin;
+		bool _paused;
+		//Slow clock sleep, see Sim900::sleep(). A wake character is only
+		//sent when _command_start says the next byte begins a command.
+		enum SIM900_SLEEP_MODE _sleep_mode;
+		int _dtr_pin;
+		bool _asleep;
+		bool _command_start;
+		unsigned long _last_write;
+
+		void pump();
+		bool clearToSend();
+		void wake();
+#if SIM900_TRACE_LENGTH > 0
+		//The name of the last command written, _name_state tracks where in
+		//a line the next byte falls.
+		char _command[SIM900_TRACE_NAME_LENGTH];
+		uint8_t _name_state;
+		uint8_t _name_length;
+
+		void noteByte(uint8_t byte);
+#endif
+	public:
+		void attach(Stream* stream, SIM900_METRICS* metrics, SoftwareSerial* soft = NULL);
+		void setFlowControl(int rts_pin, int cts_pin);
+		//Raises DTR for SIM900_SLEEP_DTR, the next write wakes the modem.
+		void setSleep(enum SIM900_SLEEP_MODE mode, int dtr_pin);
+		bool isAsleep();
+		virtual int available();
+		virtual int read();
+		virtual int peek();
+		virtual size_t write(uint8_t byte);
+		virtual size_t write(const uint8_t* buffer, size_t size);
+		virtual void flush();
+		using Print::write;
+
+	friend class Sim900;
+};
 
 class GPRSHTTP;
+class GPRSSocket;
+class Sim900;
+
+//The validators of the last 200 response from a URL, empty strings when
+//the server did not send one.
+struct validator_entry
+{
+	uint16_t url;	//Hash of the URL, 0 for an unused entry.
+	char etag[SIM900_VALIDATOR_LENGTH];
+	char modified[SIM900_VALIDATOR_LENGTH];
+};
+
+//Remembers the ETag and Last-Modified headers of GET responses so that the
+//next GET of the same URL can be made conditional (If-None-Match and
+//If-Modified-Since). A 304 answer then means the body read last time is
+//still current and no AT+HTTPREAD is needed. URLs are told apart by a 16
+//bit hash, the oldest entry is replaced once the cache is full.
+class ValidatorCache
+{
+	private:
+		validator_entry _entries[SIM900_VALIDATOR_CACHE_SIZE];
+		uint8_t _next;
+	public:
+		ValidatorCache();
+
+		validator_entry* find(const char* url);
+		//Returns the entry for url, emptied, taking over the oldest entry
+		//if url has none.
+		validator_entry* add(const char* url);
+		void forget(const char* url);
+		void clear();
+};
+
+//The Stream handed out for a transparent mode session. It passes data
+//straight to the modem, resuming the session with ATO first if a command
+//has escaped from it in the meantime.
+class TransparentStream : public Stream
+{
+	private:
+		Sim900* _sim;
+	public:
+		void attach(Sim900* sim);
+		virtual int available();
+		virtual int read();
+		virtual int peek();
+		virtual size_t write(uint8_t byte);
+		virtual size_t write(const uint8_t* buffer, size_t size);
+		virtual void flush();
+		using Print::write;
+};
+
+//Watches the modem output for a set of tokens at once. Each token keeps the
+//length of the prefix matched so far, so every received byte is examined
+//exactly once and no copy of the input is kept. Tokens are not copied either,
+//they must outlive the matcher or the next clear().
+class ResponseMatcher
+{
+	private:
+		const char* _tokens[SIM900_MAX_MATCH_TOKENS];
+		uint8_t _state[SIM900_MAX_MATCH_TOKENS];
+		uint8_t _lengths[SIM900_MAX_MATCH_TOKENS];
+		//The KMP failure table of each token, worked out by add(). Entry i
+		//is the length of the longest proper prefix of the first i + 1
+		//characters that also ends them.
+		uint8_t _fail[SIM900_MAX_MATCH_TOKENS][SIM900_MAX_TARGET_LENGTH];
+		uint16_t _coded;
+		//Tokens whose text is in flash.
+		uint16_t _flash;
+		uint8_t _count;
+		int8_t _in_code;
+		long _code;
+
+		int insert(const char* token, bool coded, bool flash);
+		char tokenChar(uint8_t token, uint8_t index);
+		uint8_t advance(uint8_t token, char c);
+		int feedCode(char c);
+		void restart();
+	public:
+		ResponseMatcher();
+
+		//Removes every token.
+		void clear();
+		//Forgets any partial matches, the tokens are kept.
+		void reset();
+		//Returns the id of the new token or SIM900_TOKEN_NONE if the matcher
+		//is full. A coded token (e.g. "+CME ERROR:") only matches once the
+		//number following it has been read, see code().
+		int add(const char* token, bool coded = false);
+		int add(const __FlashStringHelper* token, bool coded = false);
+		//Returns the id of the token completed by c, or SIM900_TOKEN_NONE.
+		int feed(char c);
+		//The number read after the last coded token, -1 if there was none.
+		long code();
+};
 
 class Sim900
 {
 	private:
 		Stream* _serial;
 		SoftwareSerial* _ser;
+		HardwareSerial* _hw;
+		//The rate the port is open at, 0 if it is not known.
+		unsigned long _baud_rate;
+		MeteredStream _link;
+		SIM900_METRICS _metrics;
 		int _error_condition;
 		int _powerPin;
 		int _statusPin;
+		int _dtrPin;
 		int _lock;
 		enum MODEM_VARIANT varient;
 		uint32_t max_http_post_size;
 
+		//Command engine state, advanced by poll().
+		enum SIM900_ENGINE_STATE _engine_state;
+		int _engine_result;
+		const char* _target;
+		bool _flash_targets;
+		ResponseMatcher _matcher;
+		uint8_t _targets;
+		int _matched;
+		long _modem_error_code;
+		bool _drop_eol;
+		//Where the response is captured, _capture_length excludes the NUL.
+		char* _capture;
+		uint16_t _capture_size;
+		uint16_t _capture_length;
+		unsigned long _engine_timeout;
+		unsigned long _engine_time;
+		unsigned long _engine_start;
+		char _response[SIM900_RESPONSE_LENGTH];
+		GPRSHTTP* _active;
+		//Set while the stream carries HTTP data instead of modem responses.
+		bool _data_mode;
+
+		//Unsolicited result code handling, see collectLine().
+		char _line[SIM900_URC_LINE_LENGTH];
+		uint8_t _line_len;
+		bool _line_matched;
+		uint16_t _line_start;
+		char _command_name[SIM900_MAX_COMMAND_NAME + 1];
+		urc_entry _urc_handlers[SIM900_MAX_URC_HANDLERS];
+		char _urc_queue[SIM900_URC_QUEUE_LENGTH][SIM900_URC_LINE_LENGTH];
+		uint8_t _urc_head;
+		uint8_t _urc_count;
+
+		//Session mode, the bearer and HTTP service stay up between
+		//connections until the session has been idle for _session_timeout.
+		bool _session_mode;
+		enum SIM900_SESSION_STATE _session_state;
+		unsigned long _session_timeout;
+		unsigned long _session_time;
+		int _session_cid;
+		int _session_http_timeout;
+		bool _session_userdata;
+
+		//Hashes of the bearer profile values last applied to or read from
+		//each CID, a field is only known if its bit is set in _profile_fields.
+		uint16_t _profile_hash[SIM900_BEARER_PROFILES][SIM900_BEARER_FIELDS];
+		uint8_t _profile_fields[SIM900_BEARER_PROFILES];
+
+		//The TCP/IP stack used by GPRSSocket, brought up on first use.
+		bool _ip_up;
+		GPRSSocket* _sockets[SIM900_MAX_SOCKETS];
+		enum SIM900_TRANSPARENT_STATE _transparent;
+		enum SIM900_ESCAPE_STEP _escape_step;
+		TransparentStream _transparent_link;
+		ValidatorCache* _validators;
+
+		//Signal monitor, sampled from poll(). The smoothed values are kept
+		//in 16ths, -1 until there has been a usable sample.
+		enum SIM900_MONITOR_STATE _monitor_state;
+		unsigned long _monitor_interval;
+		unsigned long _monitor_time;
+		int _monitor_error;
+		char _monitor_response[32];
+		int16_t _rssi_average;
+		int16_t _ber_average;
+		uint8_t _signal_good;
+		uint8_t _signal_bad;
+		uint8_t _signal_max_ber;
+		bool _network_registered;
+		bool _gprs_registered;
+		bool _good_window;
+		SIGNAL_HANDLER _signal_handler;
+
+		//SMS. The delivery report following a +CDS line is decoded as it
+		//arrives, _report_at is the index of the next octet wanted from it.
+		bool _sms_setup;
+		uint8_t _sms_reference;
+		uint8_t _sms_waiting;
+		SMS_REPORT_HANDLER _report_handler;
+		bool _report_line;
+		bool _report_nibble;
+		uint8_t _report_octet;
+		uint8_t _report_index;
+		uint8_t _report_at;
+		uint8_t _report_field;
+		uint8_t _report_reference;
+#if SIM900_TRACE_LENGTH > 0
+		//The last SIM900_TRACE_LENGTH commands, oldest at _trace_head.
+		SIM900_TRACE_EVENT _trace[SIM900_TRACE_LENGTH];
+		uint8_t _trace_head;
+		uint8_t _trace_count;
+		//bytes_sent when the last command completed and bytes_received
+		//when the current one began waiting.
+		uint32_t _trace_sent;
+		uint32_t _trace_received;
+
+		void recordTrace(int result, unsigned long elapsed);
+#endif
+
+		void init(int powerPin, int statusPin, enum MODEM_VARIANT varient);
 		bool lock();
 		bool unlock();
 		bool dropEOL();
-		int waitFor(char target[], bool dropLastEOL, String* data);
-		int waitFor(char target[], bool dropLastEOL, String* data, unsigned long timeout);
-		bool compare(char to_test[], char target[], int pos, int length, int test_len);
-		void powerToggle();
-		bool issueCommand(char command[], char ok[], bool dropLastEOL);
+		//Targets and commands used by the library itself are kept in flash,
+		//flash says whether the target strings are.
+		//data is appended to, size is its capacity including the NUL.
+		bool beginWait(const __FlashStringHelper* target, bool dropLastEOL, char* data, uint16_t size, unsigned long timeout = SIM900_INPUT_TIMEOUT);
+		bool beginWait(const char* const targets[], uint8_t count, bool dropLastEOL, char* data, uint16_t size, unsigned long timeout, bool flash = false);
+		bool startCommand(const char* command, bool flash, const char* const targets[], uint8_t count, char* data, uint16_t size);
+		bool beginDelay(unsigned long duration);
+		void pollWait();
+		void pollIdle();
+		void collectLine(char c);
+		bool isURC(const char* line);
+		bool socketURC(const char* line);
+		bool startIP(CONN &settings, bool transparent);
+		bool suspendTransparent();
+		bool beginEscape();
+		void stepEscape();
+		void dropSockets();
+		void dispatchURC();
+		void stepSession();
+		void stepMonitor(bool next);
+		bool beginSample(enum SIM900_MONITOR_STATE state, const __FlashStringHelper* command);
+		void sampleSignal(int rssi, int ber);
+		void updateGoodWindow();
+		bool releaseMonitor();
+		void yieldMonitor();
+		bool setupSMS();
+		bool sendPDU(const char* number, const uint8_t* data, uint8_t length, uint8_t part, uint8_t parts, uint8_t* reference);
+		bool readOctet(uint8_t &octet);
+		bool readDeliver(SIM900_SMS* sms, uint16_t octets);
+		void reportChar(char c);
+		bool beginSessionClose();
+		void finish(int result);
+		void recordCommand(int result);
+		bool complete();
+		int waitFor(const __FlashStringHelper* target, bool dropLastEOL, char* data, uint16_t size, unsigned long timeout = SIM900_INPUT_TIMEOUT);
+		bool powerToggle();
+		bool queryRegistration(const __FlashStringHelper* command, const char* prefix);
+		bool issueCommand(const __FlashStringHelper* command, const __FlashStringHelper* ok, bool dropLastEOL);
 		void dumpStream();
 		void set_error_condition(int error_value);
 		bool is_valid_connection_settings(CONN settings);
+		bool readBearerProfile(int cid);
+		void parseBearerProfile(int cid);
+		bool setPortBaudRate(unsigned long rate);
+		bool probe();
+		bool switchBaudRate(unsigned long rate);
 		void handle_varient(MODEM_VARIANT varient);
 	public:
-		Sim900(SoftwareSerial* serial, int baud_rate, int powerPin, int statusPin,  enum MODEM_VARIANT varient);
-		Sim900(HardwareSerial* serial, int baud_rate, int powerPin, int statusPin,  enum MODEM_VARIANT varient);
+		Sim900(SoftwareSerial* serial, long baud_rate, int powerPin, int statusPin,  enum MODEM_VARIANT varient);
+		Sim900(HardwareSerial* serial, long baud_rate, int powerPin, int statusPin,  enum MODEM_VARIANT varient);
+		//The stream must already be opened at the modem's baud rate.
+		Sim900(Stream* serial, int powerPin, int statusPin,  enum MODEM_VARIANT varient);
 
 		MODEM_VARIANT get_varient();
 		uint32_t get_max_http_post_size();
 
+		//Non-blocking command engine. Only one command can be in progress at
+		//a time, poll() must be called regularly (e.g. from loop()) until
+		//isDone() returns true, result() then holds the error code of the
+		//command (SIM900_ERROR_NO_ERROR on success). The response is
+		//appended to data, a NUL terminated buffer of size bytes, and
+		//whatever does not fit is dropped.
+		bool beginCommand(const char command[], const char target[], char* data = NULL, uint16_t size = 0);
+		//Completes on whichever of the targets arrives first, matched()
+		//then returns its index.
+		bool beginCommand(const char command[], const char* const targets[], uint8_t count, char* data = NULL, uint16_t size = 0);
+		//The same with the command and target in flash, e.g. F("AT+CSQ\r\n").
+		bool beginCommand(const __FlashStringHelper* command, const __FlashStringHelper* target, char* data = NULL, uint16_t size = 0);
+		void poll();
+		bool isDone();
+		int result();
+		int matched();
+		//The number reported with the last +CME ERROR or +CMS ERROR, -1 if
+		//the last command did not fail with one.
+		long modemErrorCode();
+
+		//Unsolicited result codes (RING, +CMTI, +CGREG, +SAPBR 1: DEACT, ...)
+		//are picked out of the modem output by poll() and passed to the
+		//handler registered for their prefix, or queued for readURC() if
+		//there is none. Passing a NULL handler removes the registration.
+		bool setURCHandler(const char* prefix, URC_HANDLER handler);
+		int availableURC();
+		bool readURC(char* buffer, int length);
+
+		bool beginSignalQuality();
+		bool getSignalQualityResult(int &strength, int &error_rate);
 		bool getSignalQuality(int &strength, int &error_rate);
 		bool waitForSignal(int iterations, int wait_time);
+		//Samples AT+CSQ, AT+CREG? and AT+CGREG? from poll() every interval
+		//milliseconds while nothing else is using the modem, and keeps a
+		//smoothed signal level and error rate. A sample in progress is cut
+		//short by the next command, though a beginCommand() is refused as
+		//busy while one of its commands is still waiting for an answer.
+		//As poll() may start a sample, read the result of a beginCommand()
+		//before calling it again.
+		void startSignalMonitor(unsigned long interval = SIM900_SIGNAL_INTERVAL);
+		void stopSignalMonitor();
+		//The good window opens once the smoothed level reaches good and
+		//closes again when it drops below bad, when the smoothed error rate
+		//goes above max_ber or when the modem is not registered for GPRS.
+		void setSignalThresholds(uint8_t good, uint8_t bad, uint8_t max_ber = SIM900_SIGNAL_MAX_BER);
+		void setSignalHandler(SIGNAL_HANDLER handler);
+		bool isSignalGood();
+		//The smoothed level and error rate, -1 before the first sample that
+		//reported them.
+		int getSmoothedSignal();
+		int getSmoothedErrorRate();
+		bool isRegistered(bool gprs = true);
+		//Whether a transmission should go ahead now. Urgent ones always do,
+		//the rest wait for the good window while the monitor is running.
+		bool canTransmit(bool urgent = false);
+		//Sends data to number as 8 bit SMS in PDU mode (AT+CMGS), split into
+		//a concatenated message if it does not fit in one. The reference
+		//the modem gives each part is stored in references, up to count of
+		//them, to match the delivery reports against.
+		bool sendSMS(const char* number, const uint8_t* data, uint16_t length, uint8_t* references = NULL, uint8_t count = 0);
+		//Lists the received messages with AT+CMGL, passes each one to
+		//handler and then deletes them all. Returns how many there were,
+		//-1 on failure.
+		int readSMS(SMS_HANDLER handler);
+		//The +CMTI notifications since the last readSMS() that succeeded.
+		uint8_t smsWaiting();
+		//Asks for a delivery report for each message sent from now on,
+		//NULL stops asking.
+		void setSMSReportHandler(SMS_REPORT_HANDLER handler);
+		//Finds the rate the modem is talking at by probing with AT, starting
+		//with the current rate.
+		bool detectBaudRate();
+		//Detects the modem's rate, then moves both ends to the fastest rate
+		//up to max_rate that passes a round trip check. The rate is stored
+		//in the modem with AT&W, so after a power cycle it answers at the
+		//rate the port was left at. Falls back to the previous rate if no
+		//faster one works.
+		bool negotiateBaudRate(unsigned long max_rate = SIM900_MAX_BAUD_RATE);
+		//Turns on RTS/CTS flow control with AT+IFC=2,2, rtsPin goes to the
+		//modem's RTS input and ctsPin comes from its CTS output. The modem
+		//is paused while the library has SIM900_FLOW_STOP bytes waiting, so
+		//poll() has to be called before that many arrive. -1 for both
+		//turns it off again.
+		bool setFlowControl(int rtsPin, int ctsPin);
+		//The pin wired to the modem's DTR input, needed by SIM900_SLEEP_DTR.
+		void setDTRPin(int dtrPin);
+		//Puts the modem into slow clock sleep with AT+CSCLK, it stays
+		//registered and attached so nothing has to be set up again when
+		//it wakes. With SIM900_SLEEP_DTR it sleeps from now until the next
+		//command, with SIM900_SLEEP_AUTO whenever the port has been quiet
+		//for a few seconds. Either way the next command wakes it first,
+		//within SIM900_WAKE_TIME. Call again to go back to sleep, or
+		//with SIM900_SLEEP_OFF to stay awake.
+		bool sleep(enum SIM900_SLEEP_MODE mode = SIM900_SLEEP_DTR);
+		bool wake();
+		//Off, awake or (as far as can be told without asking it) asleep.
+		enum SIM900_POWER_STATE getPowerState();
+		unsigned long getBaudRate();
 		bool isPoweredUp();
-		bool powerUp();
+		//Switches the modem on and waits until it reaches level. Talking to
+		//the modem is possible from SIM900_READY_AT, a few seconds before
+		//the old "Call Ready" banner. Returns true straight away if the
+		//modem is already on and at level.
+		bool powerUp(enum SIM900_READINESS level = SIM900_READY_SIM);
 		bool powerDown();
+		//Checks each readiness level in turn and returns the highest one the
+		//modem has reached.
+		enum SIM900_READINESS getReadiness();
+		bool waitForReadiness(enum SIM900_READINESS level, unsigned long timeout = SIM900_POWERUP_TIMEOUT);
+		//Takes the modem and a connection from the pool without waiting.
+		//Fails with SIM900_ERROR_BUSY while a command is under way, call
+		//poll() and try again. The bearer settings are applied by the
+		//connection's first beginInit().
+		GPRSHTTP* beginHTTPConnection(CONN settings, char URL[]);
+		//The blocking form, waits for the modem and applies the bearer
+		//settings before returning.
 		GPRSHTTP* createHTTPConnection(CONN settings, char URL[]);
+		//Opens a TCP or UDP connection with AT+CIPSTART, bringing up the
+		//TCP/IP stack with the APN, user and password from settings if it
+		//is not running yet. Up to SIM900_MAX_SOCKETS can be open at once,
+		//they are closed when deleted.
+		GPRSSocket* createSocket(CONN settings, enum SIM900_SOCKET_TYPE type, const char* host, uint16_t port);
+		//Closes every socket and shuts the TCP/IP stack down.
+		bool shutdownIP();
+		//Opens a TCP connection in transparent mode (AT+CIPMODE=1), the
+		//returned Stream then carries data straight to and from the remote
+		//end with no AT framing. Any Sim900 command issued during the
+		//session escapes to command mode with +++ first, the Stream goes
+		//back to data mode with ATO the next time it is used. It cannot be
+		//used while sockets are open.
+		Stream* beginTransparent(CONN settings, const char* host, uint16_t port);
+		//Blocks for the two guard times around +++. A beginCommand() during
+		//the session starts the escape instead and is refused as busy until
+		//poll() has finished it.
+		bool escapeTransparent();
+		bool resumeTransparent();
+		bool endTransparent();
+		enum SIM900_TRANSPARENT_STATE getTransparentState();
+		//In session mode terminate() leaves the bearer and the HTTP service
+		//running so that the next connection on the same CID only has to
+		//set its URL. They are shut down once no connection has used them
+		//for idle_timeout milliseconds, after an error, or by endSession().
+		void setSessionMode(bool enabled, unsigned long idle_timeout = SIM900_SESSION_IDLE_TIMEOUT);
+		bool endSession();
+		//Makes every GET conditional on the validators cache holds for its
+		//URL and stores the validators of each 200 response in it, NULL
+		//turns this off.
+		void setValidatorCache(ValidatorCache* cache);
+		//Byte, command, retry, timeout and modem error counts, and a latency
+		//histogram for each SIM900_COMMAND_CLASS, since the last reset.
+		const SIM900_METRICS* getMetrics();
+		void resetMetrics();
+		//The trace of the last SIM900_TRACE_LENGTH commands, recorded
+		//without printing anything so that it does not change the timing
+		//being looked at. index 0 is the oldest, NULL past the end.
+		uint8_t getTraceCount();
+		const SIM900_TRACE_EVENT* getTraceEvent(uint8_t index);
+		void clearTrace();
+		//Prints the trace one command per line: start time, duration,
+		//command, bytes sent and received, and result.
+		void dumpTrace(Print* out);
 		/*bool startGPRS();
 		bool stopGPRS();*/
 		int get_error_condition();
 
 
 	friend class GPRSHTTP; 
+	friend class GPRSSocket;
+	friend class TransparentStream;
+};
+
+//Where an OutboundQueue keeps its records, e.g. EEPROM (see
+//Sim900EEPROM.h), a flash page or a file on a host build. Addresses run
+//from 0 to size() - 1.
+class QueueStorage
+{
+	public:
+		virtual uint8_t read(uint16_t address) = 0;
+		virtual void write(uint16_t address, uint8_t value) = 0;
+		virtual uint16_t size() = 0;
+		//Called after each push or pop, for storage that buffers writes.
+		virtual void commit() {}
+};
+
+//A bounded store-and-forward queue of records for a server. Records are
+//kept in the storage as a 2 byte big endian length followed by the data,
+//so they survive a reset. flush() sends as many of them as fit in one POST
+//body, in that same framing, and only removes them once the server answers
+//with a 2xx status.
+class OutboundQueue
+{
+	private:
+		QueueStorage* _storage;
+		uint16_t _capacity;
+		uint16_t _head;
+		uint16_t _used;
+		uint16_t _count;
+		int _error_condition;
+
+		uint8_t readData(uint16_t offset);
+		void writeData(uint16_t offset, uint8_t value);
+		uint16_t recordLength(uint16_t offset);
+		void saveHeader();
+		void drop(uint16_t records, uint16_t bytes);
+		bool postBatch(Sim900* sim, CONN &settings, char URL[]);
+		void set_error_condition(int error_value);
+	public:
+		OutboundQueue(QueueStorage* storage);
+
+		//Loads the queue from the storage, which is formatted as an empty
+		//queue if it does not hold a valid one.
+		bool begin();
+		bool push(const uint8_t* data, uint16_t length);
+		bool push(const char* text);
+		//Copies up to length bytes of the oldest record into buffer and
+		//returns the length of the record.
+		int32_t peek(uint8_t* buffer, uint16_t length);
+		bool pop();
+		void clear();
+		uint16_t count();
+		//The bytes in use, including the 2 byte length of each record.
+		uint16_t used();
+		//The longest record that push() still has room for.
+		uint16_t space();
+		//Posts the queued records to URL in batches of up to
+		//get_max_http_post_size() bytes until the queue is empty. Stops at
+		//the first batch that fails, which stays queued. Unless urgent, it
+		//fails with SIM900_ERROR_WEAK_SIGNAL while sim->canTransmit() says
+		//to wait.
+		bool flush(Sim900* sim, CONN settings, char URL[], bool urgent = false);
+		//Sends the queued records to number as SMS, as many as fit in each
+		//message in the same framing as flush(). Each batch is removed once
+		//the modem reports it sent (+CMGS). A record too long for one
+		//message stops it with SIM900_ERROR_CHARACTER_LIMIT_EXCEEDED.
+		bool flushSMS(Sim900* sim, const char* number);
+		int get_error_condition();
+};
+
+//A TCP or UDP connection created by Sim900::createSocket(). Received data is
+//fetched with AT+CIPRXGET when the modem reports that some has arrived.
+//Writes are buffered and sent with AT+CIPSEND by flush(), or once the buffer
+//fills. A bulk write() is sent straight away. Over UDP each send is one
+//datagram. Sockets do not hold the modem lock, but they cannot be used
+//while a GPRSHTTP connection exists. Final for the same reason as GPRSHTTP.
+class GPRSSocket final : public Stream
+{
+	private:
+		Sim900* _sim;
+		uint8_t _id;
+		bool _connected;
+		//Set by "+CIPRXGET: 1,<id>", the modem holds data for this socket.
+		bool _rx_pending;
+		uint8_t _rx[SIM900_SOCKET_BUFFER];
+		uint8_t _rx_head;
+		uint8_t _rx_count;
+		uint8_t _tx[SIM900_SOCKET_BUFFER];
+		uint8_t _tx_count;
+		int _error_condition;
+
+		bool fetch();
+		bool send(const uint8_t* data, size_t length);
+		void set_error_condition(int error_value);
+	public:
+		GPRSSocket(Sim900* sim, uint8_t id);
+		~GPRSSocket();
+		//Sockets come from a pool of SIM900_SOCKET_POOL, never the heap.
+		static void* operator new(size_t size) throw();
+		static void operator delete(void* socket);
+
+		//True while the connection is open or received data is left to read.
+		bool connected();
+		bool close();
+		int get_error_condition();
+
+		virtual int available();
+		virtual int read();
+		virtual int peek();
+		virtual size_t write(uint8_t byte);
+		virtual size_t write(const uint8_t* buffer, size_t size);
+		virtual void flush();
+		using Print::write;
+
+	friend class Sim900;
 };
 
-class GPRSHTTP : public Stream
+//Final, so deleting one (which is how a connection is given back) never
+//goes through the base class, whose destructor is not virtual.
+class GPRSHTTP final : public Stream
 {
 	private:
 
@@ -195,21 +1249,133 @@ class GPRSHTTP : public Stream
 		int _error_condition;
 		int _cid;
 		char* url;
-		String _data;
+		//The settings the connection was created with, for reset(). They
+		//are applied to the bearer profile by beginInit() while
+		//_profile_pending is set, _profile_field is the next one to check.
+		CONN _settings;
+		bool _profile_pending;
+		uint8_t _profile_field;
 		uint32_t write_limit, write_count;
 		uint32_t read_limit,  read_count;
 		bool initialized, _data_ready;
-		int isCGATT();
-		bool HTTPINIT(int retries, int _delay);
-		bool stopBearer(int retries, int _delay);
-		bool startBearer(int retries, int _delay);
+
+		enum GPRSHTTP_STEP _step;
+		int _result;
+		int _retries;
+		int _retry_delay;
+		uint32_t _content_length;
+		unsigned long _action_timeout;
+		unsigned long _chunk_time;
+
+		//Ranged reads, see beginReadRange().
+		uint8_t* _range_buffer;
+		uint32_t _range_offset;
+		uint32_t _range_length;
+		uint32_t _range_expected;
+		uint32_t _range_got;
+		unsigned long _range_time;
+		uint32_t _received;
+		HTTP_SINK _sink;
+		int _attached;
+		bool _reused;
+		bool _failed;
+		int _http_timeout;
+		int _action_cid, _http_code;
+		int32_t _response_length;
+
+		//GET and HEAD, see sendAction().
+		int _method;
+		const char* _headers;
+		bool _conditional;
+		validator_entry* _validator;
+		char _header_line[SIM900_VALIDATOR_LENGTH + 16];
+		uint8_t _header_length;
+		uint32_t _header_left;
+		unsigned long _header_time;
+
+		bool beginOperation();
+		bool beginProfile();
+		bool nextProfileField();
+		bool beginBearer();
+		void step();
+		void finish(int result);
+		bool retry(enum GPRSHTTP_STEP retry_step);
+		enum SIM900_COMMAND_CLASS commandClass();
+		bool complete();
+		bool isCGATT();
+		int parseCGATT();
+		bool bearerStatus();
+		int parseBearerStatus();
+		void nextParam();
+		bool beginAction(int method);
+		void sendAction(bool conditions_sent);
+		void parseHeaders();
+		void headerLine();
+		void readRangeWindow();
+		void copyRange();
+		bool HTTPINIT();
+		bool HTTPTERM();
+		void release();
+		bool holdsModem();
+		bool stopBearer();
+		bool startBearer();
+		//A parameter is sent as beginParam(), its value printed straight to
+		//the modem and endParam(), so that it never has to be assembled.
+		bool beginParam(const char* param, bool flash);
+		bool endParam();
+		bool sendParam(const __FlashStringHelper* param, const char* value);
+		bool sendParam(const __FlashStringHelper* param, uint32_t value);
+		bool sendParam(const char* param, bool flash, const char* value, bool value_flash);
+		bool setParam(const char* param, bool flash, const char* value, bool value_flash);
 		void set_error_condition(int error_value);
+		void clear();
 	public:
 		GPRSHTTP(Sim900* sim, int cid, char URL[]);
+		//Terminates the connection and gives the modem back if that has
+		//not been done yet.
+		~GPRSHTTP();
+		//Connections come from a pool of SIM900_HTTP_CONNECTIONS, never the
+		//heap. new GPRSHTTP(...) gives NULL once it is used up.
+		static void* operator new(size_t size) throw();
+		static void operator delete(void* connection);
+
+		//Readies the connection for another request, to URL if one is
+		//given, instead of deleting it and creating a new one. An open
+		//HTTP session is terminated first, a terminated connection takes
+		//the modem again and reapplies its bearer settings.
+		bool reset(char URL[] = NULL);
+
+		//Non-blocking versions of init, post_init, post, init_retrieve and
+		//terminate. Each one starts the operation and returns immediately,
+		//Sim900::poll() advances it until isDone() returns true.
+		bool beginInit(int timeout = 120);
+		bool beginPostInit(uint32_t content_length);
+		bool beginPost();
+		bool beginGet();
+		bool beginHead();
+		bool beginRetrieve();
+		bool beginTerminate();
+		//Gives up an upload started by beginPostInit() without posting it.
+		//Waits for the OK the modem sends once it has the whole body, or
+		//once its AT+HTTPDATA time runs out, so that the connection can be
+		//terminated. Until then AT+HTTPTERM would be taken as body bytes.
+		bool beginDiscard();
+		bool isDone();
+		int result();
+		//The result of the last post, get or head.
+		bool getPostResult(int &cid, int &HTTP_CODE, int32_t &length);
+
 		bool init(int timeout = 120);
-		bool setParam(char* param, String value);
+		bool setParam(char* param, const String& value);
 		bool setParam(char* param, char* value);
 		bool setParam(char* param, uint32_t value);
+		bool setParam(const __FlashStringHelper* param, const String& value);
+		bool setParam(const __FlashStringHelper* param, const __FlashStringHelper* value);
+		//Extra request headers, sent with AT+HTTPPARA="USERDATA". Separate
+		//several with "\\r\\n", the modem turns that into a line break.
+		//headers is not copied, it is sent again along with the conditional
+		//headers of a cached GET.
+		bool setHeaders(const char* headers);
 
 
 		bool post_init(uint32_t content_length);
@@ -217,19 +1383,133 @@ class GPRSHTTP : public Stream
 		//If the response from the server does not have a Content-Length header
 		//then length will always be zero.
 		bool post(int &cid, int &HTTP_CODE, int32_t &length);
+		//AT+HTTPACTION=0 and 2, reporting the same way as post(). With a
+		//ValidatorCache a GET of unchanged content reports HTTP_CODE 304 and
+		//there is nothing to read.
+		bool get(int &cid, int &HTTP_CODE, int32_t &length);
+		bool head(int &cid, int &HTTP_CODE, int32_t &length);
 		int init_retrieve();
+
+		//Reads up to length bytes of the response body starting at offset
+		//with AT+HTTPREAD=<offset>,<length>. The +HTTPREAD framing and the
+		//trailing OK are dealt with here and the body is copied straight into
+		//buffer, received() gives the number of bytes read.
+		bool beginReadRange(uint32_t offset, uint8_t* buffer, uint32_t length);
+		int32_t readRange(uint32_t offset, uint8_t* buffer, uint32_t length);
+		//Reads the whole response body in windows of up to window bytes
+		//through buffer and passes each one to sink, so bodies larger than
+		//the available RAM can be consumed.
+		bool beginStreamBody(HTTP_SINK sink, uint8_t* buffer, uint32_t window);
+		int32_t streamBody(HTTP_SINK sink, uint8_t* buffer, uint32_t window);
+		uint32_t received();
 		int get_error_condition();
 		bool terminate();
 
 		size_t read(char* buf, int length);
 		size_t read(byte* buf, int length);
 		virtual size_t write(uint8_t byte);
+		//Blocks between chunks for what is left of
+		//SIM900_WRITE_CHUNK_INTERVAL. Code driven from poll() writes no
+		//more than availableForWrite() at a time and never waits.
+		virtual size_t write(const uint8_t* buffer, size_t size);
+		int availableForWrite();
 		virtual int read();
 		virtual int available();
 		virtual void flush();
 		virtual int peek();
 		using Print::write;
 
+	friend class Sim900;
+	friend class ModemManager;
+
+};
+
+//Owns a connection from createHTTPConnection() for the life of a scope and
+//deletes it however the scope is left, which terminates it and gives the
+//modem back. Use it like the pointer it holds.
+class ScopedHTTPConnection
+{
+	private:
+		GPRSHTTP* _connection;
+		ScopedHTTPConnection(const ScopedHTTPConnection&);
+		ScopedHTTPConnection& operator=(const ScopedHTTPConnection&);
+	public:
+		ScopedHTTPConnection(GPRSHTTP* connection) : _connection(connection) {}
+		~ScopedHTTPConnection() { delete _connection; }
+		GPRSHTTP* operator->() { return _connection; }
+		GPRSHTTP* get() { return _connection; }
+		operator bool() { return _connection != NULL; }
+};
+
+//A POST for ModemManager::submit(). Neither it nor the data is copied, so
+//both have to stay put until the upload handler has been called with it.
+//result is SIM900_ERROR_NO_ERROR once the server answered with a 2xx
+//status, which is left in code, and modem the index of the modem that
+//sent it.
+struct SIM900_UPLOAD
+{
+	char* url;
+	const uint8_t* data;
+	uint32_t length;
+	//Urgent uploads do not wait for the signal, see Sim900::canTransmit().
+	bool urgent;
+	enum SIM900_UPLOAD_STATE state;
+	int8_t modem;
+	uint8_t attempts;
+	uint32_t sent;
+	int result;
+	int code;
+};
+
+typedef void (*UPLOAD_HANDLER)(SIM900_UPLOAD* upload);
+
+//Drives several modems, each on its own serial port and with its own
+//bearer settings, from one loop(). Queued uploads go to the idle modem
+//with the fewest failures in a row and then the best smoothed signal
+//(see Sim900::startSignalMonitor()), one upload per modem at a time. They
+//run on the non-blocking GPRSHTTP calls, so a modem waiting for a slow
+//answer does not hold the others up. An upload that fails is tried again,
+//on another modem if there is one, up to SIM900_UPLOAD_ATTEMPTS times.
+class ModemManager
+{
+	private:
+		Sim900* _modems[SIM900_MAX_MODEMS];
+		CONN _settings[SIM900_MAX_MODEMS];
+		GPRSHTTP* _connections[SIM900_MAX_MODEMS];
+		SIM900_UPLOAD* _running[SIM900_MAX_MODEMS];
+		uint8_t _failures[SIM900_MAX_MODEMS];
+		uint8_t _count;
+		SIM900_UPLOAD* _queue[SIM900_MAX_UPLOADS];
+		uint8_t _queued;
+		UPLOAD_HANDLER _handler;
+		int _error_condition;
+
+		int pickModem(bool urgent);
+		void dispatch();
+		bool start(SIM900_UPLOAD* upload, uint8_t index);
+		void step(uint8_t index);
+		void fail(uint8_t index, int result);
+		void terminate(uint8_t index);
+		void finishUpload(uint8_t index);
+		void set_error_condition(int error_value);
+	public:
+		ModemManager();
+
+		//Returns the modem's index, -1 once there are SIM900_MAX_MODEMS.
+		int addModem(Sim900* modem, CONN settings);
+		uint8_t count();
+		Sim900* getModem(uint8_t index);
+		void setUploadHandler(UPLOAD_HANDLER handler);
+		//Queues upload, fails with SIM900_ERROR_QUEUE_FULL while
+		//SIM900_MAX_UPLOADS are already waiting.
+		bool submit(SIM900_UPLOAD* upload);
+		//Polls every modem, moves each upload on a step and starts queued
+		//ones on the modems that are free. Call it from loop().
+		void poll();
+		//Uploads waiting for a modem, and uploads running.
+		uint8_t queued();
+		uint8_t inFlight();
+		int get_error_condition();
 };
 
 #endif
@@ -0,0 +1,53 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __SIM_900_EEPROM_H__
+#define __SIM_900_EEPROM_H__
+
+#include <EEPROM.h>
+#include "Sim900.h"
+
+//Keeps an OutboundQueue in length bytes of EEPROM starting at start. Only
+//bytes that change are written, to spare the EEPROM. This lives in its own
+//header so that sketches which do not queue do not pull in EEPROM.
+class EEPROMQueueStorage : public QueueStorage
+{
+	private:
+		uint16_t _start;
+		uint16_t _length;
+	public:
+		EEPROMQueueStorage(uint16_t start, uint16_t length) : _start(start), _length(length) {}
+
+		virtual uint8_t read(uint16_t address)
+		{
+			return EEPROM.read(_start + address);
+		}
+
+		virtual void write(uint16_t address, uint8_t value)
+		{
+			EEPROM.update(_start + address, value);
+		}
+
+		virtual uint16_t size()
+		{
+			return _length;
+		}
+};
+
+#endif
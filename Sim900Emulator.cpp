@@ -0,0 +1,861 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "Sim900Emulator.h"
+
+Sim900Emulator::Sim900Emulator()
+{
+	_out_head = 0;
+	_out_count = 0;
+	_line_len = 0;
+	_skip_lf = false;
+	_latency = 5;
+	_baud_rate = 0;
+	_ready_time = 0;
+	_released = 0;
+	_echo = false;
+	_bearer = false;
+	_http = false;
+	_attached = true;
+	_sim_ready = true;
+	_csclk = 0;
+	_sms_input = false;
+	_sms_chars = 0;
+	_sms_first = 0;
+	_sms_reference = 0;
+	_sms_reports = false;
+	_inbox_count = 0;
+	_last_input = 0;
+	_creg = 1;
+	_cgreg = 1;
+	_rssi = 17;
+	_ber = 0;
+	_fail_prefix = NULL;
+	_fail_count = 0;
+	_fail_code = -1;
+	_http_code = 200;
+	_body = NULL;
+	_body_length = 0;
+	_action_delay = 300;
+	_action_due = 0;
+	_action_method = 0;
+	_action_pending = false;
+	_download_left = 0;
+	_download_due = 0;
+	_refuse_after = 0;
+	_refuse_count = 0;
+	_uploaded = 0;
+	_body_pos = 0;
+	_body_left = 0;
+	_body_at = 0;
+	_read_source = NULL;
+	_etag = NULL;
+	_not_modified = false;
+	_ip = false;
+	_connected = 0;
+	_send_socket = -1;
+	_loop_socket = -1;
+	_loop_start = 0;
+	_loop_len = 0;
+	_cipmode = false;
+	_single = false;
+	_passthrough = false;
+	_plus_count = 0;
+	_last_write = 0;
+}
+
+void Sim900Emulator::setLatency(unsigned long latency)
+{
+	_latency = latency;
+}
+
+void Sim900Emulator::setBaudRate(unsigned long baud_rate)
+{
+	_baud_rate = baud_rate;
+}
+
+void Sim900Emulator::setActionDelay(unsigned long action_delay)
+{
+	_action_delay = action_delay;
+}
+
+void Sim900Emulator::setEcho(bool echo)
+{
+	_echo = echo;
+}
+
+void Sim900Emulator::setSignal(int rssi, int ber)
+{
+	_rssi = rssi;
+	_ber = ber;
+}
+
+void Sim900Emulator::setAttached(bool attached)
+{
+	_attached = attached;
+}
+
+void Sim900Emulator::setSimReady(bool ready)
+{
+	_sim_ready = ready;
+}
+
+void Sim900Emulator::setRegistration(int creg, int cgreg)
+{
+	_creg = creg;
+	_cgreg = cgreg;
+}
+
+void Sim900Emulator::setResponse(int http_code, const char* body, uint32_t length)
+{
+	_http_code = http_code;
+	_body = body;
+	_body_length = length;
+}
+
+void Sim900Emulator::setETag(const char* etag)
+{
+	_etag = etag;
+}
+
+void Sim900Emulator::failCommand(const char* prefix, uint8_t times, int cme_error)
+{
+	_fail_prefix = prefix;
+	_fail_count = times;
+	_fail_code = cme_error;
+}
+
+void Sim900Emulator::powerUp()
+{
+	_bearer = false;
+	_http = false;
+	beginResponse();
+	queue("RDY\r\n\r\n+CFUN: 1\r\n\r\n+CPIN: READY\r\n\r\nCall Ready\r\n");
+}
+
+void Sim900Emulator::unsolicited(const char* line)
+{
+	beginResponse();
+	queue("\r\n");
+	queue(line);
+	queue("\r\n");
+}
+
+void Sim900Emulator::receiveSMS(const char* pdu)
+{
+	if(_inbox_count < SIM900_EMULATOR_INBOX)
+	{
+		_inbox_stat[_inbox_count] = 0;
+		_inbox[_inbox_count++] = pdu;
+		beginResponse();
+		queue("\r\n+CMTI: \"SM\",");
+		queue((long)_inbox_count);
+		queue("\r\n");
+	}
+}
+
+void Sim900Emulator::storeSMS(const char* pdu, uint8_t stat)
+{
+	if(_inbox_count < SIM900_EMULATOR_INBOX)
+	{
+		_inbox_stat[_inbox_count] = stat;
+		_inbox[_inbox_count++] = pdu;
+	}
+}
+
+void Sim900Emulator::refuseUpload(uint32_t after, uint8_t times)
+{
+	_refuse_after = after;
+	_refuse_count = times;
+}
+
+uint8_t Sim900Emulator::smsSent()
+{
+	return _sms_reference;
+}
+
+void Sim900Emulator::closeSocket(uint8_t id)
+{
+	if(_connected & (1 << id))
+	{
+		_connected &= ~(1 << id);
+		beginResponse();
+		queue("\r\n");
+		queue((long)id);
+		queue(", CLOSED\r\n");
+	}
+}
+
+bool Sim900Emulator::bearerActive()
+{
+	return _bearer;
+}
+
+bool Sim900Emulator::httpActive()
+{
+	return _http;
+}
+
+uint32_t Sim900Emulator::uploaded()
+{
+	return _uploaded;
+}
+
+int Sim900Emulator::sleepMode()
+{
+	return _csclk;
+}
+
+bool Sim900Emulator::asleep()
+{
+	return _csclk == 2 && (millis() - _last_input) > SIM900_EMULATOR_SLEEP_TIME;
+}
+
+void Sim900Emulator::queue(const char* text)
+{
+	while(*text && _out_count < SIM900_EMULATOR_BUFFER)
+	{
+		_out[(_out_head + _out_count) % SIM900_EMULATOR_BUFFER] = *text++;
+		_out_count++;
+	}
+}
+
+void Sim900Emulator::queueByte(uint8_t byte)
+{
+	if(_out_count < SIM900_EMULATOR_BUFFER)
+	{
+		_out[(_out_head + _out_count) % SIM900_EMULATOR_BUFFER] = byte;
+		_out_count++;
+	}
+}
+
+static uint8_t hexValue(char c)
+{
+	if(c >= 'a')
+	{
+		return c - 'a' + 10;
+	}
+	return c >= 'A' ? c - 'A' + 10 : c - '0';
+}
+
+void Sim900Emulator::queueHex(uint8_t value)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	queueByte(digits[value >> 4]);
+	queueByte(digits[value & 0x0F]);
+}
+
+void Sim900Emulator::queue(long number)
+{
+	char digits[12];
+	ltoa(number, digits, 10);
+	queue(digits);
+}
+
+//Starts the latency clock for a response, unless an earlier one is still
+//being read, in which case the new output simply follows it.
+void Sim900Emulator::beginResponse()
+{
+	if(pending() == 0)
+	{
+		_ready_time = millis() + _latency;
+		_released = 0;
+	}
+}
+
+void Sim900Emulator::respond(const char* text)
+{
+	beginResponse();
+	queue("\r\n");
+	queue(text);
+	queue("\r\n");
+}
+
+bool Sim900Emulator::starts(const char* prefix)
+{
+	return strncmp(_line, prefix, strlen(prefix)) == 0;
+}
+
+void Sim900Emulator::handle()
+{
+	_line[_line_len] = '\0';
+	_line_len = 0;
+	if(_echo)
+	{
+		beginResponse();
+		queue(_line);
+		queue("\r");
+	}
+	if(_line[0] == '\0')
+	{
+		return;
+	}
+	if(_fail_count > 0 && starts(_fail_prefix))
+	{
+		_fail_count--;
+		beginResponse();
+		if(_fail_code < 0)
+		{
+			respond("ERROR");
+		}else{
+			queue("\r\n+CME ERROR: ");
+			queue((long)_fail_code);
+			queue("\r\n");
+		}
+		return;
+	}
+	if(starts("ATE"))
+	{
+		_echo = _line[3] == '1';
+		respond("OK");
+	}else if(starts("AT+CSQ"))
+	{
+		beginResponse();
+		queue("\r\n+CSQ: ");
+		queue((long)_rssi);
+		queue(",");
+		queue((long)_ber);
+		queue("\r\n\r\nOK\r\n");
+	}else if(starts("AT+CSCLK="))
+	{
+		_csclk = atoi(_line + 9);
+		respond("OK");
+	}else if(starts("AT+CMGF=") || starts("AT+CMGD="))
+	{
+		if(starts("AT+CMGD=1,1"))
+		{
+			//Every read message, the stored ones stay.
+			uint8_t kept = 0;
+			for(uint8_t i = 0; i < _inbox_count; i++)
+			{
+				if(_inbox_stat[i] != 1)
+				{
+					_inbox_stat[kept] = _inbox_stat[i];
+					_inbox[kept++] = _inbox[i];
+				}
+			}
+			_inbox_count = kept;
+		}else if(starts("AT+CMGD="))
+		{
+			_inbox_count = 0;
+		}
+		respond("OK");
+	}else if(starts("AT+CNMI="))
+	{
+		//AT+CNMI=<mode>,<mt>,<bm>,<ds>,<bfr>
+		const char* ds = _line;
+		for(uint8_t i = 0; i < 3 && ds != NULL; i++)
+		{
+			ds = strchr(ds + 1, ',');
+		}
+		_sms_reports = ds != NULL && ds[1] == '1';
+		respond("OK");
+	}else if(starts("AT+CMGS="))
+	{
+		_sms_input = true;
+		_sms_chars = 0;
+		_sms_first = 0;
+		//The PDU follows on the same line, not after a line feed.
+		_skip_lf = false;
+		beginResponse();
+		queue("\r\n> ");
+	}else if(starts("AT+CMGL="))
+	{
+		beginResponse();
+		for(uint8_t i = 0; i < _inbox_count; i++)
+		{
+			queue("\r\n+CMGL: ");
+			queue((long)(i + 1));
+			queue(",");
+			queue((long)_inbox_stat[i]);
+			queue(",,");
+			//Listing marks a received message read.
+			if(_inbox_stat[i] == 0)
+			{
+				_inbox_stat[i] = 1;
+			}
+			//The length leaves out the SMSC address.
+			queue((long)(strlen(_inbox[i]) / 2 - 1 - (hexValue(_inbox[i][0]) << 4 | hexValue(_inbox[i][1]))));
+			queue("\r\n");
+			queue(_inbox[i]);
+		}
+		queue("\r\n\r\nOK\r\n");
+	}else if(starts("AT+IFC="))
+	{
+		respond("OK");
+	}else if(starts("AT+CPIN?"))
+	{
+		respond(_sim_ready ? "+CPIN: READY\r\n\r\nOK" : "+CPIN: SIM PIN\r\n\r\nOK");
+	}else if(starts("AT+CREG?") || starts("AT+CGREG?"))
+	{
+		bool gprs = _line[4] == 'G';
+		beginResponse();
+		queue(gprs ? "\r\n+CGREG: 0," : "\r\n+CREG: 0,");
+		queue((long)(gprs ? _cgreg : _creg));
+		queue("\r\n\r\nOK\r\n");
+	}else if(starts("AT+CGATT?"))
+	{
+		respond(_attached ? "+CGATT: 1\r\n\r\nOK" : "+CGATT: 0\r\n\r\nOK");
+	}else if(starts("AT+SAPBR=1,"))
+	{
+		//Opening the bearer fails if it is already open, as on the modem.
+		respond(_bearer ? "ERROR" : "OK");
+		_bearer = true;
+	}else if(starts("AT+SAPBR=0,"))
+	{
+		respond(_bearer ? "OK" : "ERROR");
+		_bearer = false;
+	}else if(starts("AT+SAPBR=2,"))
+	{
+		beginResponse();
+		queue("\r\n+SAPBR: ");
+		queue(atol(_line + 11));
+		queue(_bearer ? ",1,\"10.0.0.1\"" : ",3,\"0.0.0.0\"");
+		queue("\r\n\r\nOK\r\n");
+	}else if(starts("AT+SAPBR=4,"))
+	{
+		respond("+SAPBR:\r\nCONTYPE: GPRS\r\nAPN: \r\nPHONENUM: \r\nUSER: \r\nPWD: \r\nRATE: 2\r\n\r\nOK");
+	}else if(starts("AT+HTTPINIT"))
+	{
+		respond(_http ? "ERROR" : "OK");
+		_http = true;
+		_not_modified = false;
+	}else if(starts("AT+HTTPTERM"))
+	{
+		respond(_http ? "OK" : "ERROR");
+		_http = false;
+	}else if(starts("AT+HTTPPARA=\"USERDATA\""))
+	{
+		const char* match = strstr(_line, "If-None-Match: ");
+		_not_modified = _etag != NULL && match != NULL && strncmp(match + 15, _etag, strlen(_etag)) == 0;
+		respond("OK");
+	}else if(starts("AT+HTTPHEAD"))
+	{
+		char headers[SIM900_EMULATOR_LINE];
+		strcpy(headers, "HTTP/1.1 200 OK\r\n");
+		if(_etag != NULL)
+		{
+			strcat(headers, "ETag: ");
+			strcat(headers, _etag);
+			strcat(headers, "\r\n");
+		}
+		beginResponse();
+		queue("\r\n+HTTPHEAD: ");
+		queue((long)strlen(headers));
+		queue("\r\n");
+		queue(headers);
+		queue("\r\nOK\r\n");
+	}else if(starts("AT+HTTPDATA="))
+	{
+		_download_left = atol(_line + 12);
+		const char* time = strchr(_line, ',');
+		_download_due = millis() + (time != NULL ? atol(time + 1) : 0);
+		_uploaded = 0;
+		respond("DOWNLOAD");
+	}else if(starts("AT+HTTPACTION="))
+	{
+		respond(_http ? "OK" : "ERROR");
+		if(_http)
+		{
+			_action_method = atoi(_line + 14);
+			_action_due = millis() + _latency + _action_delay;
+			_action_pending = true;
+		}
+	}else if(starts("AT+HTTPREAD"))
+	{
+		uint32_t offset = 0;
+		uint32_t length = _body_length;
+		if(_line[11] == '=')
+		{
+			char* comma;
+			offset = strtoul(_line + 12, &comma, 10);
+			if(*comma == ',')
+			{
+				length = strtoul(comma + 1, NULL, 10);
+			}
+		}
+		if(offset > _body_length)
+		{
+			offset = _body_length;
+		}
+		if(length > _body_length - offset)
+		{
+			length = _body_length - offset;
+		}
+		beginResponse();
+		queue("\r\n+HTTPREAD: ");
+		queue((long)length);
+		queue("\r\n");
+		//The body is produced by next() once the header has been read.
+		_read_source = _body;
+		_body_pos = offset;
+		_body_left = length;
+		_body_at = _out_count;
+		queue("\r\nOK\r\n");
+	}else if(starts("ATO"))
+	{
+		respond(_single ? "CONNECT" : "NO CARRIER");
+		_passthrough = _single;
+		_last_write = millis();
+	}else if(starts("AT+CIPMODE="))
+	{
+		_cipmode = _line[11] == '1';
+		respond("OK");
+	}else if(starts("AT+CIPSTART=\""))
+	{
+		if(!_ip || _single)
+		{
+			respond(_ip ? "ALREADY CONNECT" : "ERROR");
+			return;
+		}
+		_single = true;
+		respond("OK");
+		queue(_cipmode ? "\r\nCONNECT\r\n" : "\r\nCONNECT OK\r\n");
+		_passthrough = _cipmode;
+		_last_write = millis();
+	}else if(starts("AT+CIPCLOSE") && _line[11] == '\0')
+	{
+		respond(_single ? "CLOSE OK" : "ERROR");
+		_single = false;
+	}else if(starts("AT+CIPSHUT"))
+	{
+		_ip = false;
+		_single = false;
+		_connected = 0;
+		_loop_start = _loop_len = 0;
+		respond("SHUT OK");
+	}else if(starts("AT+CIICR"))
+	{
+		_ip = _bearer || _attached;
+		respond(_ip ? "OK" : "ERROR");
+	}else if(starts("AT+CIFSR"))
+	{
+		respond(_ip ? "10.0.0.2" : "ERROR");
+	}else if(starts("AT+CIPSTART="))
+	{
+		uint8_t id = atoi(_line + 12);
+		if(!_ip || (_connected & (1 << id)))
+		{
+			respond(_ip ? "ALREADY CONNECT" : "ERROR");
+			return;
+		}
+		_connected |= 1 << id;
+		respond("OK");
+		queue("\r\n");
+		queue((long)id);
+		queue(", CONNECT OK\r\n");
+	}else if(starts("AT+CIPSEND="))
+	{
+		uint8_t id = atoi(_line + 11);
+		if(!(_connected & (1 << id)))
+		{
+			respond("ERROR");
+			return;
+		}
+		_download_left = atol(strchr(_line, ',') + 1);
+		//Only the last socket sent on has its echo kept.
+		if(id != _loop_socket || (_body_left == 0 && _loop_start == _loop_len))
+		{
+			_loop_start = _loop_len = 0;
+		}
+		_send_socket = id;
+		beginResponse();
+		queue("\r\n> ");
+	}else if(starts("AT+CIPRXGET=2,"))
+	{
+		uint8_t id = atoi(_line + 14);
+		uint32_t length = atol(strchr(_line + 14, ',') + 1);
+		uint8_t held = id == _loop_socket ? _loop_len - _loop_start : 0;
+		if(length > held)
+		{
+			length = held;
+		}
+		beginResponse();
+		queue("\r\n+CIPRXGET: 2,");
+		queue((long)id);
+		queue(",");
+		queue((long)length);
+		queue(",");
+		queue((long)(held - length));
+		queue("\r\n");
+		_read_source = _loop;
+		_body_pos = _loop_start;
+		_body_left = length;
+		_body_at = _out_count;
+		_loop_start += length;
+		queue("\r\nOK\r\n");
+	}else if(starts("AT+CIPCLOSE="))
+	{
+		uint8_t id = atoi(_line + 12);
+		if(!(_connected & (1 << id)))
+		{
+			respond("ERROR");
+			return;
+		}
+		_connected &= ~(1 << id);
+		beginResponse();
+		queue("\r\n");
+		queue((long)id);
+		queue(", CLOSE OK\r\n");
+	}else{
+		respond("OK");
+	}
+}
+
+//Echoes transparent mode data, holding back a +++ that follows a guard
+//time in case it turns out to be the escape.
+void Sim900Emulator::passthrough(uint8_t byte)
+{
+	unsigned long now = millis();
+	if(byte == '+' && _plus_count < 3 && (_plus_count > 0 || (now - _last_write) >= SIM900_EMULATOR_GUARD_TIME))
+	{
+		_plus_count++;
+	}else
+	{
+		beginResponse();
+		for(; _plus_count > 0; _plus_count--)
+		{
+			queueByte('+');
+		}
+		queueByte(byte);
+	}
+	_last_write = now;
+}
+
+//Raises the +HTTPACTION result once its delay has passed, and leaves
+//transparent mode once +++ has been followed by a guard time.
+void Sim900Emulator::update()
+{
+	if(_download_left > 0 && _send_socket < 0 && (long)(millis() - _download_due) >= 0)
+	{
+		//The upload ends with what has arrived so far.
+		_download_left = 0;
+		respond("OK");
+	}
+	if(_passthrough && _plus_count == 3 && (millis() - _last_write) >= SIM900_EMULATOR_GUARD_TIME)
+	{
+		_plus_count = 0;
+		_passthrough = false;
+		respond("OK");
+	}
+	if(_action_pending && (long)(millis() - _action_due) >= 0)
+	{
+		_action_pending = false;
+		beginResponse();
+		queue("\r\n+HTTPACTION: ");
+		queue((long)_action_method);
+		queue(",");
+		//Without a bearer the modem reports 601, network error. HEAD and
+		//a 304 have no body.
+		bool not_modified = _action_method == 0 && _not_modified;
+		queue(!_bearer ? 601L : not_modified ? 304L : (long)_http_code);
+		queue(",");
+		queue(_bearer && !not_modified && _action_method != 2 ? (long)_body_length : 0L);
+		queue("\r\n");
+	}
+}
+
+uint32_t Sim900Emulator::pending()
+{
+	return _out_count + _body_left;
+}
+
+char Sim900Emulator::next(bool consume)
+{
+	char c;
+	if(_body_left > 0 && _body_at == 0)
+	{
+		c = _read_source != NULL ? _read_source[_body_pos] : (char)('0' + _body_pos % 10);
+		if(consume)
+		{
+			_body_pos++;
+			_body_left--;
+		}
+	}else{
+		c = _out[_out_head];
+		if(consume)
+		{
+			_out_head = (_out_head + 1) % SIM900_EMULATOR_BUFFER;
+			_out_count--;
+			if(_body_left > 0)
+			{
+				_body_at--;
+			}
+		}
+	}
+	if(consume)
+	{
+		_released++;
+	}
+	return c;
+}
+
+int Sim900Emulator::available()
+{
+	update();
+	uint32_t count = pending();
+	unsigned long now = millis();
+	if(count == 0 || (long)(now - _ready_time) < 0)
+	{
+		return 0;
+	}
+	unsigned long elapsed = now - _ready_time;
+	//Ten bits a character on the wire.
+	if(_baud_rate > 0 && elapsed < 100000)
+	{
+		uint32_t allowed = elapsed * (_baud_rate / 10) / 1000 + 1;
+		if(allowed <= _released)
+		{
+			return 0;
+		}
+		if(count > allowed - _released)
+		{
+			count = allowed - _released;
+		}
+	}
+	return count > 0x7FFF ? 0x7FFF : (int)count;
+}
+
+int Sim900Emulator::read()
+{
+	if(available() <= 0)
+	{
+		return -1;
+	}
+	return (uint8_t)next(true);
+}
+
+int Sim900Emulator::peek()
+{
+	if(available() <= 0)
+	{
+		return -1;
+	}
+	return (uint8_t)next(false);
+}
+
+size_t Sim900Emulator::write(uint8_t byte)
+{
+	bool sleeping = asleep();
+	_last_input = millis();
+	if(sleeping)
+	{
+		return 1;
+	}
+	//The line feed after a command is not part of any HTTPDATA upload.
+	if(_skip_lf)
+	{
+		_skip_lf = false;
+		if(byte == '\n')
+		{
+			return 1;
+		}
+	}
+	if(_passthrough)
+	{
+		passthrough(byte);
+		return 1;
+	}
+	if(_sms_input)
+	{
+		smsInput(byte);
+		return 1;
+	}
+	if(_download_left > 0)
+	{
+		if(_send_socket < 0 && _refuse_count > 0 && _uploaded >= _refuse_after)
+		{
+			_refuse_count--;
+			return 0;
+		}
+		_uploaded++;
+		if(_send_socket >= 0 && _loop_len < SIM900_EMULATOR_LOOPBACK)
+		{
+			_loop[_loop_len++] = byte;
+		}
+		if(--_download_left == 0)
+		{
+			if(_send_socket < 0)
+			{
+				respond("OK");
+				return 1;
+			}
+			beginResponse();
+			queue("\r\n");
+			queue((long)_send_socket);
+			queue(", SEND OK\r\n");
+			queue("\r\n+CIPRXGET: 1,");
+			queue((long)_send_socket);
+			queue("\r\n");
+			_loop_socket = _send_socket;
+			_send_socket = -1;
+		}
+		return 1;
+	}
+	if(byte == '\n')
+	{
+		return 1;
+	}
+	if(byte == '\r')
+	{
+		_skip_lf = true;
+		handle();
+		return 1;
+	}
+	if(_line_len < SIM900_EMULATOR_LINE - 1)
+	{
+		_line[_line_len++] = byte;
+	}
+	return 1;
+}
+
+//
+//Reads the hex PDU after the AT+CMGS prompt up to its Ctrl-Z, keeping the
+//first octet after the SMSC length to see if a status report was asked
+//for.
+//
+void Sim900Emulator::smsInput(uint8_t byte)
+{
+	if(byte != 0x1A)
+	{
+		if(_sms_chars == 2 || _sms_chars == 3)
+		{
+			_sms_first = (_sms_first << 4) | hexValue(byte);
+		}
+		_sms_chars++;
+		return;
+	}
+	_sms_input = false;
+	_sms_reference++;
+	beginResponse();
+	queue("\r\n+CMGS: ");
+	queue((long)_sms_reference);
+	queue("\r\n\r\nOK\r\n");
+	if(_sms_reports && (_sms_first & 0x20))
+	{
+		//SMS-STATUS-REPORT to 1234, delivered.
+		queue("\r\n+CDS: 21\r\n0006");
+		queueHex(_sms_reference);
+		queue("04812143211017110000002110171100000000\r\n");
+	}
+}
+
+void Sim900Emulator::flush()
+{
+}
@@ -0,0 +1,226 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __SIM_900_EMULATOR_H__
+#define __SIM_900_EMULATOR_H__
+
+#include <Stream.h>
+#include "Arduino.h"
+
+//Size of the buffer holding the emulator's pending output, the response
+//body is generated as it is read and does not count against it.
+#ifndef SIM900_EMULATOR_BUFFER
+#define SIM900_EMULATOR_BUFFER 128
+#endif
+
+//Data sent on a socket is looped back to it, this much of it is kept.
+#ifndef SIM900_EMULATOR_LOOPBACK
+#define SIM900_EMULATOR_LOOPBACK 64
+#endif
+
+//The silence the emulator needs on each side of +++ in transparent mode.
+#ifndef SIM900_EMULATOR_GUARD_TIME
+#define SIM900_EMULATOR_GUARD_TIME 1000
+#endif
+
+//How long the port has to be quiet before AT+CSCLK=2 lets the emulator
+//sleep, the character that wakes it is lost.
+#ifndef SIM900_EMULATOR_SLEEP_TIME
+#define SIM900_EMULATOR_SLEEP_TIME 5000
+#endif
+
+//The number of received and stored SMS the emulator holds for AT+CMGL. They
+//are listed in one go, so together they have to fit SIM900_EMULATOR_BUFFER.
+#ifndef SIM900_EMULATOR_INBOX
+#define SIM900_EMULATOR_INBOX 2
+#endif
+
+//The longest command line the emulator understands.
+#ifndef SIM900_EMULATOR_LINE
+#define SIM900_EMULATOR_LINE 96
+#endif
+
+//A Stream that plays the modem's side of the AT dialogue used by Sim900 and
+//GPRSHTTP (SAPBR, HTTPINIT, HTTPPARA, HTTPDATA, HTTPACTION, HTTPREAD,
+//HTTPHEAD, CSQ, IFC, CSCLK, CMGF, CNMI, CMGS, CMGL, CMGD,
+//CGATT, CPIN, CREG, CGREG, the CIP socket and transparent mode commands
+//and the power up banners), so that the library can be exercised and
+//timed without a modem. Pass it to the Sim900(Stream*, ...) constructor.
+//All timing is taken from millis(), so it follows whatever clock the core
+//provides.
+class Sim900Emulator : public Stream
+{
+	private:
+		char _out[SIM900_EMULATOR_BUFFER];
+		uint16_t _out_head;
+		uint16_t _out_count;
+		char _line[SIM900_EMULATOR_LINE];
+		uint8_t _line_len;
+		bool _skip_lf;
+
+		//Response pacing.
+		unsigned long _latency;
+		unsigned long _baud_rate;
+		unsigned long _ready_time;
+		uint32_t _released;
+
+		//Modem state.
+		bool _echo;
+		bool _bearer;
+		bool _http;
+		bool _attached;
+		bool _sim_ready;
+		int _csclk;
+		unsigned long _last_input;
+		int _creg;
+		int _cgreg;
+		int _rssi;
+		int _ber;
+
+		//Injected errors.
+		const char* _fail_prefix;
+		uint8_t _fail_count;
+		int _fail_code;
+
+		//HTTP emulation.
+		int _http_code;
+		const char* _body;
+		uint32_t _body_length;
+		unsigned long _action_delay;
+		unsigned long _action_due;
+		int _action_method;
+		bool _action_pending;
+		uint32_t _download_left;
+		//When the AT+HTTPDATA time runs out and the modem ends the upload.
+		unsigned long _download_due;
+		uint32_t _refuse_after;
+		uint8_t _refuse_count;
+		uint32_t _uploaded;
+		uint32_t _body_pos;
+		uint32_t _body_left;
+		uint16_t _body_at;
+		const char* _read_source;
+		const char* _etag;
+		bool _not_modified;
+
+		//Socket emulation, every socket echoes what is sent on it.
+		bool _ip;
+		uint8_t _connected;
+		int8_t _send_socket;
+		int8_t _loop_socket;
+		char _loop[SIM900_EMULATOR_LOOPBACK];
+		uint8_t _loop_start;
+		uint8_t _loop_len;
+
+		//SMS emulation. A status report is queued for each message sent
+		//with one requested, received messages are kept as hex PDUs.
+		bool _sms_input;
+		uint16_t _sms_chars;
+		uint8_t _sms_first;
+		uint8_t _sms_reference;
+		bool _sms_reports;
+		const char* _inbox[SIM900_EMULATOR_INBOX];
+		//The AT+CMGL <stat> of each, 0 unread, 1 read, 2 and 3 unsent
+		//and sent SMS-SUBMITs.
+		uint8_t _inbox_stat[SIM900_EMULATOR_INBOX];
+		uint8_t _inbox_count;
+
+		//Transparent mode, data is echoed until +++ is seen between guard
+		//times.
+		bool _cipmode;
+		bool _single;
+		bool _passthrough;
+		uint8_t _plus_count;
+		unsigned long _last_write;
+
+		void queue(const char* text);
+		void queue(long number);
+		void queueByte(uint8_t byte);
+		void queueHex(uint8_t value);
+		void smsInput(uint8_t byte);
+		void passthrough(uint8_t byte);
+		void respond(const char* text);
+		void beginResponse();
+		void handle();
+		bool starts(const char* prefix);
+		void update();
+		uint32_t pending();
+		char next(bool consume);
+	public:
+		Sim900Emulator();
+
+		//Milliseconds between a command and the start of its response.
+		void setLatency(unsigned long latency);
+		//Limits how fast responses become available, 0 for no limit.
+		void setBaudRate(unsigned long baud_rate);
+		//Milliseconds between AT+HTTPACTION and its +HTTPACTION result.
+		void setActionDelay(unsigned long action_delay);
+		void setEcho(bool echo);
+		void setSignal(int rssi, int ber);
+		void setAttached(bool attached);
+		void setSimReady(bool ready);
+		//The <stat> values reported by AT+CREG? and AT+CGREG?, 1 is
+		//registered, 2 is searching.
+		void setRegistration(int creg, int cgreg);
+		//The status code and body returned for every HTTP action. A NULL
+		//body produces length bytes of generated text. The body is not
+		//copied.
+		void setResponse(int http_code, const char* body, uint32_t length);
+		//The ETag reported by AT+HTTPHEAD, NULL for none. A GET with a
+		//matching If-None-Match header is answered with 304. Not copied.
+		void setETag(const char* etag);
+		//Answers the next times commands starting with prefix with ERROR, or
+		//with +CME ERROR: <cme_error> if it is not negative.
+		void failCommand(const char* prefix, uint8_t times = 1, int cme_error = -1);
+		//Queues the banners the modem prints when it is switched on.
+		void powerUp();
+		//Queues an unsolicited result code.
+		void unsolicited(const char* line);
+		//Stores an SMS-DELIVER PDU, in hex with the SMSC address in front,
+		//and reports it with +CMTI. The PDU is not copied.
+		void receiveSMS(const char* pdu);
+		//Stores an SMS-SUBMIT PDU, as above, with <stat> 2 (unsent) or 3
+		//(sent) and without reporting it. AT+CMGD=1,1 leaves it in place.
+		void storeSMS(const char* pdu, uint8_t stat);
+		//Refuses the next times bytes of an AT+HTTPDATA upload once after
+		//bytes of it have been taken, like a port that cannot keep up, so
+		//that a write falls short.
+		void refuseUpload(uint32_t after, uint8_t times = 1);
+		//The number of messages sent with AT+CMGS.
+		uint8_t smsSent();
+		//Closes a socket from the remote end.
+		void closeSocket(uint8_t id);
+
+		bool bearerActive();
+		bool httpActive();
+		//The AT+CSCLK mode and whether the port has been quiet long enough
+		//for it to be asleep.
+		int sleepMode();
+		bool asleep();
+		uint32_t uploaded();
+
+		virtual int available();
+		virtual int read();
+		virtual int peek();
+		virtual size_t write(uint8_t byte);
+		virtual void flush();
+		using Print::write;
+};
+
+#endif
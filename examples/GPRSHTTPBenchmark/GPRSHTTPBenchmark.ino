@@ -0,0 +1,210 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <SoftwareSerial.h>
+#include <Sim900.h>
+#include <Sim900Emulator.h>
+
+// Runs RUNS complete POST cycles and prints min/median/p99 milliseconds
+// for each phase, plus payload and body throughput. Each summary line
+// starts with RUN_LABEL so the output of two runs (say before and after
+// changing a retry delay) can be compared line by line.
+//
+// With USE_EMULATOR set the modem is a Sim900Emulator with LINK_LATENCY
+// and LINK_BAUD, no modem needs to be attached.
+
+#define USE_EMULATOR 1
+#define LINK_LATENCY 20
+#define LINK_BAUD 19200
+#define RUNS 10
+#define PAYLOAD_SIZE 512
+#define BODY_SIZE 1024
+#define RUN_LABEL "baseline"
+
+enum PHASE
+{
+  PHASE_INIT,         // bearer bring-up, HTTPINIT and the HTTPPARA calls
+  PHASE_POST_INIT,    // HTTPDATA up to DOWNLOAD
+  PHASE_PAYLOAD,      // writing the payload
+  PHASE_ACTION,       // the upload's OK, then HTTPACTION up to +HTTPACTION
+  PHASE_READ,         // HTTPREAD of the whole body
+  PHASE_TERMINATE,
+  PHASE_TOTAL,
+  PHASE_COUNT
+};
+
+const char* phase_names[PHASE_COUNT] = {"init", "post_init", "payload", "action", "read", "terminate", "total"};
+
+CONN settings;
+#if USE_EMULATOR
+Sim900Emulator emulator;
+Sim900 modem(&emulator, 9, 8, VARIANT_2);
+#else
+// pins 10, and 11 are serial rx and tx pins for the modem
+// pin 9 is the power toggle pin
+// analog pin 8 is the GRPS power status pin
+Sim900 modem(new SoftwareSerial(10, 11), LINK_BAUD, 9, 8, VARIANT_2);
+#endif
+char url[] = "www.example.com";
+
+unsigned long samples[PHASE_COUNT][RUNS];
+int completed = 0;
+uint32_t body_bytes = 0;
+uint8_t window[64];
+
+void count_body(const uint8_t* data, uint32_t length)
+{
+  body_bytes += length;
+}
+
+void setup()
+{
+  Serial.begin(19200);             // the Serial port of Arduino baud rate.
+  delay(2000);
+  settings.cid = 1;
+  settings.contype = "GPRS";
+  settings.apn = "internet";
+#if USE_EMULATOR
+  emulator.setLatency(LINK_LATENCY);
+  emulator.setBaudRate(LINK_BAUD);
+  emulator.setResponse(200, NULL, BODY_SIZE);
+#else
+  if(!modem.powerUp())
+  {
+     Serial.println("Powering up modem failed !"); 
+     return;
+  }
+#endif
+  for(int run = 0; run < RUNS; run++)
+  {
+    if(!cycle(run))
+    {
+      Serial.println(get_error_message(modem.get_error_condition()));
+      break;
+    }
+    completed++;
+  }
+  report();
+}
+
+void loop()
+{
+}
+
+bool cycle(int run)
+{
+  int cid = 0, code = 0;
+  int32_t length = 0;
+  unsigned long start = millis();
+  unsigned long mark = start;
+  bool ok = false;
+  GPRSHTTP* con = modem.createHTTPConnection(settings, url);
+  if(con == NULL)
+  {
+    return false;
+  }
+  if(con->init())
+  {
+    lap(PHASE_INIT, run, mark);
+    if(con->post_init(PAYLOAD_SIZE))
+    {
+      lap(PHASE_POST_INIT, run, mark);
+      for(unsigned int i = 0; i < sizeof(window); i++)
+      {
+        window[i] = 'a' + i % 26;
+      }
+      for(uint32_t sent = 0; sent < PAYLOAD_SIZE; sent += sizeof(window))
+      {
+        uint32_t chunk = PAYLOAD_SIZE - sent;
+        con->write(window, chunk < sizeof(window) ? chunk : sizeof(window));
+      }
+      lap(PHASE_PAYLOAD, run, mark);
+      ok = con->post(cid, code, length);
+      lap(PHASE_ACTION, run, mark);
+    }
+  }
+  if(ok)
+  {
+    body_bytes = 0;
+    ok = con->streamBody(count_body, window, sizeof(window)) >= 0;
+    lap(PHASE_READ, run, mark);
+  }
+  ok = con->terminate() && ok;
+  lap(PHASE_TERMINATE, run, mark);
+  samples[PHASE_TOTAL][run] = millis() - start;
+  delete con;
+  return ok;
+}
+
+void lap(int phase, int run, unsigned long &mark)
+{
+  unsigned long now = millis();
+  samples[phase][run] = now - mark;
+  mark = now;
+}
+
+void sort(unsigned long* values, int count)
+{
+  for(int i = 1; i < count; i++)
+  {
+    unsigned long value = values[i];
+    int j = i - 1;
+    for(; j >= 0 && values[j] > value; j--)
+    {
+      values[j + 1] = values[j];
+    }
+    values[j + 1] = value;
+  }
+}
+
+void report()
+{
+  Serial.print(RUN_LABEL);
+  Serial.print(" runs=");
+  Serial.println(completed, DEC);
+  if(completed == 0)
+  {
+    return;
+  }
+  for(int phase = 0; phase < PHASE_COUNT; phase++)
+  {
+    unsigned long* values = samples[phase];
+    sort(values, completed);
+    Serial.print(RUN_LABEL);
+    Serial.print(" ");
+    Serial.print(phase_names[phase]);
+    Serial.print(" min=");
+    Serial.print(values[0], DEC);
+    Serial.print(" median=");
+    Serial.print(values[completed / 2], DEC);
+    Serial.print(" p99=");
+    Serial.println(values[(completed * 99) / 100], DEC);
+  }
+  throughput("payload", PAYLOAD_SIZE, samples[PHASE_PAYLOAD][completed / 2]);
+  throughput("body", body_bytes, samples[PHASE_READ][completed / 2]);
+}
+
+void throughput(const char* name, uint32_t bytes, unsigned long ms)
+{
+  Serial.print(RUN_LABEL);
+  Serial.print(" ");
+  Serial.print(name);
+  Serial.print(" bytes/s=");
+  Serial.println(ms > 0 ? (bytes * 1000UL) / ms : 0, DEC);
+}
@@ -61,8 +61,10 @@ void test_modem()
         Serial.print(" Error Rate: ");
         Serial.println(error_rate);        
       }
-      GPRSHTTP* con = modem.createHTTPConnection(settings, url);
-      if(con == NULL)
+      //The connection is terminated and handed back when con goes out of
+      //scope, whichever way the block is left.
+      ScopedHTTPConnection con(modem.createHTTPConnection(settings, url));
+      if(!con)
       {
           Serial.println(get_error_message(modem.get_error_condition()));
           return;
@@ -93,8 +95,6 @@ void test_modem()
           }
         }
       }
-      con->terminate();
-      delete con;
       Serial.println("------------------------------------------------");
   }else
   {
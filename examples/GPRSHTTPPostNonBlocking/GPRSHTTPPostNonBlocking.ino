@@ -0,0 +1,137 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <SoftwareSerial.h>
+#include <Sim900.h>
+
+// Posts "Hello World!" without ever blocking loop(), the modem is
+// advanced by modem.poll() and the rest of loop() keeps running.
+
+enum STATE
+{
+  STATE_INIT,
+  STATE_POST_INIT,
+  STATE_POST,
+  STATE_RETRIEVE,
+  STATE_READ,
+  STATE_TERMINATE,
+  STATE_FINISHED
+};
+
+CONN settings;
+// pins 10, and 11 are serial rx and tx pins for the modem
+// pin 9 is the power toggle pin
+// analog pin 8 is the GRPS power status pin
+Sim900 modem(new SoftwareSerial(10, 11), 19200, 9, 8, VARIANT_2);
+char url[] = "www.example.com";
+GPRSHTTP* con = NULL;
+STATE state = STATE_FINISHED;
+int32_t remaining = 0;
+
+void setup()
+{
+  Serial.begin(19200);             // the Serial port of Arduino baud rate.
+  delay(2000);
+  settings.cid = 1;
+  settings.contype = "GPRS";
+  settings.apn = "internet";
+  if(!modem.powerUp())
+  {
+     Serial.println("Powering up modem failed !"); 
+     return;
+  }
+  con = modem.createHTTPConnection(settings, url);
+  if(con == NULL)
+  {
+      Serial.println(get_error_message(modem.get_error_condition()));
+      return;
+  }
+  if(con->beginInit())
+  {
+    state = STATE_INIT;
+  }
+}
+
+void loop()
+{
+  modem.poll();
+  if(state == STATE_READ)
+  {
+    while(remaining > 0 && con->available() > 0)
+    {
+      Serial.write(con->read());
+      remaining--;
+    }
+    if(remaining == 0)
+    {
+      Serial.println();
+      con->beginTerminate();
+      state = STATE_TERMINATE;
+    }
+  }
+  else if(con != NULL && state != STATE_FINISHED && con->isDone())
+  {
+    advance();
+  }
+  // Sensor sampling etc. carries on here while the request is in flight.
+}
+
+void advance()
+{
+  int cid = 0, code = 0;
+  bool ok = con->result() == SIM900_ERROR_NO_ERROR;
+  if(!ok && state != STATE_TERMINATE)
+  {
+    Serial.println(get_error_message(con->result()));
+    con->beginTerminate();
+    state = STATE_TERMINATE;
+    return;
+  }
+  switch(state)
+  {
+  case STATE_INIT:
+    con->beginPostInit(14);
+    state = STATE_POST_INIT;
+    break;
+  case STATE_POST_INIT:
+    con->println("Hello World!");
+    con->beginPost();
+    state = STATE_POST;
+    break;
+  case STATE_POST:
+    con->getPostResult(cid, code, remaining);
+    Serial.print("HTTP CODE: ");
+    Serial.println(code, DEC);  
+    con->beginRetrieve();
+    state = STATE_RETRIEVE;
+    break;
+  case STATE_RETRIEVE:
+    Serial.println("Retrieved Data:");
+    state = STATE_READ;
+    break;
+  case STATE_TERMINATE:
+    delete con;
+    con = NULL;
+    state = STATE_FINISHED;
+    Serial.println("------------------------------------------------");
+    break;
+  default:
+    break;
+  }
+}
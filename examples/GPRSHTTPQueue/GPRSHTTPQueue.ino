@@ -0,0 +1,88 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <SoftwareSerial.h>
+#include <EEPROM.h>
+#include <Sim900.h>
+#include <Sim900EEPROM.h>
+
+// Takes a reading every minute and queues it in the EEPROM. Every ten
+// minutes the queue is posted in as few requests as possible, readings that
+// could not be sent stay queued, across resets too, until the next attempt.
+// When GPRS is not available they are sent by SMS instead, as many as fit
+// in each message.
+
+CONN settings;
+// pins 10, and 11 are serial rx and tx pins for the modem
+// pin 9 is the power toggle pin
+// analog pin 8 is the GRPS power status pin
+Sim900 modem(new SoftwareSerial(10, 11), 19200, 9, 8, VARIANT_2);
+char url[] = "www.example.com/readings";
+char sms_number[] = "+15555550100";
+// The first 512 bytes of EEPROM hold the queue.
+EEPROMQueueStorage storage(0, 512);
+OutboundQueue queue(&storage);
+unsigned long last_reading = 0;
+unsigned long last_flush = 0;
+
+void setup()
+{
+  Serial.begin(19200);             // the Serial port of Arduino baud rate.
+  delay(2000);
+  settings.cid = 1;
+  settings.contype = "GPRS";
+  settings.apn = "internet";
+  queue.begin();
+  Serial.print(queue.count());
+  Serial.println(" readings queued.");
+}
+
+void loop()
+{
+  if(millis() - last_reading > 60000)
+  {
+    last_reading = millis();
+    char reading[20];
+    ltoa(millis() / 1000, reading, 10);
+    strcat(reading, ",");
+    itoa(analogRead(0), reading + strlen(reading), 10);
+    if(!queue.push(reading))
+    {
+      Serial.println(get_error_message(queue.get_error_condition()));
+    }
+  }
+  if(millis() - last_flush > 600000 && queue.count() > 0)
+  {
+    last_flush = millis();
+    bool sent = false;
+    if(modem.powerUp(SIM900_READY_NETWORK) && modem.waitForSignal(5, 1000))
+    {
+      sent = (modem.getReadiness() == SIM900_READY_GPRS && queue.flush(&modem, settings, url)) ||
+        queue.flushSMS(&modem, sms_number);
+    }
+    if(sent)
+    {
+      Serial.println("Queue sent.");
+    }else
+    {
+      Serial.println(get_error_message(queue.get_error_condition()));
+    }
+    modem.powerDown();
+  }
+}
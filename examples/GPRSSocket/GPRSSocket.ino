@@ -0,0 +1,76 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <SoftwareSerial.h>
+#include <Sim900.h>
+
+// Keeps a TCP command channel open and sends a UDP reading every ten
+// seconds alongside it, whatever arrives on the TCP channel is printed.
+
+CONN settings;
+// pins 10, and 11 are serial rx and tx pins for the modem
+// pin 9 is the power toggle pin
+// analog pin 8 is the GRPS power status pin
+Sim900 modem(new SoftwareSerial(10, 11), 19200, 9, 8, VARIANT_2);
+GPRSSocket* commands = NULL;
+GPRSSocket* telemetry = NULL;
+unsigned long last_reading = 0;
+
+void setup()
+{
+  Serial.begin(19200);             // the Serial port of Arduino baud rate.
+  delay(2000);
+  settings.apn = "internet";
+  if(!modem.powerUp(SIM900_READY_GPRS))
+  {
+     Serial.println("Powering up modem failed !"); 
+     return;
+  }
+  commands = modem.createSocket(settings, SIM900_TCP, "commands.example.com", 4000);
+  telemetry = modem.createSocket(settings, SIM900_UDP, "telemetry.example.com", 4001);
+  if(commands == NULL || telemetry == NULL)
+  {
+      Serial.println(get_error_message(modem.get_error_condition()));
+  }
+}
+
+void loop()
+{
+  if(commands == NULL || telemetry == NULL)
+  {
+    return;
+  }
+  while(commands->available() > 0)
+  {
+    Serial.write(commands->read());
+  }
+  if(millis() - last_reading > 10000)
+  {
+    last_reading = millis();
+    telemetry->print("temperature=");
+    telemetry->println(analogRead(0), DEC);
+    telemetry->flush();   // one datagram
+  }
+  if(!commands->connected())
+  {
+    Serial.println("Command channel closed.");
+    delete commands;
+    commands = modem.createSocket(settings, SIM900_TCP, "commands.example.com", 4000);
+  }
+}
@@ -0,0 +1,490 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "Arduino.h"
+
+static uint64_t host_time = 0;
+static unsigned long host_tick = 10;
+static int host_digital[HOST_PINS];
+static int host_analog[HOST_PINS];
+
+HardwareSerial Serial;
+
+void hostSetTime(uint64_t us)
+{
+	host_time = us;
+}
+
+uint64_t hostTime()
+{
+	return host_time;
+}
+
+void hostSetTick(unsigned long us)
+{
+	host_tick = us;
+}
+
+unsigned long millis()
+{
+	host_time += host_tick;
+	return (unsigned long)(host_time / 1000);
+}
+
+unsigned long micros()
+{
+	host_time += host_tick;
+	return (unsigned long)host_time;
+}
+
+void delay(unsigned long ms)
+{
+	host_time += (uint64_t)ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	host_time += us;
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+	(void)pin;
+	(void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+	hostSetDigital(pin, value);
+}
+
+int digitalRead(uint8_t pin)
+{
+	return pin < HOST_PINS ? host_digital[pin] : LOW;
+}
+
+int analogRead(uint8_t pin)
+{
+	return pin < HOST_PINS ? host_analog[pin] : 0;
+}
+
+void hostSetDigital(uint8_t pin, int value)
+{
+	if(pin < HOST_PINS)
+	{
+		host_digital[pin] = value;
+	}
+}
+
+void hostSetAnalog(uint8_t pin, int value)
+{
+	if(pin < HOST_PINS)
+	{
+		host_analog[pin] = value;
+	}
+}
+
+char* ultoa(unsigned long value, char* buffer, int base)
+{
+	char digits[sizeof(unsigned long) * 8 + 1];
+	int count = 0;
+	do
+	{
+		int digit = value % base;
+		digits[count++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+		value /= base;
+	}while(value > 0);
+	for(int i = 0; i < count; i++)
+	{
+		buffer[i] = digits[count - 1 - i];
+	}
+	buffer[count] = '\0';
+	return buffer;
+}
+
+char* ltoa(long value, char* buffer, int base)
+{
+	if(value < 0 && base == 10)
+	{
+		buffer[0] = '-';
+		ultoa(-(unsigned long)value, buffer + 1, base);
+		return buffer;
+	}
+	return ultoa((unsigned long)value, buffer, base);
+}
+
+String::String(const char* value) : _buffer(NULL), _length(0)
+{
+	assign(value, value == NULL ? 0 : strlen(value));
+}
+
+String::String(const String& value) : _buffer(NULL), _length(0)
+{
+	assign(value._buffer, value._length);
+}
+
+String::String(const __FlashStringHelper* value) : _buffer(NULL), _length(0)
+{
+	const char* text = reinterpret_cast<const char*>(value);
+	assign(text, text == NULL ? 0 : strlen(text));
+}
+
+String::String(char value) : _buffer(NULL), _length(0)
+{
+	assign(&value, 1);
+}
+
+String::String(int value, unsigned char base) : _buffer(NULL), _length(0)
+{
+	char text[sizeof(long) * 8 + 2];
+	ltoa(value, text, base);
+	assign(text, strlen(text));
+}
+
+String::String(unsigned int value, unsigned char base) : _buffer(NULL), _length(0)
+{
+	char text[sizeof(long) * 8 + 2];
+	ultoa(value, text, base);
+	assign(text, strlen(text));
+}
+
+String::String(long value, unsigned char base) : _buffer(NULL), _length(0)
+{
+	char text[sizeof(long) * 8 + 2];
+	ltoa(value, text, base);
+	assign(text, strlen(text));
+}
+
+String::String(unsigned long value, unsigned char base) : _buffer(NULL), _length(0)
+{
+	char text[sizeof(long) * 8 + 2];
+	ultoa(value, text, base);
+	assign(text, strlen(text));
+}
+
+String::~String()
+{
+	free(_buffer);
+}
+
+String& String::operator=(const String& value)
+{
+	if(this != &value)
+	{
+		assign(value._buffer, value._length);
+	}
+	return *this;
+}
+
+String& String::operator=(const char* value)
+{
+	assign(value, value == NULL ? 0 : strlen(value));
+	return *this;
+}
+
+bool String::assign(const char* value, unsigned int length)
+{
+	char* buffer = (char*)realloc(_buffer, length + 1);
+	if(buffer == NULL)
+	{
+		return false;
+	}
+	_buffer = buffer;
+	memmove(_buffer, value == NULL ? "" : value, length);
+	_buffer[length] = '\0';
+	_length = length;
+	return true;
+}
+
+bool String::concat(const String& value)
+{
+	return concat(value._buffer);
+}
+
+bool String::concat(const char* value)
+{
+	if(value == NULL)
+	{
+		return false;
+	}
+	unsigned int length = strlen(value);
+	char* buffer = (char*)realloc(_buffer, _length + length + 1);
+	if(buffer == NULL)
+	{
+		return false;
+	}
+	_buffer = buffer;
+	memcpy(_buffer + _length, value, length + 1);
+	_length += length;
+	return true;
+}
+
+bool String::concat(char value)
+{
+	char text[2] = {value, '\0'};
+	return concat(text);
+}
+
+bool String::equals(const String& value) const
+{
+	return _length == value._length && strcmp(_buffer, value._buffer) == 0;
+}
+
+char String::operator[](unsigned int index) const
+{
+	return index < _length ? _buffer[index] : '\0';
+}
+
+int String::indexOf(char value, unsigned int from) const
+{
+	if(from >= _length)
+	{
+		return -1;
+	}
+	const char* found = strchr(_buffer + from, value);
+	return found == NULL ? -1 : found - _buffer;
+}
+
+int String::indexOf(const char* value, unsigned int from) const
+{
+	if(from > _length)
+	{
+		return -1;
+	}
+	const char* found = strstr(_buffer + from, value);
+	return found == NULL ? -1 : found - _buffer;
+}
+
+String String::substring(unsigned int from) const
+{
+	return substring(from, _length);
+}
+
+String String::substring(unsigned int from, unsigned int to) const
+{
+	if(from > to)
+	{
+		unsigned int swap = from;
+		from = to;
+		to = swap;
+	}
+	if(to > _length)
+	{
+		to = _length;
+	}
+	String result;
+	if(from < to)
+	{
+		result.assign(_buffer + from, to - from);
+	}
+	return result;
+}
+
+long String::toInt() const
+{
+	return atol(_buffer);
+}
+
+void String::trim()
+{
+	unsigned int start = 0;
+	unsigned int end = _length;
+	while(start < end && isspace((unsigned char)_buffer[start]))
+	{
+		start++;
+	}
+	while(end > start && isspace((unsigned char)_buffer[end - 1]))
+	{
+		end--;
+	}
+	memmove(_buffer, _buffer + start, end - start);
+	_buffer[end - start] = '\0';
+	_length = end - start;
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+	size_t written = 0;
+	while(written < size && write(buffer[written]))
+	{
+		written++;
+	}
+	return written;
+}
+
+size_t Print::write(const char* value)
+{
+	return value == NULL ? 0 : write((const uint8_t*)value, strlen(value));
+}
+
+size_t Print::printNumber(unsigned long value, int base, bool negative)
+{
+	char text[sizeof(long) * 8 + 2];
+	size_t written = negative ? write('-') : 0;
+	ultoa(value, text, base < 2 ? 10 : base);
+	if(base == HEX)
+	{
+		for(char* digit = text; *digit != '\0'; digit++)
+		{
+			*digit = toupper((unsigned char)*digit);
+		}
+	}
+	return written + write(text);
+}
+
+size_t Print::print(const __FlashStringHelper* value)
+{
+	return write(reinterpret_cast<const char*>(value));
+}
+
+size_t Print::print(const String& value)
+{
+	return write((const uint8_t*)value.c_str(), value.length());
+}
+
+size_t Print::print(const char* value)
+{
+	return write(value);
+}
+
+size_t Print::print(char value)
+{
+	return write((uint8_t)value);
+}
+
+size_t Print::print(unsigned char value, int base)
+{
+	return printNumber(value, base, false);
+}
+
+size_t Print::print(int value, int base)
+{
+	return print((long)value, base);
+}
+
+size_t Print::print(unsigned int value, int base)
+{
+	return printNumber(value, base, false);
+}
+
+size_t Print::print(long value, int base)
+{
+	if(value < 0 && base == DEC)
+	{
+		return printNumber(-(unsigned long)value, base, true);
+	}
+	return printNumber((unsigned long)value, base, false);
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+	return printNumber(value, base, false);
+}
+
+size_t Print::print(double value, int digits)
+{
+	char text[48];
+	snprintf(text, sizeof(text), "%.*f", digits, value);
+	return write(text);
+}
+
+size_t Print::println()
+{
+	return write("\r\n");
+}
+
+size_t Print::println(const __FlashStringHelper* value)
+{
+	size_t written = print(value);
+	return written + println();
+}
+
+size_t Print::println(const String& value)
+{
+	size_t written = print(value);
+	return written + println();
+}
+
+size_t Print::println(const char* value)
+{
+	size_t written = print(value);
+	return written + println();
+}
+
+size_t Print::println(char value)
+{
+	size_t written = print(value);
+	return written + println();
+}
+
+size_t Print::println(unsigned char value, int base)
+{
+	size_t written = print(value, base);
+	return written + println();
+}
+
+size_t Print::println(int value, int base)
+{
+	size_t written = print(value, base);
+	return written + println();
+}
+
+size_t Print::println(unsigned int value, int base)
+{
+	size_t written = print(value, base);
+	return written + println();
+}
+
+size_t Print::println(long value, int base)
+{
+	size_t written = print(value, base);
+	return written + println();
+}
+
+size_t Print::println(unsigned long value, int base)
+{
+	size_t written = print(value, base);
+	return written + println();
+}
+
+size_t Print::println(double value, int digits)
+{
+	size_t written = print(value, digits);
+	return written + println();
+}
+
+size_t Stream::readBytes(char* buffer, size_t length)
+{
+	size_t count = 0;
+	unsigned long start = millis();
+	while(count < length && millis() - start < _timeout)
+	{
+		int c = read();
+		if(c >= 0)
+		{
+			buffer[count++] = (char)c;
+		}
+	}
+	return count;
+}
+
+size_t HardwareSerial::write(uint8_t value)
+{
+	return fputc(value, stdout) == EOF ? 0 : 1;
+}
@@ -0,0 +1,206 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//Just enough of the Arduino core to build the library, the emulator and the
+//tests on a desktop. Time is virtual: delay() moves the clock forward and so
+//does every read of it (by the tick, see hostSetTick()), so the library's
+//timeouts and the emulator's latency cost no real time.
+
+#ifndef __SIM_900_HOST_ARDUINO_H__
+#define __SIM_900_HOST_ARDUINO_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define HOST_PINS 64
+
+//Flash is ordinary memory on the host.
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+#define pgm_read_dword(address) (*(const uint32_t*)(address))
+#define pgm_read_ptr(address) (*(void* const*)(address))
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strstr_P strstr
+#define strchr_P strchr
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strncasecmp_P strncasecmp
+#define memcpy_P memcpy
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper*>(PSTR(string_literal)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+//The virtual clock, in microseconds.
+void hostSetTime(uint64_t us);
+uint64_t hostTime();
+//How far each millis() or micros() call moves the clock, 10us by default.
+void hostSetTick(unsigned long us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+//Sets what digitalRead() and analogRead() return for a pin. digitalWrite()
+//sets the digital level too.
+void hostSetDigital(uint8_t pin, int value);
+void hostSetAnalog(uint8_t pin, int value);
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+char* ltoa(long value, char* buffer, int base);
+char* ultoa(unsigned long value, char* buffer, int base);
+
+class String
+{
+	public:
+		String(const char* value = "");
+		String(const String& value);
+		String(const __FlashStringHelper* value);
+		explicit String(char value);
+		explicit String(int value, unsigned char base = DEC);
+		explicit String(unsigned int value, unsigned char base = DEC);
+		explicit String(long value, unsigned char base = DEC);
+		explicit String(unsigned long value, unsigned char base = DEC);
+		~String();
+		String& operator=(const String& value);
+		String& operator=(const char* value);
+		bool concat(const String& value);
+		bool concat(const char* value);
+		bool concat(char value);
+		String& operator+=(const String& value) {concat(value); return *this;}
+		String& operator+=(const char* value) {concat(value); return *this;}
+		String& operator+=(char value) {concat(value); return *this;}
+		bool equals(const String& value) const;
+		bool operator==(const String& value) const {return equals(value);}
+		bool operator!=(const String& value) const {return !equals(value);}
+		char operator[](unsigned int index) const;
+		unsigned int length() const {return _length;}
+		const char* c_str() const {return _buffer;}
+		int indexOf(char value, unsigned int from = 0) const;
+		int indexOf(const char* value, unsigned int from = 0) const;
+		String substring(unsigned int from) const;
+		String substring(unsigned int from, unsigned int to) const;
+		long toInt() const;
+		void trim();
+	private:
+		bool assign(const char* value, unsigned int length);
+		char* _buffer;
+		unsigned int _length;
+};
+
+//No virtual destructor, as in the Arduino core, so that deleting through
+//a base pointer warns here as it would there.
+class Print
+{
+	public:
+		virtual size_t write(uint8_t value) = 0;
+		virtual size_t write(const uint8_t* buffer, size_t size);
+		size_t write(const char* value);
+		size_t write(const char* buffer, size_t size) {return write((const uint8_t*)buffer, size);}
+		virtual void flush() {}
+
+		size_t print(const __FlashStringHelper* value);
+		size_t print(const String& value);
+		size_t print(const char* value);
+		size_t print(char value);
+		size_t print(unsigned char value, int base = DEC);
+		size_t print(int value, int base = DEC);
+		size_t print(unsigned int value, int base = DEC);
+		size_t print(long value, int base = DEC);
+		size_t print(unsigned long value, int base = DEC);
+		size_t print(double value, int digits = 2);
+
+		size_t println();
+		size_t println(const __FlashStringHelper* value);
+		size_t println(const String& value);
+		size_t println(const char* value);
+		size_t println(char value);
+		size_t println(unsigned char value, int base = DEC);
+		size_t println(int value, int base = DEC);
+		size_t println(unsigned int value, int base = DEC);
+		size_t println(long value, int base = DEC);
+		size_t println(unsigned long value, int base = DEC);
+		size_t println(double value, int digits = 2);
+	private:
+		size_t printNumber(unsigned long value, int base, bool negative);
+};
+
+class Stream : public Print
+{
+	public:
+		virtual int available() = 0;
+		virtual int read() = 0;
+		virtual int peek() = 0;
+		void setTimeout(unsigned long timeout) {_timeout = timeout;}
+		size_t readBytes(char* buffer, size_t length);
+		size_t readBytes(uint8_t* buffer, size_t length) {return readBytes((char*)buffer, length);}
+	protected:
+		Stream() : _timeout(1000) {}
+		unsigned long _timeout;
+};
+
+//Serial prints to stdout and never has anything to read.
+class HardwareSerial : public Stream
+{
+	public:
+		void begin(unsigned long baud) {(void)baud;}
+		void end() {}
+		int available() {return 0;}
+		int read() {return -1;}
+		int peek() {return -1;}
+		size_t write(uint8_t value);
+		using Print::write;
+		operator bool() {return true;}
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,44 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __SIM_900_HOST_EEPROM_H__
+#define __SIM_900_HOST_EEPROM_H__
+
+#include "Arduino.h"
+
+#ifndef HOST_EEPROM_SIZE
+#define HOST_EEPROM_SIZE 1024
+#endif
+
+//A RAM array standing in for the EEPROM, it starts out erased (0xFF).
+class EEPROMClass
+{
+	public:
+		EEPROMClass() {memset(_cells, 0xFF, sizeof(_cells));}
+		uint8_t read(int address) {return _cells[address];}
+		void write(int address, uint8_t value) {_cells[address] = value;}
+		void update(int address, uint8_t value) {_cells[address] = value;}
+		uint16_t length() {return HOST_EEPROM_SIZE;}
+	private:
+		uint8_t _cells[HOST_EEPROM_SIZE];
+};
+
+static EEPROMClass EEPROM;
+
+#endif
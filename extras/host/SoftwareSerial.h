@@ -0,0 +1,47 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __SIM_900_HOST_SOFTWARE_SERIAL_H__
+#define __SIM_900_HOST_SOFTWARE_SERIAL_H__
+
+#include "Arduino.h"
+
+//An unconnected port, host tests talk to a Sim900Emulator instead.
+class SoftwareSerial : public Stream
+{
+	public:
+		SoftwareSerial(uint8_t receivePin, uint8_t transmitPin, bool inverse = false)
+		{
+			(void)receivePin;
+			(void)transmitPin;
+			(void)inverse;
+		}
+		void begin(long baud) {(void)baud;}
+		void end() {}
+		bool listen() {return true;}
+		bool isListening() {return true;}
+		bool overflow() {return false;}
+		int available() {return 0;}
+		int read() {return -1;}
+		int peek() {return -1;}
+		size_t write(uint8_t value) {(void)value; return 1;}
+		using Print::write;
+};
+
+#endif
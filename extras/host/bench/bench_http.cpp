@@ -0,0 +1,166 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//Full POST cycles against Sim900Emulator, the host counterpart of the
+//GPRSHTTPBenchmark example. Times are virtual microseconds, so they are
+//what the library waits for (latency, baud rate, retry delays, chunk
+//intervals) and do not vary from run to run. Prints CSV:
+//
+//  label,phase,runs,min_us,median_us,p99_us,bytes,bytes_per_s
+//
+//bytes is the payload for the payload phase, the body for read and both
+//for total, otherwise 0. Give each configuration its own label and the
+//outputs of two runs can be joined on label and phase.
+//
+//Usage: bench_http [label] [runs] [latency_ms] [baud] [payload] [body]
+
+#include "Sim900.h"
+#include "Sim900Emulator.h"
+#include <vector>
+#include <algorithm>
+
+enum PHASE
+{
+	PHASE_INIT,		//bearer bring-up, HTTPINIT and the HTTPPARA calls
+	PHASE_POST_INIT,	//HTTPDATA up to DOWNLOAD
+	PHASE_PAYLOAD,		//writing the payload
+	PHASE_ACTION,		//the upload's OK, then HTTPACTION up to +HTTPACTION
+	PHASE_READ,		//HTTPREAD of the whole body
+	PHASE_TERMINATE,
+	PHASE_TOTAL,
+	PHASE_COUNT
+};
+
+static const char* const phase_names[PHASE_COUNT] = {"init", "post_init", "payload", "action", "read", "terminate", "total"};
+
+static std::vector<uint64_t> samples[PHASE_COUNT];
+static uint32_t body_bytes = 0;
+
+static void count_body(const uint8_t* data, uint32_t length)
+{
+	(void)data;
+	body_bytes += length;
+}
+
+static void lap(int phase, uint64_t &mark)
+{
+	uint64_t now = hostTime();
+	samples[phase].push_back(now - mark);
+	mark = now;
+}
+
+static bool cycle(Sim900 &modem, CONN &settings, char* url, uint32_t payload)
+{
+	int cid = 0, code = 0;
+	int32_t length = 0;
+	uint8_t window[64];
+	uint64_t start = hostTime();
+	uint64_t mark = start;
+	GPRSHTTP* con = modem.createHTTPConnection(settings, url);
+	if(con == NULL)
+	{
+		return false;
+	}
+	bool ok = con->init();
+	lap(PHASE_INIT, mark);
+	ok = ok && con->post_init(payload);
+	lap(PHASE_POST_INIT, mark);
+	for(unsigned int i = 0; i < sizeof(window); i++)
+	{
+		window[i] = 'a' + i % 26;
+	}
+	for(uint32_t sent = 0; ok && sent < payload; sent += sizeof(window))
+	{
+		uint32_t chunk = payload - sent;
+		ok = con->write(window, chunk < sizeof(window) ? chunk : sizeof(window)) > 0;
+	}
+	lap(PHASE_PAYLOAD, mark);
+	ok = ok && con->post(cid, code, length);
+	lap(PHASE_ACTION, mark);
+	body_bytes = 0;
+	ok = ok && con->streamBody(count_body, window, sizeof(window)) >= 0;
+	lap(PHASE_READ, mark);
+	ok = con->terminate() && ok;
+	lap(PHASE_TERMINATE, mark);
+	samples[PHASE_TOTAL].push_back(hostTime() - start);
+	delete con;
+	return ok;
+}
+
+static void report(const char* label, int phase, uint32_t bytes)
+{
+	std::vector<uint64_t> &values = samples[phase];
+	std::sort(values.begin(), values.end());
+	size_t count = values.size();
+	uint64_t median = values[count / 2];
+	printf("%s,%s,%lu,%llu,%llu,%llu,%lu,%.0f\n", label, phase_names[phase], (unsigned long)count,
+		(unsigned long long)values[0], (unsigned long long)median,
+		(unsigned long long)values[(count * 99) / 100], (unsigned long)bytes,
+		bytes > 0 && median > 0 ? bytes * 1000000.0 / median : 0.0);
+}
+
+int main(int argc, char** argv)
+{
+	const char* label = argc > 1 ? argv[1] : "baseline";
+	int runs = argc > 2 ? atoi(argv[2]) : 20;
+	unsigned long latency = argc > 3 ? atol(argv[3]) : 20;
+	unsigned long baud = argc > 4 ? atol(argv[4]) : 19200;
+	uint32_t payload = argc > 5 ? atol(argv[5]) : 512;
+	uint32_t body = argc > 6 ? atol(argv[6]) : 1024;
+
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	CONN settings;
+	settings.cid = 1;
+	settings.contype = (char*)"GPRS";
+	settings.apn = (char*)"internet";
+	char url[] = "www.example.com";
+	emulator.setLatency(latency);
+	emulator.setBaudRate(baud);
+	emulator.setResponse(200, NULL, body);
+
+	int completed = 0;
+	for(; completed < runs; completed++)
+	{
+		if(!cycle(modem, settings, url, payload))
+		{
+			fprintf(stderr, "run %d failed: %d\n", completed, modem.get_error_condition());
+			return 1;
+		}
+	}
+	printf("label,phase,runs,min_us,median_us,p99_us,bytes,bytes_per_s\n");
+	if(completed == 0)
+	{
+		return 0;
+	}
+	for(int phase = 0; phase < PHASE_COUNT; phase++)
+	{
+		uint32_t bytes = 0;
+		if(phase == PHASE_PAYLOAD || phase == PHASE_TOTAL)
+		{
+			bytes += payload;
+		}
+		if(phase == PHASE_READ || phase == PHASE_TOTAL)
+		{
+			bytes += body_bytes;
+		}
+		report(label, phase, bytes);
+	}
+	return 0;
+}
@@ -0,0 +1,169 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//Bytes per second of ResponseMatcher against the window compare() loop
+//waitFor() used before it, on the same input. Prints CSV:
+//
+//  input,matcher,bytes,seconds,bytes_per_s,matches
+//
+//Usage: bench_matcher [megabytes]
+
+#include "Sim900.h"
+#include <chrono>
+#include <vector>
+#include <string>
+
+//The old engine kept the last max(target length, 5) bytes in a ring and
+//compared the whole target and "ERROR" against it after every byte.
+class WindowMatcher
+{
+	private:
+		char _window[SIM900_MAX_TARGET_LENGTH];
+		int _window_pos;
+		int _window_len;
+		const char* _target;
+		int _target_len;
+
+		static bool compare(const char to_test[], const char target[], int pos, int length, int test_len)
+		{
+			int s = pos - length;
+			if(s < 0){s = 0;}
+			for(int i = 0; i < length; i++)
+			{
+				if(to_test[(i+s) % test_len] != target[i])
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+	public:
+		void begin(const char* target)
+		{
+			_target = target;
+			_target_len = strlen(target);
+			_window_len = _target_len < 5 ? 5 : _target_len;
+			memset(_window, 0, sizeof(_window));
+			_window_pos = 0;
+		}
+
+		//0 for the target, 1 for ERROR, -1 for neither.
+		int feed(char c)
+		{
+			_window[_window_pos++ % _window_len] = c;
+			if(_window_pos >= _window_len * 2)
+			{
+				_window_pos -= _window_len;
+			}
+			if(compare(_window, _target, _window_pos, _target_len, _window_len))
+			{
+				return 0;
+			}
+			if(compare(_window, "ERROR", _window_pos, 5, _window_len))
+			{
+				return 1;
+			}
+			return -1;
+		}
+};
+
+//What the modem sends during an upload and a read, with the response
+//tokens waited for appearing every so often.
+static std::string response_input(size_t size)
+{
+	static const char* const lines[] =
+	{
+		"AT+HTTPPARA=\"URL\",\"www.example.com/upload\"\r\r\nOK\r\n",
+		"\r\n+HTTPACTION: 1,200,1024\r\n",
+		"+HTTPREAD: 64\r\nthe quick brown fox jumps over the lazy dog 0123456789abcdef\r\nOK\r\n",
+		"\r\n+CSQ: 17,0\r\n\r\nOK\r\n",
+		"\r\n+CREG: 0,1\r\n"
+	};
+	std::string input;
+	for(size_t i = 0; input.size() < size; i++)
+	{
+		input += lines[i % (sizeof(lines) / sizeof(lines[0]))];
+	}
+	return input;
+}
+
+//Long runs that nearly match the target, the worst case for falling back
+//after a mismatch.
+static std::string repetitive_input(size_t size)
+{
+	std::string input;
+	while(input.size() < size)
+	{
+		input += "OOOOOOOOOOOOOOOOOOOOOOOOOOOOOOOOOOOOOOK\r\n";
+	}
+	return input;
+}
+
+static void report(const char* input, const char* matcher, size_t bytes, double seconds, unsigned long matches)
+{
+	printf("%s,%s,%lu,%.6f,%.0f,%lu\n", input, matcher, (unsigned long)bytes, seconds, bytes / seconds, matches);
+}
+
+static void run(const char* name, const std::string& input, const char* target)
+{
+	ResponseMatcher matcher;
+	WindowMatcher window;
+	unsigned long matches = 0;
+	const char* data = input.data();
+	size_t size = input.size();
+
+	window.begin(target);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < size; i++)
+	{
+		if(window.feed(data[i]) >= 0)
+		{
+			matches++;
+		}
+	}
+	std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+	report(name, "window", size, took.count(), matches);
+
+	//The same tokens beginWait() sets up: the target, then the error
+	//tokens.
+	matcher.add(target);
+	matcher.add("+CME ERROR:", true);
+	matcher.add("+CMS ERROR:", true);
+	matcher.add("ERROR");
+	matches = 0;
+	start = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < size; i++)
+	{
+		if(matcher.feed(data[i]) != SIM900_TOKEN_NONE)
+		{
+			matches++;
+		}
+	}
+	took = std::chrono::steady_clock::now() - start;
+	report(name, "matcher", size, took.count(), matches);
+}
+
+int main(int argc, char** argv)
+{
+	size_t size = (argc > 1 ? atol(argv[1]) : 8) * 1024 * 1024;
+	printf("input,matcher,bytes,seconds,bytes_per_s,matches\n");
+	run("response", response_input(size), "OK\r\n");
+	run("repetitive", repetitive_input(size), "OOOOOOOOOOOOOOOOOOOK");
+	return 0;
+}
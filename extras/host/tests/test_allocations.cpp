@@ -0,0 +1,208 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "Sim900.h"
+#include "Sim900Emulator.h"
+#include "host_test.h"
+#include <new>
+
+//Every heap allocation made while counting is set, through operator new or,
+//with glibc, malloc() and friends (which the shim's String uses).
+static bool counting = false;
+static unsigned long allocations = 0;
+
+void* operator new(size_t size)
+{
+	if(counting)
+	{
+		allocations++;
+	}
+	void* block = malloc(size > 0 ? size : 1);
+	if(block == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	return block;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* block) noexcept
+{
+	free(block);
+}
+
+void operator delete[](void* block) noexcept
+{
+	free(block);
+}
+
+#ifdef __GLIBC__
+extern "C"
+{
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t count, size_t size);
+	void* __libc_realloc(void* block, size_t size);
+
+	void* malloc(size_t size)
+	{
+		if(counting)
+		{
+			allocations++;
+		}
+		return __libc_malloc(size);
+	}
+
+	void* calloc(size_t count, size_t size)
+	{
+		if(counting)
+		{
+			allocations++;
+		}
+		return __libc_calloc(count, size);
+	}
+
+	void* realloc(void* block, size_t size)
+	{
+		if(counting)
+		{
+			allocations++;
+		}
+		return __libc_realloc(block, size);
+	}
+}
+#endif
+
+static void settings_for(CONN &settings)
+{
+	settings.cid = 1;
+	settings.contype = (char*)"GPRS";
+	settings.apn = (char*)"internet";
+}
+
+//Taking a connection, a POST, reading the response, a GET, a signal
+//quality query and terminating, twice so the second cycle reuses
+//everything the first one set up.
+static void request_cycle()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	CONN settings;
+	settings_for(settings);
+	char url[] = "www.example.com";
+	uint8_t body[16];
+	int cid = 0, code = 0, strength = -1, error_rate = -1;
+	int32_t length = 0;
+	emulator.setResponse(200, "accepted", 8);
+
+	counting = true;
+	for(int i = 0; i < 2; i++)
+	{
+		GPRSHTTP* con = modem.createHTTPConnection(settings, url);
+		CHECK(con != NULL);
+		CHECK(con->init());
+		CHECK(con->post_init(5));
+		CHECK(con->write((const uint8_t*)"hello", 5) == 5);
+		CHECK(con->post(cid, code, length));
+		CHECK(code == 200);
+		CHECK(con->readRange(0, body, sizeof(body)) == 8);
+		CHECK(con->get(cid, code, length));
+		CHECK(code == 200);
+		CHECK(con->terminate());
+		delete con;
+		CHECK(modem.getSignalQuality(strength, error_rate));
+	}
+	counting = false;
+	CHECK(allocations == 0);
+}
+
+//A socket opened, echoed through and closed.
+static void socket_cycle()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	CONN settings;
+	settings_for(settings);
+
+	counting = true;
+	GPRSSocket* socket = modem.createSocket(settings, SIM900_TCP, "example.com", 7);
+	CHECK(socket != NULL);
+	CHECK(socket->write((const uint8_t*)"ping", 4) == 4);
+	uint64_t start = hostTime();
+	while(socket->available() < 4)
+	{
+		CHECK(hostTime() - start < 10000000);
+	}
+	CHECK(socket->read() == 'p');
+	CHECK(socket->close());
+	delete socket;
+	counting = false;
+	CHECK(allocations == 0);
+}
+
+//Once the pools are used up, creating another fails instead of falling
+//back to the heap.
+static void exhausted()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	CONN settings;
+	settings_for(settings);
+	char url[] = "www.example.com";
+	GPRSHTTP* connections[SIM900_HTTP_CONNECTIONS];
+	GPRSSocket* sockets[SIM900_SOCKET_POOL];
+
+	counting = true;
+	connections[0] = modem.createHTTPConnection(settings, url);
+	CHECK(connections[0] != NULL);
+	for(int i = 1; i < SIM900_HTTP_CONNECTIONS; i++)
+	{
+		connections[i] = new GPRSHTTP(&modem, 1, url);
+		CHECK(connections[i] != NULL);
+	}
+	CHECK(new GPRSHTTP(&modem, 1, url) == NULL);
+	for(int i = 0; i < SIM900_HTTP_CONNECTIONS; i++)
+	{
+		delete connections[i];
+	}
+	for(int i = 0; i < SIM900_SOCKET_POOL; i++)
+	{
+		sockets[i] = modem.createSocket(settings, SIM900_TCP, "example.com", 7);
+		CHECK(sockets[i] != NULL);
+	}
+	CHECK(new GPRSSocket(&modem, 0) == NULL);
+	for(int i = 0; i < SIM900_SOCKET_POOL; i++)
+	{
+		delete sockets[i];
+	}
+	counting = false;
+	CHECK(allocations == 0);
+}
+
+int main()
+{
+	request_cycle();
+	socket_cycle();
+	exhausted();
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,72 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "Sim900.h"
+#include "Sim900Emulator.h"
+#include "host_test.h"
+
+//The library talks to the emulator and the clock only moves when the
+//library reads it or waits.
+static void query_signal()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	emulator.setSignal(21, 0);
+	int strength = -1, error_rate = -1;
+	CHECK(modem.getSignalQuality(strength, error_rate));
+	CHECK(strength == 21);
+	CHECK(error_rate == 0);
+}
+
+//A modem that never answers runs into SIM900_INPUT_TIMEOUT in virtual time.
+static void time_out()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	emulator.setLatency(2 * SIM900_INPUT_TIMEOUT);
+	int strength = -1, error_rate = -1;
+	unsigned long start = millis();
+	CHECK(!modem.getSignalQuality(strength, error_rate));
+	CHECK(modem.get_error_condition() == SIM900_ERROR_TIMEOUT);
+	unsigned long waited = millis() - start;
+	CHECK(waited >= SIM900_INPUT_TIMEOUT);
+	CHECK(waited < SIM900_INPUT_TIMEOUT + 1000);
+}
+
+static void clock()
+{
+	hostSetTime(5000);
+	delay(250);
+	CHECK(hostTime() == 255000);
+	hostSetTick(0);
+	CHECK(millis() == 255);
+	CHECK(micros() == 255000);
+	hostSetTick(10);
+	hostSetAnalog(8, 700);
+	CHECK(analogRead(8) == 700);
+}
+
+int main()
+{
+	clock();
+	query_signal();
+	time_out();
+	printf("ok\n");
+	return 0;
+}
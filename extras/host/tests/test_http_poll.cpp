@@ -0,0 +1,207 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "Sim900.h"
+#include "Sim900Emulator.h"
+#include "host_test.h"
+
+//No single call may hold the caller up for longer than this much virtual
+//time, the delays of the request (latency, retries, guard times) have to
+//be waited out across poll()s.
+#define MAX_CALL_US 20000
+
+static uint64_t longest_call = 0;
+static unsigned long polls = 0;
+
+static void poll(Sim900 &modem)
+{
+	uint64_t start = hostTime();
+	modem.poll();
+	uint64_t took = hostTime() - start;
+	if(took > longest_call)
+	{
+		longest_call = took;
+	}
+	polls++;
+}
+
+static void run(Sim900 &modem, GPRSHTTP* con)
+{
+	while(!con->isDone())
+	{
+		poll(modem);
+	}
+	CHECK(con->result() == SIM900_ERROR_NO_ERROR);
+}
+
+//A whole POST cycle, from taking the connection to terminating it, driven
+//by poll() alone.
+static void post_cycle()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	CONN settings;
+	settings.cid = 1;
+	settings.contype = (char*)"GPRS";
+	settings.apn = (char*)"internet";
+	char url[] = "www.example.com";
+	uint8_t payload[300];
+	uint8_t body[16];
+	int cid = 0, code = 0;
+	int32_t length = 0;
+	emulator.setLatency(50);
+	emulator.setResponse(200, "accepted", 8);
+	memset(payload, 'p', sizeof(payload));
+
+	GPRSHTTP* con = modem.beginHTTPConnection(settings, url);
+	CHECK(con != NULL);
+	CHECK(!emulator.bearerActive());
+	CHECK(con->beginInit());
+	run(modem, con);
+	CHECK(emulator.bearerActive());
+	CHECK(emulator.httpActive());
+
+	CHECK(con->beginPostInit(sizeof(payload)));
+	run(modem, con);
+	uint32_t sent = 0;
+	while(sent < sizeof(payload))
+	{
+		int room = con->availableForWrite();
+		if(room > 0)
+		{
+			uint64_t start = hostTime();
+			sent += con->write(payload + sent, room);
+			CHECK(hostTime() - start < MAX_CALL_US);
+		}
+		poll(modem);
+	}
+	CHECK(con->availableForWrite() == 0);
+	CHECK(con->beginPost());
+	run(modem, con);
+	CHECK(con->getPostResult(cid, code, length));
+	CHECK(code == 200);
+	CHECK(length == 8);
+	CHECK(emulator.uploaded() == sizeof(payload));
+
+	CHECK(con->beginReadRange(0, body, sizeof(body)));
+	run(modem, con);
+	CHECK(con->received() == 8);
+	CHECK(memcmp(body, "accepted", 8) == 0);
+
+	CHECK(con->beginTerminate());
+	run(modem, con);
+	CHECK(!emulator.httpActive());
+	CHECK(!emulator.bearerActive());
+	delete con;
+	CHECK(longest_call < MAX_CALL_US);
+	printf("post cycle: %lu polls, longest %luus\n", polls, (unsigned long)longest_call);
+}
+
+//The blocking wrapper gives the same result.
+static void blocking_cycle()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	CONN settings;
+	settings.cid = 1;
+	settings.contype = (char*)"GPRS";
+	settings.apn = (char*)"internet";
+	char url[] = "www.example.com";
+	int cid = 0, code = 0;
+	int32_t length = 0;
+	GPRSHTTP* con = modem.createHTTPConnection(settings, url);
+	CHECK(con != NULL);
+	CHECK(con->init());
+	CHECK(con->post_init(5));
+	CHECK(con->write((const uint8_t*)"hello", 5) == 5);
+	CHECK(con->post(cid, code, length));
+	CHECK(code == 200);
+	//The body in one read, and no more than it.
+	char body[16];
+	CHECK(con->init_retrieve());
+	CHECK(con->read(body, sizeof(body)) == (size_t)length);
+	CHECK(con->get_error_condition() == SIM900_ERROR_READ_LIMIT_EXCEEDED);
+	CHECK(con->terminate());
+	delete con;
+}
+
+//A command during a transparent session starts the escape and is refused
+//until poll() has waited out both guard times.
+static void escape()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	CONN settings;
+	settings.cid = 1;
+	settings.contype = (char*)"GPRS";
+	settings.apn = (char*)"internet";
+	Stream* link = modem.beginTransparent(settings, "example.com", 80);
+	CHECK(link != NULL);
+	CHECK(modem.getTransparentState() == SIM900_TRANSPARENT_DATA);
+	longest_call = 0;
+	uint64_t start = hostTime();
+	CHECK(!modem.beginCommand(F("AT+CSQ\r\n"), F("OK")));
+	CHECK(modem.get_error_condition() == SIM900_ERROR_BUSY);
+	CHECK(hostTime() - start < MAX_CALL_US);
+	while(modem.getTransparentState() != SIM900_TRANSPARENT_COMMAND)
+	{
+		poll(modem);
+		CHECK(hostTime() - start < 4000000);
+	}
+	CHECK(hostTime() - start >= 2000000);
+	CHECK(modem.beginCommand(F("AT+CSQ\r\n"), F("OK")));
+	while(!modem.isDone())
+	{
+		poll(modem);
+	}
+	CHECK(modem.result() == SIM900_ERROR_NO_ERROR);
+	CHECK(longest_call < MAX_CALL_US);
+	CHECK(modem.endTransparent());
+}
+
+//A sample's command in flight makes beginCommand() busy instead of
+//waiting for it.
+static void monitor()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	emulator.setLatency(500);
+	//The monitor leaves a modem that is switched off alone.
+	hostSetAnalog(8, 1023);
+	modem.startSignalMonitor(1000);
+	poll(modem);
+	CHECK(!modem.isDone());
+	uint64_t start = hostTime();
+	CHECK(!modem.beginCommand(F("AT+CSQ\r\n"), F("OK")));
+	CHECK(modem.get_error_condition() == SIM900_ERROR_BUSY);
+	CHECK(hostTime() - start < MAX_CALL_US);
+	//The blocking calls still wait for it.
+	int strength = -1, error_rate = -1;
+	CHECK(modem.getSignalQuality(strength, error_rate));
+}
+
+int main()
+{
+	post_cycle();
+	blocking_cycle();
+	escape();
+	monitor();
+	printf("ok\n");
+	return 0;
+}
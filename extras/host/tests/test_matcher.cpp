@@ -0,0 +1,107 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "Sim900.h"
+#include "host_test.h"
+
+//Feeds text and returns the token completed by its last character,
+//failing if one completes any earlier.
+static int feed(ResponseMatcher &matcher, const char* text)
+{
+	int found = SIM900_TOKEN_NONE;
+	for(const char* c = text; *c != '\0'; c++)
+	{
+		CHECK(found == SIM900_TOKEN_NONE);
+		found = matcher.feed(*c);
+	}
+	return found;
+}
+
+//Partial matches that overlap with the token itself.
+static void fall_back()
+{
+	ResponseMatcher matcher;
+	CHECK(matcher.add("aab") == 0);
+	CHECK(feed(matcher, "aaab") == 0);
+	matcher.clear();
+	CHECK(matcher.add("abab!") == 0);
+	CHECK(feed(matcher, "abababab!") == 0);
+	matcher.clear();
+	CHECK(matcher.add(F("OOK")) == 0);
+	CHECK(feed(matcher, "OOOOOOOK") == 0);
+	CHECK(feed(matcher, "xOOK") == 0);
+}
+
+//"ERROR" inside "+CME ERROR:" waits for the longer token and its code.
+static void coded()
+{
+	ResponseMatcher matcher;
+	CHECK(matcher.add("OK") == 0);
+	CHECK(matcher.add("+CME ERROR:", true) == 1);
+	CHECK(matcher.add("ERROR") == 2);
+	CHECK(feed(matcher, "+CME ERROR: 30\r") == 1);
+	CHECK(matcher.code() == 30);
+	CHECK(feed(matcher, "\r\nERROR") == 2);
+	CHECK(feed(matcher, "\r\nOK") == 0);
+}
+
+//The same answer, a byte at a time, as a scan of the whole input.
+static void against_strstr()
+{
+	static const char* const tokens[] = {"+HTTPACTION:", "OK\r\n", "ERROR", "abcabd"};
+	char input[4096];
+	unsigned int seed = 7;
+	for(uint8_t t = 0; t < sizeof(tokens) / sizeof(tokens[0]); t++)
+	{
+		for(int round = 0; round < 50; round++)
+		{
+			size_t length = 0;
+			while(length < sizeof(input) - 1)
+			{
+				seed = seed * 1103515245 + 12345;
+				input[length++] = "abcdOKRE\r\n+"[(seed >> 16) % 11];
+			}
+			input[length] = '\0';
+			const char* expected = strstr(input, tokens[t]);
+			ResponseMatcher matcher;
+			matcher.add(tokens[t]);
+			size_t found = 0;
+			while(found < length && matcher.feed(input[found]) == SIM900_TOKEN_NONE)
+			{
+				found++;
+			}
+			if(expected == NULL)
+			{
+				CHECK(found == length);
+			}else
+			{
+				CHECK(found == (size_t)(expected - input) + strlen(tokens[t]) - 1);
+			}
+		}
+	}
+}
+
+int main()
+{
+	fall_back();
+	coded();
+	against_strstr();
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,244 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "Sim900.h"
+#include "Sim900Emulator.h"
+#include "host_test.h"
+
+//As in test_http_poll, no poll() may hold the caller up for longer than
+//this much virtual time.
+#define MAX_CALL_US 20000
+
+static uint8_t finished = 0;
+static uint64_t longest = 0;
+static uint8_t most_in_flight = 0;
+
+static void handler(SIM900_UPLOAD* upload)
+{
+	(void)upload;
+	finished++;
+}
+
+//Polls until count uploads have been handed back, keeping the longest
+//poll() and the most uploads that ran at once.
+static void run(ModemManager &manager, uint8_t count)
+{
+	uint64_t start = hostTime();
+	finished = 0;
+	longest = 0;
+	most_in_flight = 0;
+	while(finished < count)
+	{
+		uint64_t before = hostTime();
+		manager.poll();
+		if(hostTime() - before > longest)
+		{
+			longest = hostTime() - before;
+		}
+		if(manager.inFlight() > most_in_flight)
+		{
+			most_in_flight = manager.inFlight();
+		}
+		CHECK(hostTime() - start < 300000000);
+	}
+}
+
+static void settings_for(CONN &settings)
+{
+	settings.cid = 1;
+	settings.contype = (char*)"GPRS";
+	settings.apn = (char*)"internet";
+}
+
+static char url[] = "www.example.com";
+static uint8_t data[300];
+
+static void job_for(SIM900_UPLOAD &job)
+{
+	memset(data, 'd', sizeof(data));
+	job.url = url;
+	job.data = data;
+	job.length = sizeof(data);
+	job.urgent = false;
+}
+
+//From taking the connection to terminating it, nothing waits inside
+//poll(), the bearer profile and the chunk interval included.
+static void upload()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	ModemManager manager;
+	CONN settings;
+	settings_for(settings);
+	SIM900_UPLOAD job;
+	job_for(job);
+	emulator.setLatency(50);
+	CHECK(manager.addModem(&modem, settings) == 0);
+	manager.setUploadHandler(handler);
+	CHECK(manager.submit(&job));
+	run(manager, 1);
+	CHECK(longest < MAX_CALL_US);
+	CHECK(job.result == SIM900_ERROR_NO_ERROR);
+	CHECK(job.code == 200);
+	CHECK(job.attempts == 1);
+	CHECK(emulator.uploaded() == sizeof(data));
+	CHECK(manager.inFlight() == 0);
+}
+
+//A transparent session makes the modem busy until the escape that taking
+//the connection starts is over, which is not a failure.
+static void busy()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	ModemManager manager;
+	CONN settings;
+	settings_for(settings);
+	SIM900_UPLOAD job;
+	job_for(job);
+	CHECK(modem.beginTransparent(settings, "example.com", 80) != NULL);
+	CHECK(manager.addModem(&modem, settings) == 0);
+	manager.setUploadHandler(handler);
+	CHECK(manager.submit(&job));
+	manager.poll();
+	CHECK(manager.queued() == 1);
+	CHECK(job.attempts == 0);
+	run(manager, 1);
+	CHECK(longest < MAX_CALL_US);
+	CHECK(job.result == SIM900_ERROR_NO_ERROR);
+	CHECK(job.attempts == 1);
+}
+
+//Two uploads on two modems run side by side with the default pool.
+static void parallel()
+{
+	Sim900Emulator first_emulator, second_emulator;
+	Sim900 first(&first_emulator, 9, 8, VARIANT_2);
+	Sim900 second(&second_emulator, 7, 6, VARIANT_2);
+	ModemManager manager;
+	CONN settings;
+	settings_for(settings);
+	SIM900_UPLOAD jobs[2];
+	job_for(jobs[0]);
+	job_for(jobs[1]);
+	first_emulator.setLatency(50);
+	second_emulator.setLatency(50);
+	CHECK(manager.addModem(&first, settings) == 0);
+	CHECK(manager.addModem(&second, settings) == 1);
+	manager.setUploadHandler(handler);
+	CHECK(manager.submit(&jobs[0]));
+	CHECK(manager.submit(&jobs[1]));
+	run(manager, 2);
+	CHECK(longest < MAX_CALL_US);
+	CHECK(most_in_flight == 2);
+	CHECK(jobs[0].modem != jobs[1].modem);
+	for(int i = 0; i < 2; i++)
+	{
+		CHECK(jobs[i].result == SIM900_ERROR_NO_ERROR);
+		CHECK(jobs[i].attempts == 1);
+	}
+	CHECK(first_emulator.uploaded() == sizeof(data));
+	CHECK(second_emulator.uploaded() == sizeof(data));
+}
+
+//An upload that fails on one modem is tried again on the other.
+static void failover()
+{
+	Sim900Emulator first_emulator, second_emulator;
+	Sim900 first(&first_emulator, 9, 8, VARIANT_2);
+	Sim900 second(&second_emulator, 7, 6, VARIANT_2);
+	ModemManager manager;
+	CONN settings;
+	settings_for(settings);
+	SIM900_UPLOAD job;
+	job_for(job);
+	first_emulator.failCommand("AT+HTTPDATA", 3);
+	CHECK(manager.addModem(&first, settings) == 0);
+	CHECK(manager.addModem(&second, settings) == 1);
+	manager.setUploadHandler(handler);
+	CHECK(manager.submit(&job));
+	run(manager, 1);
+	CHECK(longest < MAX_CALL_US);
+	CHECK(job.result == SIM900_ERROR_NO_ERROR);
+	CHECK(job.attempts == 2);
+	CHECK(job.modem == 1);
+	CHECK(second_emulator.uploaded() == sizeof(data));
+}
+
+//A write that falls short in the middle of the body leaves the modem
+//taking bytes as data. The rest is sent without posting it, only then is
+//the connection terminated, and the upload is tried again.
+static void short_write()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	ModemManager manager;
+	CONN settings;
+	settings_for(settings);
+	SIM900_UPLOAD job;
+	job_for(job);
+	CHECK(manager.addModem(&modem, settings) == 0);
+	manager.setUploadHandler(handler);
+	emulator.refuseUpload(2 * SIM900_WRITE_CHUNK_SIZE);
+	CHECK(manager.submit(&job));
+	uint64_t start = hostTime();
+	run(manager, 1);
+	CHECK(longest < MAX_CALL_US);
+	CHECK(hostTime() - start < SIM900_HTTP_TIMEOUT * 1000UL);
+	CHECK(job.result == SIM900_ERROR_NO_ERROR);
+	CHECK(job.attempts == 2);
+	CHECK(emulator.uploaded() == sizeof(data));
+}
+
+//If the rest cannot be sent either the modem's AT+HTTPDATA time has to
+//run out, which poll() waits for without blocking.
+static void stalled_write()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	ModemManager manager;
+	CONN settings;
+	settings_for(settings);
+	SIM900_UPLOAD job;
+	job_for(job);
+	CHECK(manager.addModem(&modem, settings) == 0);
+	manager.setUploadHandler(handler);
+	emulator.refuseUpload(2 * SIM900_WRITE_CHUNK_SIZE, 2);
+	CHECK(manager.submit(&job));
+	uint64_t start = hostTime();
+	run(manager, 1);
+	CHECK(longest < MAX_CALL_US);
+	CHECK(hostTime() - start >= SIM900_HTTP_TIMEOUT * 1000UL);
+	CHECK(job.result == SIM900_ERROR_NO_ERROR);
+	CHECK(job.attempts == 2);
+	CHECK(emulator.uploaded() == sizeof(data));
+}
+
+int main()
+{
+	upload();
+	busy();
+	parallel();
+	failover();
+	short_write();
+	stalled_write();
+	printf("ok\n");
+	return 0;
+}
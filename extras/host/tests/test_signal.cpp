@@ -0,0 +1,68 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "Sim900.h"
+#include "Sim900Emulator.h"
+#include "host_test.h"
+
+//Polls for seconds of virtual time, a sample a second.
+static void wait(Sim900 &modem, unsigned long seconds)
+{
+	uint64_t end = hostTime() + seconds * 1000000ULL;
+	while(hostTime() < end)
+	{
+		modem.poll();
+	}
+}
+
+//A steady level is reached exactly from either side, so one right at the
+//good threshold opens the window. It stays open down to the bad threshold.
+static void settles()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	hostSetAnalog(8, 1023);
+	modem.setSignalThresholds(12, 8);
+	emulator.setSignal(5, 0);
+	modem.startSignalMonitor(1000);
+	wait(modem, 5);
+	CHECK(modem.getSmoothedSignal() == 5);
+	CHECK(!modem.canTransmit());
+	emulator.setSignal(12, 0);
+	wait(modem, 60);
+	CHECK(modem.getSmoothedSignal() == 12);
+	CHECK(modem.canTransmit());
+	emulator.setSignal(31, 0);
+	wait(modem, 60);
+	CHECK(modem.getSmoothedSignal() == 31);
+	emulator.setSignal(8, 0);
+	wait(modem, 60);
+	CHECK(modem.getSmoothedSignal() == 8);
+	CHECK(modem.canTransmit());
+	emulator.setSignal(7, 0);
+	wait(modem, 60);
+	CHECK(!modem.canTransmit());
+}
+
+int main()
+{
+	settles();
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+  Sim900 is an Arduino library for working with the Sim900 GRPS Shield
+  Copyright (C) 2012  Nigel Bajema
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "Sim900.h"
+#include "Sim900Emulator.h"
+#include "host_test.h"
+
+static int handled = 0;
+static SIM900_SMS last;
+
+static void handler(const SIM900_SMS* sms)
+{
+	handled++;
+	last = *sms;
+}
+
+//"Hi" from +31641600986, 7 bit text. Short enough for both to be listed
+//within SIM900_EMULATOR_BUFFER.
+static const char deliver[] = "00040B911346610089F6000020806291731408" "02C834";
+//"hi" to +46708251358, a message the modem has stored as sent.
+static const char submit[] = "0011000B916407281553F80000AA02E834";
+
+//AT+CMGL=4 lists stored SUBMITs too. They are skipped rather than read as
+//a DELIVER, and the delete of the read messages leaves them in place.
+static void list_skips_submit()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	emulator.storeSMS(submit, 3);
+	emulator.receiveSMS(deliver);
+	CHECK(modem.readSMS(handler) == 1);
+	CHECK(handled == 1);
+	CHECK(strcmp(last.sender, "+31641600986") == 0);
+	CHECK(last.text);
+	CHECK(last.length == 2);
+	CHECK(memcmp(last.data, "Hi", 2) == 0);
+	CHECK(modem.readSMS(handler) == 0);
+	CHECK(handled == 1);
+}
+
+//A listing that fails leaves the count of waiting messages alone.
+static void failed_list()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	emulator.receiveSMS(deliver);
+	uint64_t start = hostTime();
+	while(modem.smsWaiting() == 0)
+	{
+		modem.poll();
+		CHECK(hostTime() - start < 1000000);
+	}
+	emulator.failCommand("AT+CMGL");
+	handled = 0;
+	CHECK(modem.readSMS(handler) == -1);
+	CHECK(modem.smsWaiting() == 1);
+	CHECK(modem.readSMS(handler) == 1);
+	CHECK(handled == 1);
+	CHECK(modem.smsWaiting() == 0);
+}
+
+//Only digits, after an optional +, are taken as a number.
+static void number()
+{
+	Sim900Emulator emulator;
+	Sim900 modem(&emulator, 9, 8, VARIANT_2);
+	const uint8_t data[] = {1, 2, 3};
+	CHECK(!modem.sendSMS("+3164160098a", data, sizeof(data)));
+	CHECK(modem.get_error_condition() == SIM900_ERROR_CHARACTER_LIMIT_EXCEEDED);
+	CHECK(!modem.sendSMS("", data, sizeof(data)));
+	CHECK(!modem.sendSMS("+", data, sizeof(data)));
+	CHECK(emulator.smsSent() == 0);
+	CHECK(modem.sendSMS("+31641600986", data, sizeof(data)));
+	CHECK(emulator.smsSent() == 1);
+}
+
+int main()
+{
+	list_skips_submit();
+	failed_list();
+	number();
+	printf("ok\n");
+	return 0;
+}